@@ -28,6 +28,391 @@ MenuItem PickRandomMenuItem() {
     return BENSCHILLIBOWLMenu[index];
 }
 
+#ifdef ORDER_RING
+
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Tries on a full or empty ring before going to sleep
+#define ORDER_SPINS 100
+
+/* Sleep until *word no longer holds `seen` (or a spurious wake-up) */
+static void FutexWait(atomic_uint* word, unsigned int seen) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+/* Wake `count` threads sleeping in Park() on `word`, if there are any.
+   The caller has just published its change to the ring. */
+static void Notify(atomic_uint* word, atomic_int* waiters, int count) {
+    // Pairs with the fence in Park(): either the sleeper sees the change
+    // when it tries again, or we see the sleeper here
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiters, memory_order_relaxed) > 0) {
+        atomic_fetch_add(word, 1);
+        syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+    }
+}
+
+/* Claim the next slot for `order`. Returns false when the ring is full. */
+static bool TryAddOrder(BENSCHILLIBOWL* bcb, Order* order) {
+    size_t pos = atomic_load_explicit(&bcb->add_position, memory_order_relaxed);
+    while (1) {
+        OrderSlot* slot = &bcb->slots[pos % bcb->max_size];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            // The slot is free for this position; take the position
+            if (atomic_compare_exchange_weak_explicit(&bcb->add_position, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->order = order;
+                atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+            // pos was reloaded, try again
+        } else if (diff < 0) {
+            // The slot still holds the order from one lap ago
+            return false;
+        } else {
+            // Another customer took this position first
+            pos = atomic_load_explicit(&bcb->add_position, memory_order_relaxed);
+        }
+    }
+}
+
+/* Take the oldest order. Returns NULL when the ring is empty. */
+static Order* TryGetOrder(BENSCHILLIBOWL* bcb) {
+    size_t pos = atomic_load_explicit(&bcb->get_position, memory_order_relaxed);
+    while (1) {
+        OrderSlot* slot = &bcb->slots[pos % bcb->max_size];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&bcb->get_position, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                Order* order = slot->order;
+                // Free the slot for the customer one lap ahead
+                atomic_store_explicit(&slot->sequence, pos + bcb->max_size, memory_order_release);
+                return order;
+            }
+        } else if (diff < 0) {
+            // Nothing has been added at this position yet
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&bcb->get_position, memory_order_relaxed);
+        }
+    }
+}
+
+/* Allocate the Restaurant and its ring; every slot starts free for the
+   first lap */
+BENSCHILLIBOWL* OpenRestaurant(int max_size, int expected_num_orders) {
+    // With one slot a filled sequence number would read as free for the
+    // next lap, so the smallest ring has two
+    if (max_size < 2) max_size = 2;
+
+    BENSCHILLIBOWL* bcb = (BENSCHILLIBOWL*) aligned_alloc(CACHE_LINE, sizeof(BENSCHILLIBOWL));
+    OrderSlot* slots = (OrderSlot*) malloc(max_size * sizeof(OrderSlot));
+    if (bcb == NULL || slots == NULL) {
+        perror("Could not open the restaurant");
+        exit(1);
+    }
+    memset(bcb, 0, sizeof(BENSCHILLIBOWL));
+
+    bcb->slots = slots;
+    bcb->max_size = max_size;
+    bcb->expected_num_orders = expected_num_orders;
+    for (int i = 0; i < max_size; i++) {
+        atomic_init(&slots[i].sequence, i);
+        slots[i].order = NULL;
+    }
+    atomic_init(&bcb->next_order_number, 1);
+
+    printf("Restaurant is open!\n");
+    return bcb;
+}
+
+/* check that the number of orders received is equal to the number handled, then free the ring */
+void CloseRestaurant(BENSCHILLIBOWL* bcb) {
+    int handled = atomic_load(&bcb->orders_handled);
+    if (handled != bcb->expected_num_orders) {
+        fprintf(stderr, "Warning: Expected %d orders, but handled %d\n",
+                bcb->expected_num_orders, handled);
+    }
+
+    // Free any orders nobody took
+    Order* order;
+    while ((order = TryGetOrder(bcb)) != NULL) {
+        free(order);
+    }
+
+    free(bcb->slots);
+    free(bcb);
+
+    printf("Restaurant is closed!\n");
+}
+
+/* add an order to the ring, sleeping while it is full */
+int AddOrder(BENSCHILLIBOWL* bcb, Order* order) {
+    order->order_number = atomic_fetch_add_explicit(&bcb->next_order_number, 1, memory_order_relaxed);
+    order->next = NULL;
+
+    int tries = 0;
+    while (!TryAddOrder(bcb, order)) {
+        if (++tries < ORDER_SPINS) continue;
+
+        // Announce ourselves before the last look, so a cook freeing a
+        // slot after it is sure to wake us
+        atomic_fetch_add(&bcb->add_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        unsigned int seen = atomic_load(&bcb->can_add_orders);
+        if (TryAddOrder(bcb, order)) {
+            atomic_fetch_sub(&bcb->add_waiters, 1);
+            break;
+        }
+        FutexWait(&bcb->can_add_orders, seen);
+        atomic_fetch_sub(&bcb->add_waiters, 1);
+        tries = 0;
+    }
+
+    Notify(&bcb->can_get_orders, &bcb->get_waiters, 1);
+    return order->order_number;
+}
+
+/* take an order from the ring, sleeping while it is empty. Returns NULL
+   once every expected order has been taken. */
+Order *GetOrder(BENSCHILLIBOWL* bcb) {
+    int tries = 0;
+    Order* order;
+    while ((order = TryGetOrder(bcb)) == NULL) {
+        if (atomic_load(&bcb->orders_handled) >= bcb->expected_num_orders) {
+            return NULL;
+        }
+        if (++tries < ORDER_SPINS) continue;
+
+        atomic_fetch_add(&bcb->get_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        unsigned int seen = atomic_load(&bcb->can_get_orders);
+        if ((order = TryGetOrder(bcb)) != NULL) {
+            atomic_fetch_sub(&bcb->get_waiters, 1);
+            break;
+        }
+        if (atomic_load(&bcb->orders_handled) >= bcb->expected_num_orders) {
+            atomic_fetch_sub(&bcb->get_waiters, 1);
+            return NULL;
+        }
+        FutexWait(&bcb->can_get_orders, seen);
+        atomic_fetch_sub(&bcb->get_waiters, 1);
+        tries = 0;
+    }
+
+    Notify(&bcb->can_add_orders, &bcb->add_waiters, 1);
+
+    // The last order: no more are coming, so wake every cook still waiting
+    if (atomic_fetch_add(&bcb->orders_handled, 1) + 1 == bcb->expected_num_orders) {
+        Notify(&bcb->can_get_orders, &bcb->get_waiters, INT_MAX);
+    }
+    return order;
+}
+
+#elif defined(ORDER_SHARDS)
+
+#include <limits.h>
+
+// Each thread's queue once it has called GetOrder() (cooks only)
+static __thread int home_shard = -1;
+
+/* The queue a customer's orders go to */
+static OrderShard* ShardFor(BENSCHILLIBOWL* bcb, int customer_id) {
+    unsigned int hash = (unsigned int) customer_id * 2654435761u;
+    return &bcb->shards[(hash >> 16) % KITCHEN_SHARDS];
+}
+
+/* Append in O(1): the shard keeps its tail */
+static void PushOrder(OrderShard* shard, Order* order) {
+    order->next = NULL;
+    pthread_mutex_lock(&shard->lock);
+    if (shard->tail != NULL) {
+        shard->tail->next = order;
+    } else {
+        shard->head = order;
+    }
+    shard->tail = order;
+    atomic_fetch_add(&shard->size, 1);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/* Take the oldest order of a shard, or NULL without locking an empty one */
+static Order* PopOrder(OrderShard* shard) {
+    if (atomic_load_explicit(&shard->size, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&shard->lock);
+    Order* order = shard->head;
+    if (order != NULL) {
+        shard->head = order->next;
+        if (shard->head == NULL) {
+            shard->tail = NULL;
+        }
+        atomic_fetch_sub(&shard->size, 1);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return order;
+}
+
+/* The cook's own queue first, then steal from the others in turn */
+static Order* TakeOrder(BENSCHILLIBOWL* bcb) {
+    for (int i = 0; i < KITCHEN_SHARDS; i++) {
+        Order* order = PopOrder(&bcb->shards[(home_shard + i) % KITCHEN_SHARDS]);
+        if (order != NULL) {
+            return order;
+        }
+    }
+    return NULL;
+}
+
+static bool AllShardsEmpty(BENSCHILLIBOWL* bcb) {
+    for (int i = 0; i < KITCHEN_SHARDS; i++) {
+        if (atomic_load(&bcb->shards[i].size) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Wake one (or every) thread sleeping on `cond`, if there are any. The
+   caller has just made its change with an atomic operation. */
+static void Wake(BENSCHILLIBOWL* bcb, atomic_int* waiters, pthread_cond_t* cond, bool all) {
+    // Pairs with the sleeper counting itself before its last check:
+    // either it sees the change or we see it here
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiters, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&(bcb->mutex));
+        if (all) {
+            pthread_cond_broadcast(cond);
+        } else {
+            pthread_cond_signal(cond);
+        }
+        pthread_mutex_unlock(&(bcb->mutex));
+    }
+}
+
+/* Allocate the Restaurant with every queue empty */
+BENSCHILLIBOWL* OpenRestaurant(int max_size, int expected_num_orders) {
+    BENSCHILLIBOWL* bcb = (BENSCHILLIBOWL*) aligned_alloc(CACHE_LINE, sizeof(BENSCHILLIBOWL));
+    if (bcb == NULL) {
+        perror("Could not open the restaurant");
+        exit(1);
+    }
+    memset(bcb, 0, sizeof(BENSCHILLIBOWL));
+
+    for (int i = 0; i < KITCHEN_SHARDS; i++) {
+        pthread_mutex_init(&(bcb->shards[i].lock), NULL);
+        bcb->shards[i].head = NULL;
+        bcb->shards[i].tail = NULL;
+        atomic_init(&bcb->shards[i].size, 0);
+    }
+    bcb->max_size = max_size;
+    bcb->expected_num_orders = expected_num_orders;
+    atomic_init(&bcb->next_order_number, 1);
+    pthread_mutex_init(&(bcb->mutex), NULL);
+    pthread_cond_init(&(bcb->can_add_orders), NULL);
+    pthread_cond_init(&(bcb->can_get_orders), NULL);
+
+    printf("Restaurant is open!\n");
+    return bcb;
+}
+
+/* check that the number of orders received is equal to the number handled, then free every queue */
+void CloseRestaurant(BENSCHILLIBOWL* bcb) {
+    int handled = atomic_load(&bcb->orders_handled);
+    if (handled != bcb->expected_num_orders) {
+        fprintf(stderr, "Warning: Expected %d orders, but handled %d\n",
+                bcb->expected_num_orders, handled);
+    }
+
+    for (int i = 0; i < KITCHEN_SHARDS; i++) {
+        Order* order;
+        while ((order = PopOrder(&bcb->shards[i])) != NULL) {
+            free(order);
+        }
+        pthread_mutex_destroy(&(bcb->shards[i].lock));
+    }
+    pthread_mutex_destroy(&(bcb->mutex));
+    pthread_cond_destroy(&(bcb->can_add_orders));
+    pthread_cond_destroy(&(bcb->can_get_orders));
+    free(bcb);
+
+    printf("Restaurant is closed!\n");
+}
+
+/* add an order to the customer's queue, waiting while the restaurant is full */
+int AddOrder(BENSCHILLIBOWL* bcb, Order* order) {
+    order->order_number = atomic_fetch_add_explicit(&bcb->next_order_number, 1, memory_order_relaxed);
+
+    // Reserve a place in the restaurant
+    int size = atomic_load(&bcb->current_size);
+    while (1) {
+        if (size < bcb->max_size) {
+            if (atomic_compare_exchange_weak(&bcb->current_size, &size, size + 1)) {
+                break;
+            }
+            continue;       // size was reloaded
+        }
+
+        pthread_mutex_lock(&(bcb->mutex));
+        atomic_fetch_add(&bcb->add_waiters, 1);
+        while (atomic_load(&bcb->current_size) >= bcb->max_size) {
+            pthread_cond_wait(&(bcb->can_add_orders), &(bcb->mutex));
+        }
+        atomic_fetch_sub(&bcb->add_waiters, 1);
+        pthread_mutex_unlock(&(bcb->mutex));
+        size = atomic_load(&bcb->current_size);
+    }
+
+    PushOrder(ShardFor(bcb, order->customer_id), order);
+    Wake(bcb, &bcb->get_waiters, &(bcb->can_get_orders), false);
+    return order->order_number;
+}
+
+/* take an order, from this cook's queue if it has one, otherwise stolen
+   from another. Returns NULL once every expected order has been taken. */
+Order *GetOrder(BENSCHILLIBOWL* bcb) {
+    if (home_shard == -1) {
+        home_shard = atomic_fetch_add(&bcb->next_home, 1) % KITCHEN_SHARDS;
+    }
+
+    Order* order;
+    while ((order = TakeOrder(bcb)) == NULL) {
+        if (atomic_load(&bcb->orders_handled) >= bcb->expected_num_orders) {
+            return NULL;
+        }
+
+        pthread_mutex_lock(&(bcb->mutex));
+        atomic_fetch_add(&bcb->get_waiters, 1);
+        while (AllShardsEmpty(bcb) && atomic_load(&bcb->orders_handled) < bcb->expected_num_orders) {
+            pthread_cond_wait(&(bcb->can_get_orders), &(bcb->mutex));
+        }
+        atomic_fetch_sub(&bcb->get_waiters, 1);
+        pthread_mutex_unlock(&(bcb->mutex));
+    }
+
+    atomic_fetch_sub(&bcb->current_size, 1);
+    Wake(bcb, &bcb->add_waiters, &(bcb->can_add_orders), false);
+
+    // The last order: no more are coming, so wake every cook still waiting
+    if (atomic_fetch_add(&bcb->orders_handled, 1) + 1 == bcb->expected_num_orders) {
+        Wake(bcb, &bcb->get_waiters, &(bcb->can_get_orders), true);
+    }
+    return order;
+}
+
+#else
+
 /* Allocate memory for the Restaurant, then create the mutex and condition variables needed to instantiate the Restaurant */
 BENSCHILLIBOWL* OpenRestaurant(int max_size, int expected_num_orders) {
     // Allocate memory for the restaurant
@@ -165,4 +550,6 @@ void AddOrderToBack(Order **orders, Order *order) {
         }
         current->next = order;
     }
-}
\ No newline at end of file
+}
+
+#endif
@@ -15,6 +15,81 @@ typedef struct OrderStruct {
     struct OrderStruct *next;
 } Order;
 
+#if defined(ORDER_RING) || defined(ORDER_SHARDS)
+#include <stdatomic.h>
+
+#define CACHE_LINE 64
+#endif
+
+#ifdef ORDER_RING
+
+// One slot of the lock-free order ring. Its sequence number says whose
+// turn it is: a customer may fill it once it equals the position being
+// added, a cook may take it once it is one past the position being taken.
+typedef struct OrderSlot {
+    atomic_size_t sequence;
+    Order* order;
+} OrderSlot;
+
+// The restaurant built with -DORDER_RING keeps its orders in a bounded
+// ring of max_size slots instead of a locked list:
+//  - customers and cooks each claim a position with one compare-and-swap
+//    on their own counter, kept on separate cache lines
+//  - a customer finding the ring full, or a cook finding it empty, spins
+//    briefly and then sleeps on a futex; the other side only makes the
+//    wake-up system call when someone is actually asleep
+typedef struct Restaurant {
+    OrderSlot* slots;
+    int max_size;
+    int expected_num_orders;
+    _Alignas(CACHE_LINE) atomic_size_t add_position;     // Next slot to fill
+    _Alignas(CACHE_LINE) atomic_size_t get_position;     // Next slot to take
+    _Alignas(CACHE_LINE) atomic_int next_order_number;
+    atomic_int orders_handled;
+    // Futex words, bumped before waking whoever sleeps on them
+    _Alignas(CACHE_LINE) atomic_uint can_add_orders;
+    atomic_int add_waiters;
+    _Alignas(CACHE_LINE) atomic_uint can_get_orders;
+    atomic_int get_waiters;
+} BENSCHILLIBOWL;
+
+#elif defined(ORDER_SHARDS)
+
+#ifndef KITCHEN_SHARDS
+#define KITCHEN_SHARDS 10   // One per cook in main.c
+#endif
+
+// One cook's queue of orders in the sharded kitchen
+typedef struct OrderShard {
+    _Alignas(CACHE_LINE) pthread_mutex_t lock;
+    Order* head;
+    Order* tail;
+    atomic_int size;            // Orders queued; read without the lock
+} OrderShard;
+
+// The restaurant built with -DORDER_SHARDS splits its orders over
+// KITCHEN_SHARDS queues, each with its own lock:
+//  - a customer's orders all go to the queue its ID hashes to
+//  - each cook owns one queue, handed out on its first GetOrder(); it
+//    serves that queue and steals from the others when it runs dry
+//  - max_size still bounds all the orders in the restaurant together
+//  - customers and cooks only touch the restaurant-wide mutex to sleep,
+//    when it is full or every queue is empty
+typedef struct Restaurant {
+    OrderShard shards[KITCHEN_SHARDS];
+    int max_size;
+    int expected_num_orders;
+    atomic_int next_home;       // Queue for the next cook to show up
+    _Alignas(CACHE_LINE) atomic_int current_size;
+    _Alignas(CACHE_LINE) atomic_int next_order_number;
+    _Alignas(CACHE_LINE) atomic_int orders_handled;
+    _Alignas(CACHE_LINE) pthread_mutex_t mutex;
+    pthread_cond_t can_add_orders, can_get_orders;
+    atomic_int add_waiters, get_waiters;
+} BENSCHILLIBOWL;
+
+#else
+
 // A restuarant contains:
 //  - An array of orders
 //  - its current size (the number of orders currently handled by the restaurant)
@@ -38,6 +113,8 @@ typedef struct Restaurant {
     pthread_cond_t can_add_orders, can_get_orders;
 } BENSCHILLIBOWL;
 
+#endif
+
 /**
  * Picks a random menu item and returns it.
  */
@@ -0,0 +1,165 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "server.h"
+#include "admin.h"
+#include "metrics.h"
+
+#define ADMIN_REPLY 8192
+
+static int admin_fd = -1;
+static long started_ns;
+
+// Rates are measured between consecutive `stats` requests
+static MetricsSnapshot last_snapshot;
+static long last_ns;
+
+static size_t format_stats(char *buf, size_t cap) {
+    MetricsSnapshot *now = (MetricsSnapshot*) malloc(sizeof(MetricsSnapshot));
+    if (now == NULL) {
+        return snprintf(buf, cap, "error out of memory\nEND\n");
+    }
+    metrics_snapshot(now);
+    long t = metrics_now_ns();
+
+    size_t len = snprintf(buf, cap, "uptime_s %.1f\n", (t - started_ns) / 1e9);
+    len += metrics_format(buf + len, cap - len, now, &last_snapshot, t - last_ns);
+
+    SlabPool *pools[] = { &user_pool, &room_pool };
+    for (int i = 0; i < 2 && len < cap; i++) {
+        SlabStats st;
+        slab_stats(pools[i], &st);
+        len += snprintf(buf + len, cap - len,
+                        "pool_%s allocs %ld frees %ld live %ld chunks %ld refills %ld\n",
+                        st.name, st.allocs, st.frees, st.live, st.chunks, st.refills);
+    }
+    if (len < cap) {
+        len += snprintf(buf + len, cap - len, "END\n");
+    }
+    if (len >= cap) len = cap - 1;
+
+    last_snapshot = *now;
+    last_ns = t;
+    free(now);
+    return len;
+}
+
+static int admin_write(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Serve one admin client until it quits or hangs up
+static void admin_session(int fd) {
+    char in[512];
+    size_t have = 0;
+    char *reply = (char*) malloc(ADMIN_REPLY);
+    if (reply == NULL) return;
+
+    while (1) {
+        ssize_t n = read(fd, in + have, sizeof(in) - 1 - have);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        have += n;
+        in[have] = '\0';
+
+        char *line = in;
+        char *nl;
+        while ((nl = strchr(line, '\n')) != NULL) {
+            *nl = '\0';
+            char *cmd = trimwhitespace(line);
+            line = nl + 1;
+
+            size_t len;
+            if (strcmp(cmd, "stats") == 0) {
+                len = format_stats(reply, ADMIN_REPLY);
+            } else if (strcmp(cmd, "quit") == 0) {
+                free(reply);
+                return;
+            } else if (strcmp(cmd, "help") == 0 || cmd[0] == '\0') {
+                len = snprintf(reply, ADMIN_REPLY, "commands: stats help quit\n");
+            } else {
+                len = snprintf(reply, ADMIN_REPLY, "unknown command '%.64s'\n", cmd);
+            }
+            if (admin_write(fd, reply, len) == -1) {
+                free(reply);
+                return;
+            }
+        }
+
+        // Keep a partial command; drop one that cannot fit
+        have = strlen(line);
+        if (have >= sizeof(in) - 1) have = 0;
+        memmove(in, line, have);
+    }
+    free(reply);
+}
+
+static void *admin_main(void *arg) {
+    while (1) {
+        int fd = accept(admin_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("admin accept");
+            return NULL;
+        }
+        admin_session(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int admin_socket() {
+    return admin_fd;
+}
+
+// Bind the loopback listener
+static int admin_listen(int port) {
+    int opt = TRUE;
+    struct sockaddr_in address;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("admin socket");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(fd, BACKLOG) == -1) {
+        perror("admin bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int admin_start(int port, int fd) {
+    started_ns = last_ns = metrics_now_ns();
+
+    if ((admin_fd = fd != -1 ? fd : admin_listen(port)) == -1) {
+        return -1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, admin_main, NULL) != 0) {
+        perror("pthread_create admin");
+        return -1;
+    }
+    pthread_detach(tid);
+    printf("Admin port: %d (loopback)\n", port);
+    return 0;
+}
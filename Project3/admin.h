@@ -0,0 +1,24 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef ADMIN_H
+#define ADMIN_H
+
+// Admin port: a line-based text protocol on its own listener, bound to
+// the loopback interface, served by one background thread. Commands:
+//   stats   counters, rates since the previous `stats`, histograms and
+//           allocator pools, terminated by a line reading "END"
+//   help    list commands
+//   quit    close the admin connection
+// It never touches rw_lock, so it keeps answering while the chat side
+// is wedged.
+
+// Start the admin thread listening on `port`, or on the already bound
+// listener `fd` if it is not -1 (hot restart). Returns -1 on failure.
+int admin_start(int port, int fd);
+
+// The admin listener, -1 if there is none
+int admin_socket();
+
+#endif
@@ -0,0 +1,528 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+// Load generator and latency benchmark for the chat server.
+//
+// Opens N simulated clients spread over a few threads. Every client logs
+// in, leaves the Lobby and joins one of the benchmark rooms, then sends
+// commands at a fixed rate, picking each one from a weighted mix of
+//   msg    - a chat message carrying its send time
+//   join   - join (or leave, if already in it) a random benchmark room
+//   login  - rename between two names owned by the client
+//   users  - list all users
+// Every copy of a message that reaches another client is a delivery, and
+// its latency is the receive time minus the embedded send time. Results
+// are printed as a single JSON object so runs can be diffed against a
+// saved baseline.
+//
+// Usage: ./bench [-a addr] [-p port] [-c clients] [-t threads]
+//                [-d seconds] [-r rooms] [-R rate] [-m msg,join,login,users]
+//                [-L]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define MAX_ROOMS     64          // Room membership is tracked in a uint64_t
+#define CARRY_MAX     4096        // Longest partial line kept between reads
+#define MAX_SAMPLES   (4 << 20)   // Latency samples kept per thread
+#define SETTLE_MS     500         // Pause between setup and measuring
+
+enum { OP_MSG, OP_JOIN, OP_LOGIN, OP_USERS, NUM_OPS };
+static const char *op_names[] = { "msg", "join", "login", "users" };
+
+static const char *server_addr = "127.0.0.1";
+static int server_port = 8888;
+static int num_clients = 50;
+static int num_threads = 4;
+static int seconds = 5;
+static int num_rooms = 4;
+static double rate = 10.0;                    // Commands per client per second
+static int mix[NUM_OPS] = { 80, 10, 5, 5 };
+static int stay_in_lobby = 0;
+
+static atomic_int running;
+static long start_ns;                         // Start of the measured window
+
+typedef struct Client {
+    int id;
+    int fd;
+    uint64_t rooms;                           // Benchmark rooms joined
+    int renamed;                              // Which of its two names is in use
+    long next_send;                           // ns
+    char carry[CARRY_MAX];
+    size_t carry_len;
+} Client;
+
+typedef struct Worker {
+    int id;
+    Client *clients;
+    int nclients;
+    unsigned int seed;
+    long *samples;                            // Delivery latencies in ns
+    long nsamples;
+    long dropped_samples;                     // Past MAX_SAMPLES
+    long sent[NUM_OPS + 1];                   // Last slot counts leaves
+    long delivered;
+    long stalls;                              // Commands skipped on a full socket
+    long bytes_in;
+    long errors;
+} Worker;
+
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-a addr] [-p port] [-c clients] [-t threads] [-d seconds]\n"
+                    "          [-r rooms] [-R rate] [-m msg,join,login,users] [-L]\n", prog);
+    fprintf(stderr, "  -R rate     commands per client per second (default 10)\n");
+    fprintf(stderr, "  -m weights  command mix (default 80,10,5,5)\n");
+    fprintf(stderr, "  -L          keep clients in the Lobby as well\n");
+}
+
+/////////////////// CONNECTIONS //////////////////////////
+
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+                poll(&pfd, 1, 1000);
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_cmd(int fd, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static int send_cmd(int fd, const char *fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    return send_all(fd, line, len);
+}
+
+static int connect_client(Client *c) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server_port);
+    if (inet_pton(AF_INET, server_addr, &addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address: %s\n", server_addr);
+        return -1;
+    }
+
+    if ((c->fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(c->fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        perror("connect");
+        close(c->fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 0;
+}
+
+// Blocking setup: name the client and put it in its home room
+static int setup_client(Client *c) {
+    int home = c->id % num_rooms;
+
+    if (send_cmd(c->fd, "login b%d\n", c->id) == -1) return -1;
+    if (!stay_in_lobby && send_cmd(c->fd, "leave Lobby\n") == -1) return -1;
+    if (send_cmd(c->fd, "join bench%d\n", home) == -1) return -1;
+    c->rooms = (uint64_t) 1 << home;
+    return 0;
+}
+
+/////////////////// WORKERS //////////////////////////
+
+static int pick_op(Worker *w) {
+    int total = 0;
+    for (int i = 0; i < NUM_OPS; i++) total += mix[i];
+    int roll = rand_r(&w->seed) % total;
+    for (int i = 0; i < NUM_OPS; i++) {
+        if (roll < mix[i]) return i;
+        roll -= mix[i];
+    }
+    return OP_MSG;
+}
+
+static void send_op(Worker *w, Client *c) {
+    char line[256];
+    int len;
+    int op = pick_op(w);
+    int slot = op;
+
+    switch (op) {
+    case OP_JOIN: {
+        int room = rand_r(&w->seed) % num_rooms;
+        uint64_t bit = (uint64_t) 1 << room;
+        if (c->rooms & bit) {
+            len = snprintf(line, sizeof(line), "leave bench%d\n", room);
+            slot = NUM_OPS;
+        } else {
+            len = snprintf(line, sizeof(line), "join bench%d\n", room);
+        }
+        c->rooms ^= bit;
+        break;
+    }
+    case OP_LOGIN:
+        c->renamed = !c->renamed;
+        len = snprintf(line, sizeof(line), "login b%d%s\n", c->id, c->renamed ? "x" : "");
+        break;
+    case OP_USERS:
+        len = snprintf(line, sizeof(line), "users\n");
+        break;
+    default:
+        len = snprintf(line, sizeof(line), "ping %d %ld\n", c->id, now_ns());
+        break;
+    }
+
+    // Open loop: a client that cannot take a whole command right now
+    // skips it rather than falling behind schedule
+    ssize_t n = send(c->fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n == len) {
+        w->sent[slot]++;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        w->stalls++;
+    } else if (n > 0) {
+        // Partial line: finish it so the stream stays framed
+        send_all(c->fd, line + n, len - n);
+        w->sent[slot]++;
+    } else {
+        w->errors++;
+    }
+}
+
+static void record(Worker *w, long latency) {
+    if (w->nsamples < MAX_SAMPLES) {
+        w->samples[w->nsamples++] = latency;
+    } else {
+        w->dropped_samples++;
+    }
+}
+
+// Look for "::name> ping <id> <ns>" lines that another client sent
+static void scan_line(Worker *w, Client *c, char *line, long now) {
+    char *p = strstr(line, "> ping ");
+    if (p == NULL) return;
+
+    char *end;
+    long sender = strtol(p + 7, &end, 10);
+    if (end == p + 7 || sender == c->id) return;   // Our own echo
+    long sent = strtol(end, NULL, 10);
+    if (sent < start_ns) return;                    // From before the window
+
+    w->delivered++;
+    record(w, now - sent);
+}
+
+static int drain_client(Worker *w, Client *c) {
+    char buf[16384];
+
+    while (1) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0) return -1;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        long now = now_ns();
+        w->bytes_in += n;
+
+        char *pos = buf;
+        char *end = buf + n;
+        char *nl;
+        while ((nl = (char*) memchr(pos, '\n', end - pos)) != NULL) {
+            *nl = '\0';
+            if (c->carry_len > 0) {
+                size_t take = nl - pos;
+                if (c->carry_len + take >= CARRY_MAX) take = CARRY_MAX - c->carry_len - 1;
+                memcpy(c->carry + c->carry_len, pos, take);
+                c->carry[c->carry_len + take] = '\0';
+                scan_line(w, c, c->carry, now);
+                c->carry_len = 0;
+            } else {
+                scan_line(w, c, pos, now);
+            }
+            pos = nl + 1;
+        }
+
+        size_t rest = end - pos;
+        if (c->carry_len + rest >= CARRY_MAX) rest = CARRY_MAX - c->carry_len - 1;
+        memcpy(c->carry + c->carry_len, pos, rest);
+        c->carry_len += rest;
+    }
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = (Worker*) arg;
+    long interval = (long) (1e9 / rate);
+
+    int epfd = epoll_create1(0);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        return NULL;
+    }
+    for (int i = 0; i < w->nclients; i++) {
+        Client *c = &w->clients[i];
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+        // Spread the first sends over one interval
+        c->next_send = start_ns + (long) rand_r(&w->seed) % interval;
+    }
+
+    struct epoll_event events[256];
+    while (atomic_load(&running)) {
+        long now = now_ns();
+        long next = now + 10000000L;
+
+        for (int i = 0; i < w->nclients; i++) {
+            Client *c = &w->clients[i];
+            if (c->fd == -1) continue;
+            if (c->next_send <= now) {
+                send_op(w, c);
+                c->next_send += interval;
+                if (c->next_send < now) c->next_send = now + interval;
+            }
+            if (c->next_send < next) next = c->next_send;
+        }
+
+        int timeout = (int) ((next - now_ns()) / 1000000L);
+        if (timeout < 0) timeout = 0;
+        int n = epoll_wait(epfd, events, 256, timeout);
+        for (int i = 0; i < n; i++) {
+            Client *c = (Client*) events[i].data.ptr;
+            if (drain_client(w, c) == -1) {
+                w->errors++;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+                close(c->fd);
+                c->fd = -1;
+            }
+        }
+    }
+
+    close(epfd);
+    return NULL;
+}
+
+/////////////////// REPORT //////////////////////////
+
+static int cmp_long(const void *a, const void *b) {
+    long x = *(const long*) a;
+    long y = *(const long*) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(long *sorted, long n, double p) {
+    if (n == 0) return 0.0;
+    long idx = (long) (p * (n - 1));
+    return sorted[idx] / 1000.0;
+}
+
+static void report(Worker *workers, double elapsed) {
+    long sent[NUM_OPS + 1] = { 0 };
+    long delivered = 0, stalls = 0, bytes_in = 0, errors = 0, dropped = 0, n = 0;
+
+    for (int t = 0; t < num_threads; t++) {
+        for (int i = 0; i <= NUM_OPS; i++) sent[i] += workers[t].sent[i];
+        delivered += workers[t].delivered;
+        stalls += workers[t].stalls;
+        bytes_in += workers[t].bytes_in;
+        errors += workers[t].errors;
+        dropped += workers[t].dropped_samples;
+        n += workers[t].nsamples;
+    }
+
+    long *all = (long*) malloc((n ? n : 1) * sizeof(long));
+    long k = 0;
+    double sum = 0;
+    for (int t = 0; t < num_threads; t++) {
+        for (long i = 0; i < workers[t].nsamples; i++) {
+            all[k++] = workers[t].samples[i];
+            sum += workers[t].samples[i];
+        }
+    }
+    qsort(all, n, sizeof(long), cmp_long);
+
+    long total_sent = 0;
+    for (int i = 0; i <= NUM_OPS; i++) total_sent += sent[i];
+
+    printf("{\n");
+    printf("  \"clients\": %d, \"threads\": %d, \"seconds\": %.3f, \"rooms\": %d,\n",
+           num_clients, num_threads, elapsed, num_rooms);
+    printf("  \"rate_per_client\": %.1f, \"lobby\": %s,\n", rate, stay_in_lobby ? "true" : "false");
+    printf("  \"mix\": {\"msg\": %d, \"join\": %d, \"login\": %d, \"users\": %d},\n",
+           mix[OP_MSG], mix[OP_JOIN], mix[OP_LOGIN], mix[OP_USERS]);
+    printf("  \"sent\": {");
+    for (int i = 0; i < NUM_OPS; i++) printf("\"%s\": %ld, ", op_names[i], sent[i]);
+    printf("\"leave\": %ld},\n", sent[NUM_OPS]);
+    printf("  \"commands_per_sec\": %.1f,\n", total_sent / elapsed);
+    printf("  \"delivered\": %ld, \"deliveries_per_sec\": %.1f,\n", delivered, delivered / elapsed);
+    printf("  \"bytes_in_per_sec\": %.1f,\n", bytes_in / elapsed);
+    printf("  \"send_stalls\": %ld, \"errors\": %ld,\n", stalls, errors);
+    printf("  \"latency_us\": {\"samples\": %ld, \"dropped\": %ld, \"mean\": %.1f, "
+           "\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}\n",
+           n, dropped, n ? sum / n / 1000.0 : 0.0,
+           percentile_us(all, n, 0.50), percentile_us(all, n, 0.99),
+           percentile_us(all, n, 0.999), n ? all[n - 1] / 1000.0 : 0.0);
+    printf("}\n");
+
+    free(all);
+}
+
+/////////////////// MAIN //////////////////////////
+
+static int parse_mix(const char *arg) {
+    int total = 0;
+    if (sscanf(arg, "%d,%d,%d,%d", &mix[OP_MSG], &mix[OP_JOIN],
+               &mix[OP_LOGIN], &mix[OP_USERS]) != NUM_OPS) {
+        return -1;
+    }
+    for (int i = 0; i < NUM_OPS; i++) {
+        if (mix[i] < 0) return -1;
+        total += mix[i];
+    }
+    return total > 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:p:c:t:d:r:R:m:Lh")) != -1) {
+        switch (opt) {
+        case 'a': server_addr = optarg; break;
+        case 'p': server_port = atoi(optarg); break;
+        case 'c': num_clients = atoi(optarg); break;
+        case 't': num_threads = atoi(optarg); break;
+        case 'd': seconds = atoi(optarg); break;
+        case 'r': num_rooms = atoi(optarg); break;
+        case 'R': rate = atof(optarg); break;
+        case 'L': stay_in_lobby = 1; break;
+        case 'm':
+            if (parse_mix(optarg) == -1) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (num_clients < 1 || num_threads < 1 || seconds < 1 || rate <= 0 ||
+        num_rooms < 1 || num_rooms > MAX_ROOMS) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (num_threads > num_clients) num_threads = num_clients;
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    Client *clients = (Client*) calloc(num_clients, sizeof(Client));
+    Worker *workers = (Worker*) calloc(num_threads, sizeof(Worker));
+    if (clients == NULL || workers == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+
+    // Setup: one client creates the rooms, then everyone moves in
+    for (int i = 0; i < num_clients; i++) {
+        clients[i].id = i;
+        if (connect_client(&clients[i]) == -1) exit(1);
+    }
+    for (int r = 0; r < num_rooms; r++) {
+        if (send_cmd(clients[0].fd, "create bench%d\n", r) == -1) exit(1);
+    }
+    usleep(100 * 1000);
+    for (int i = 0; i < num_clients; i++) {
+        if (setup_client(&clients[i]) == -1) {
+            perror("setup");
+            exit(1);
+        }
+    }
+    usleep(SETTLE_MS * 1000);
+    for (int i = 0; i < num_clients; i++) {
+        fcntl(clients[i].fd, F_SETFL, fcntl(clients[i].fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    // Clients are dealt out to threads in contiguous blocks
+    pthread_t *tids = (pthread_t*) malloc(num_threads * sizeof(pthread_t));
+    int per = num_clients / num_threads;
+    int extra = num_clients % num_threads;
+    int next = 0;
+
+    start_ns = now_ns();
+    atomic_store(&running, 1);
+    for (int t = 0; t < num_threads; t++) {
+        Worker *w = &workers[t];
+        w->id = t;
+        w->seed = t + 1;
+        w->clients = clients + next;
+        w->nclients = per + (t < extra ? 1 : 0);
+        w->samples = (long*) malloc(MAX_SAMPLES * sizeof(long));
+        next += w->nclients;
+        if (w->samples == NULL || pthread_create(&tids[t], NULL, worker_main, w) != 0) {
+            perror("worker");
+            exit(1);
+        }
+    }
+
+    sleep(seconds);
+    atomic_store(&running, 0);
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    double elapsed = (now_ns() - start_ns) / 1e9;
+
+    report(workers, elapsed);
+
+    for (int i = 0; i < num_clients; i++) {
+        if (clients[i].fd != -1) close(clients[i].fd);
+    }
+    for (int t = 0; t < num_threads; t++) {
+        free(workers[t].samples);
+    }
+    free(tids);
+    free(workers);
+    free(clients);
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+// Command parsing benchmark.
+//
+// Classifies the same client lines with two parsers:
+//   legacy - the old process_command() front end: split the first words
+//            in place, walk a strcmp() chain, and put the cuts back when
+//            the line turns out to be a chat message
+//   table  - command_parse(): length and one character pick the only
+//            candidate command, one memcmp() confirms it
+// and reports the cost per line for each kind of line. Every run copies
+// the line into a scratch buffer first, since both parsers write to it.
+//
+// Usage: ./bench_commands [-n iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "command.h"
+
+#define LEGACY_MAX_ARGS 3
+
+static long iterations = 2000000;
+
+static const char *lines[] = {
+    "hello everyone, how is it going today?",
+    "lol",
+    "joining late, sorry",
+    "create lobby",
+    "join lobby",
+    "leave lobby",
+    "connect alice",
+    "disconnect alice",
+    "rooms",
+    "users",
+    "login alice",
+    "history lobby 20",
+    "help",
+    "exit",
+};
+#define NUM_LINES ((int) (sizeof(lines) / sizeof(lines[0])))
+
+static volatile unsigned long sink;
+
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// The tokenizer and dispatch chain process_command() used to have. The
+// number returned stands in for the branch that would have run.
+static int legacy_parse(char *line) {
+    char *arguments[LEGACY_MAX_ARGS + 1];
+    char *cuts[LEGACY_MAX_ARGS];
+    char saved[LEGACY_MAX_ARGS];
+    int ncuts = 0;
+    int argc = 0;
+
+    char *p = line;
+    while (argc < LEGACY_MAX_ARGS) {
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0') break;
+        arguments[argc++] = p;
+        while (*p != '\0' && !isspace((unsigned char)*p)) p++;
+        if (*p != '\0') {
+            cuts[ncuts] = p;
+            saved[ncuts++] = *p;
+            *p++ = '\0';
+        }
+    }
+    for (int i = argc; i <= LEGACY_MAX_ARGS; i++) {
+        arguments[i] = NULL;
+    }
+    if (arguments[0] == NULL) return CMD_EMPTY;
+
+    if (strcmp(arguments[0], "create") == 0 && arguments[1] != NULL) return CMD_CREATE;
+    if (strcmp(arguments[0], "join") == 0 && arguments[1] != NULL) return CMD_JOIN;
+    if (strcmp(arguments[0], "leave") == 0 && arguments[1] != NULL) return CMD_LEAVE;
+    if (strcmp(arguments[0], "connect") == 0 && arguments[1] != NULL) return CMD_CONNECT;
+    if (strcmp(arguments[0], "disconnect") == 0 && arguments[1] != NULL) return CMD_DISCONNECT;
+    if (strcmp(arguments[0], "rooms") == 0) return CMD_ROOMS;
+    if (strcmp(arguments[0], "users") == 0) return CMD_USERS;
+    if (strcmp(arguments[0], "login") == 0 && arguments[1] != NULL) return CMD_LOGIN;
+    if (strcmp(arguments[0], "history") == 0 && arguments[1] != NULL) return CMD_HISTORY;
+    if (strcmp(arguments[0], "help") == 0) return CMD_HELP;
+    if (strcmp(arguments[0], "exit") == 0 || strcmp(arguments[0], "logout") == 0) return CMD_EXIT;
+
+    for (int i = 0; i < ncuts; i++) {
+        *cuts[i] = saved[i];
+    }
+    return CMD_MESSAGE;
+}
+
+static int table_parse(char *line, size_t len) {
+    Command cmd;
+    return command_parse(line, len, &cmd);
+}
+
+// Average ns per line for one parser on one line
+static double run(int use_table, const char *line) {
+    char scratch[256];
+    size_t len = strlen(line);
+    unsigned long acc = 0;
+
+    long start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        memcpy(scratch, line, len + 1);
+        acc += use_table ? table_parse(scratch, len) : legacy_parse(scratch);
+    }
+    long elapsed = now_ns() - start;
+
+    sink += acc;
+    return (double) elapsed / iterations;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': iterations = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (iterations <= 0) iterations = 1;
+
+    // Both parsers must agree before their speed means anything
+    for (int i = 0; i < NUM_LINES; i++) {
+        char a[256], b[256];
+        strcpy(a, lines[i]);
+        strcpy(b, lines[i]);
+        int expect = legacy_parse(a);
+        int got = table_parse(b, strlen(b));
+        if (expect != got) {
+            fprintf(stderr, "parsers disagree on '%s': %d vs %d\n", lines[i], expect, got);
+            exit(1);
+        }
+    }
+
+    printf("%ld iterations per line\n\n", iterations);
+    printf("%-40s %10s %10s %8s\n", "line", "legacy ns", "table ns", "speedup");
+
+    double legacy_total = 0, table_total = 0;
+    for (int i = 0; i < NUM_LINES; i++) {
+        double legacy = run(0, lines[i]);
+        double table = run(1, lines[i]);
+        legacy_total += legacy;
+        table_total += table;
+        printf("%-40s %10.1f %10.1f %7.2fx\n", lines[i], legacy, table, legacy / table);
+    }
+    printf("%-40s %10.1f %10.1f %7.2fx\n", "(mean)", legacy_total / NUM_LINES,
+           table_total / NUM_LINES, legacy_total / table_total);
+    return 0;
+}
@@ -0,0 +1,173 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+// Compressed transport benchmark.
+//
+// Feeds one client's view of a busy room (chat lines from many users,
+// each "\n::name> text\nchat>" as the server sends it) through the
+// per-connection compressor and reports bytes on the wire and CPU time
+// per message for:
+//   plain    - what an uncompressed client receives
+//   deflate  - the compressed stream without the preset dictionary
+//   dict     - with the dictionary, as the server runs it
+//   dict-6   - the same at zlib level 6
+// Every stream is inflated again and compared with the input, the way a
+// client would decode it. CPU time is the server's side only.
+//
+// Usage: ./bench_compress [-n messages] [-u users]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "compress.h"
+
+static int num_messages = 100000;
+static int num_users = 50;
+
+static const char *words[] = {
+    "the", "and", "you", "that", "have", "for", "with", "this", "what",
+    "just", "are", "not", "but", "lol", "meeting", "today", "tomorrow",
+    "build", "broke", "again", "anyone", "seen", "deploy", "server", "fixed",
+    "thanks", "ok", "sure", "coffee", "lunch", "is", "it", "on", "we", "I",
+    "can", "will", "check", "later", "now", "ping", "me", "when", "ready",
+};
+#define NUM_WORDS ((int) (sizeof(words) / sizeof(words[0])))
+
+typedef struct Mode {
+    const char *name;
+    int level;                 // 0: no compression
+    int dictionary;
+} Mode;
+
+static const Mode modes[] = {
+    { "plain", 0, 0 },
+    { "deflate", COMPRESS_LEVEL, 0 },
+    { "dict", COMPRESS_LEVEL, 1 },
+    { "dict-6", 6, 1 },
+};
+
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static char **make_messages(size_t *total) {
+    char **msgs = (char**) malloc(num_messages * sizeof(char*));
+    unsigned int seed = 42;
+    *total = 0;
+
+    for (int i = 0; i < num_messages; i++) {
+        char text[512];
+        int len = 0;
+        int nwords = 3 + rand_r(&seed) % 12;
+        for (int w = 0; w < nwords; w++) {
+            len += snprintf(text + len, sizeof(text) - len, "%s%s", w ? " " : "",
+                            words[rand_r(&seed) % NUM_WORDS]);
+        }
+        char line[640];
+        snprintf(line, sizeof(line), "\n::user%d> %s\nchat>", rand_r(&seed) % num_users, text);
+        msgs[i] = strdup(line);
+        *total += strlen(line);
+    }
+    return msgs;
+}
+
+// Inflate the stream and compare it with what went in
+static int verify(const char *wire, size_t wire_len, char **msgs, size_t total, int dictionary) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, -COMPRESS_WINDOW_BITS) != Z_OK) return -1;
+    if (dictionary) {
+        inflateSetDictionary(&strm, (const Bytef*) compress_dictionary, compress_dictionary_len);
+    }
+
+    char *plain = (char*) malloc(total + 1);
+    strm.next_in = (Bytef*) wire;
+    strm.avail_in = wire_len;
+    strm.next_out = (Bytef*) plain;
+    strm.avail_out = total + 1;
+    int rc = inflate(&strm, Z_SYNC_FLUSH);
+    size_t got = total + 1 - strm.avail_out;
+    inflateEnd(&strm);
+
+    int ok = (rc == Z_OK || rc == Z_BUF_ERROR || rc == Z_STREAM_END) && got == total;
+    size_t off = 0;
+    for (int i = 0; ok && i < num_messages; i++) {
+        size_t len = strlen(msgs[i]);
+        ok = memcmp(plain + off, msgs[i], len) == 0;
+        off += len;
+    }
+    free(plain);
+    return ok ? 0 : -1;
+}
+
+static void run(const Mode *mode, char **msgs, size_t total) {
+    size_t wire_len = 0;
+    char *wire = (char*) malloc(compressor_bound(total) * 2);
+    Compressor *z = mode->level ? compressor_new(mode->level, mode->dictionary) : NULL;
+
+    long start = now_ns();
+    for (int i = 0; i < num_messages; i++) {
+        size_t len = strlen(msgs[i]);
+        if (z == NULL) {
+            memcpy(wire + wire_len, msgs[i], len);
+            wire_len += len;
+            continue;
+        }
+        MsgBuf *piece = compressor_push(z, msgs[i], len);
+        if (piece == NULL) {
+            fprintf(stderr, "%s: compression failed\n", mode->name);
+            exit(1);
+        }
+        memcpy(wire + wire_len, piece->data, piece->len);
+        wire_len += piece->len;
+        msgbuf_unref(piece);
+    }
+    long elapsed = now_ns() - start;
+
+    if (z != NULL && verify(wire, wire_len, msgs, total, mode->dictionary) == -1) {
+        fprintf(stderr, "%s: stream does not decode to the input\n", mode->name);
+        exit(1);
+    }
+
+    printf("%-8s %12zu %10.1f %9.1f%% %10.0f\n", mode->name, wire_len,
+           (double) wire_len / num_messages, 100.0 * wire_len / total,
+           (double) elapsed / num_messages);
+    compressor_free(z);
+    free(wire);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:u:")) != -1) {
+        switch (opt) {
+        case 'n': num_messages = atoi(optarg); break;
+        case 'u': num_users = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n messages] [-u users]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (num_messages < 1) num_messages = 1;
+    if (num_users < 1) num_users = 1;
+
+    size_t total;
+    char **msgs = make_messages(&total);
+
+    printf("%d messages from %d users, %.1f bytes each on average\n\n",
+           num_messages, num_users, (double) total / num_messages);
+    printf("%-8s %12s %10s %10s %10s\n", "mode", "wire bytes", "bytes/msg", "of plain", "ns/msg");
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        run(&modes[i], msgs, total);
+    }
+
+    for (int i = 0; i < num_messages; i++) free(msgs[i]);
+    free(msgs);
+    return 0;
+}
@@ -0,0 +1,269 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+// Lock contention benchmark for the chat server's locking schemes.
+//
+// Broadcaster threads repeatedly walk the member list of their own room
+// (what sendMessageToRecipients() does), while membership threads keep
+// joining and leaving *other* rooms. The same workload is run under:
+//   legacy  - the old numReaders + rw_lock mutex pair, joins take rw_lock
+//   global  - one writer-preferring RWLock, joins take it for writing
+//   fine    - RWLock read for everyone, plus a per-room RWLock
+//   epoch   - broadcasters read the room's published copy in an epoch
+//             section, joiners take only the room lock
+// and broadcast throughput and latency are reported for each.
+//
+// Usage: ./bench_locks [-r rooms] [-m members] [-b broadcasters]
+//                      [-w joiners] [-t seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "list.h"
+#include "rwlock.h"
+#include "epoch.h"
+
+#define MAX_SAMPLES (1 << 20)
+
+enum { SCHEME_LEGACY, SCHEME_GLOBAL, SCHEME_FINE, SCHEME_EPOCH };
+static const char *scheme_names[] = { "legacy", "global", "fine", "epoch" };
+
+static int num_rooms = 16;
+static int num_members = 200;
+static int num_broadcasters = 4;
+static int num_joiners = 4;
+static int seconds = 2;
+
+static int scheme;
+static Room **rooms;
+static atomic_int running;
+
+// Old scheme from server.h
+static int numReaders = 0;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t legacy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static RWLock dir_lock = RWLOCK_INITIALIZER;
+
+typedef struct Worker {
+    int id;
+    long ops;
+    long *samples;             // Broadcast latencies in ns
+    long nsamples;
+    unsigned long sink;        // Keeps the member walk from being optimized out
+} Worker;
+
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void legacy_read_lock() {
+    pthread_mutex_lock(&mutex);
+    numReaders++;
+    if (numReaders == 1) pthread_mutex_lock(&legacy_lock);
+    pthread_mutex_unlock(&mutex);
+}
+
+static void legacy_read_unlock() {
+    pthread_mutex_lock(&mutex);
+    numReaders--;
+    if (numReaders == 0) pthread_mutex_unlock(&legacy_lock);
+    pthread_mutex_unlock(&mutex);
+}
+
+// Stand-in for one send(): touch the member's id
+static unsigned long visit(int id) {
+    return (unsigned long) id * 2654435761u;
+}
+
+static void *broadcaster(void *arg) {
+    Worker *w = (Worker*) arg;
+    Room *room = rooms[w->id % num_rooms];
+
+    while (atomic_load(&running)) {
+        long start = now_ns();
+
+        if (scheme == SCHEME_EPOCH) {
+            epoch_enter();
+            Bitset *members = atomic_load_explicit(&room->publishedUsers, memory_order_acquire);
+            if (members != NULL) {
+                BITSET_FOREACH(id, members) {
+                    w->sink += visit(id);
+                }
+            }
+            epoch_exit();
+        } else {
+            if (scheme == SCHEME_LEGACY) legacy_read_lock();
+            else rwlock_read_lock(&dir_lock);
+            if (scheme == SCHEME_FINE) rwlock_read_lock(&room->lock);
+
+            BITSET_FOREACH(id, &room->users) {
+                w->sink += visit(id);
+            }
+
+            if (scheme == SCHEME_FINE) rwlock_read_unlock(&room->lock);
+            if (scheme == SCHEME_LEGACY) legacy_read_unlock();
+            else rwlock_read_unlock(&dir_lock);
+        }
+
+        if (w->nsamples < MAX_SAMPLES) {
+            w->samples[w->nsamples++] = now_ns() - start;
+        }
+        w->ops++;
+    }
+    return NULL;
+}
+
+static void *joiner(void *arg) {
+    Worker *w = (Worker*) arg;
+    unsigned int seed = w->id + 1;
+
+    // Churn ids sit past every seeded member
+    int userId = num_rooms * num_members + w->id;
+
+    while (atomic_load(&running)) {
+        // Only rooms nobody broadcasts in, so any slowdown is pure lock contention
+        int idx = num_broadcasters + rand_r(&seed) % (num_rooms - num_broadcasters);
+        Room *room = rooms[idx];
+
+        for (int step = 0; step < 2; step++) {
+            if (scheme == SCHEME_LEGACY) {
+                pthread_mutex_lock(&legacy_lock);
+            } else if (scheme == SCHEME_GLOBAL) {
+                rwlock_write_lock(&dir_lock);
+            } else if (scheme == SCHEME_EPOCH) {
+                rwlock_write_lock(&room->lock);
+            } else {
+                rwlock_read_lock(&dir_lock);
+                rwlock_write_lock(&room->lock);
+            }
+
+            if (step == 0) addUserToR(room, userId);
+            else removeUserFromR(room, userId);
+
+            if (scheme == SCHEME_LEGACY) {
+                pthread_mutex_unlock(&legacy_lock);
+            } else if (scheme == SCHEME_GLOBAL) {
+                rwlock_write_unlock(&dir_lock);
+            } else if (scheme == SCHEME_EPOCH) {
+                rwlock_write_unlock(&room->lock);
+            } else {
+                rwlock_write_unlock(&room->lock);
+                rwlock_read_unlock(&dir_lock);
+            }
+        }
+        w->ops++;
+    }
+    return NULL;
+}
+
+static int cmp_long(const void *a, const void *b) {
+    long x = *(const long*) a, y = *(const long*) b;
+    return (x > y) - (x < y);
+}
+
+static void run(int which) {
+    Worker bw[num_broadcasters], jw[num_joiners];
+    pthread_t bt[num_broadcasters], jt[num_joiners];
+
+    scheme = which;
+    atomic_store(&running, 1);
+
+    for (int i = 0; i < num_broadcasters; i++) {
+        memset(&bw[i], 0, sizeof(Worker));
+        bw[i].id = i;
+        bw[i].samples = (long*) malloc(MAX_SAMPLES * sizeof(long));
+        pthread_create(&bt[i], NULL, broadcaster, &bw[i]);
+    }
+    for (int i = 0; i < num_joiners; i++) {
+        memset(&jw[i], 0, sizeof(Worker));
+        jw[i].id = i;
+        pthread_create(&jt[i], NULL, joiner, &jw[i]);
+    }
+
+    sleep(seconds);
+    atomic_store(&running, 0);
+
+    long broadcasts = 0, joins = 0, nsamples = 0;
+    for (int i = 0; i < num_broadcasters; i++) {
+        pthread_join(bt[i], NULL);
+        broadcasts += bw[i].ops;
+        nsamples += bw[i].nsamples;
+    }
+    for (int i = 0; i < num_joiners; i++) {
+        pthread_join(jt[i], NULL);
+        joins += jw[i].ops;
+    }
+
+    long *all = (long*) malloc((nsamples ? nsamples : 1) * sizeof(long));
+    long n = 0;
+    for (int i = 0; i < num_broadcasters; i++) {
+        memcpy(all + n, bw[i].samples, bw[i].nsamples * sizeof(long));
+        n += bw[i].nsamples;
+        free(bw[i].samples);
+    }
+    qsort(all, n, sizeof(long), cmp_long);
+
+    printf("%-7s %14.0f %14.0f %10ld %10ld %10ld\n", scheme_names[which],
+           (double) broadcasts / seconds, (double) joins / seconds,
+           n ? all[n / 2] / 1000 : 0,
+           n ? all[(long) (n * 0.99)] / 1000 : 0,
+           n ? all[n - 1] / 1000 : 0);
+    free(all);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "r:m:b:w:t:")) != -1) {
+        switch (opt) {
+        case 'r': num_rooms = atoi(optarg); break;
+        case 'm': num_members = atoi(optarg); break;
+        case 'b': num_broadcasters = atoi(optarg); break;
+        case 'w': num_joiners = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-r rooms] [-m members] [-b broadcasters] "
+                            "[-w joiners] [-t seconds]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (num_rooms <= num_broadcasters) {
+        fprintf(stderr, "need more rooms (-r) than broadcasters (-b)\n");
+        exit(1);
+    }
+
+    Room *room_head = NULL;
+    rooms = (Room**) malloc(num_rooms * sizeof(Room*));
+    for (int i = 0; i < num_rooms; i++) {
+        char name[MAX_NAME_LEN];
+        snprintf(name, sizeof(name), "room%d", i);
+        room_head = insertFirstR(room_head, name);
+        rooms[i] = room_head;
+        for (int j = 0; j < num_members; j++) {
+            addUserToR(rooms[i], i * num_members + j);
+        }
+    }
+
+    printf("%d rooms x %d members, %d broadcasters, %d joiners, %ds per scheme\n\n",
+           num_rooms, num_members, num_broadcasters, num_joiners, seconds);
+    printf("%-7s %14s %14s %10s %10s %10s\n", "scheme", "broadcasts/s",
+           "join+leave/s", "p50 us", "p99 us", "max us");
+
+    run(SCHEME_LEGACY);
+    run(SCHEME_GLOBAL);
+    run(SCHEME_FINE);
+    run(SCHEME_EPOCH);
+
+    epoch_drain();
+    freeAllRooms(&room_head);
+    free(rooms);
+    return 0;
+}
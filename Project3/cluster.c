@@ -0,0 +1,315 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "server.h"
+#include "cluster.h"
+#include "metrics.h"
+
+#include <sys/un.h>
+
+static const char *relay_path = NULL;
+static atomic_int connected = 0;   // Frames are dropped while 0
+static int wake_pipe[2] = {-1, -1};
+
+// Frames queued by chat threads, guarded by out_lock
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *pending = NULL;
+static size_t pending_len = 0;
+static size_t pending_cap = 0;
+
+// Owned by the cluster thread: the batch being written
+static char *out = NULL;
+static size_t out_len = 0;
+static size_t out_off = 0;
+static size_t out_cap = 0;
+
+static char *in = NULL;
+static size_t in_len = 0;
+static size_t in_cap = 0;
+
+/////////////////// SENDING //////////////////////////
+
+// Room for `len` more bytes in the pending buffer. Caller holds out_lock.
+static char *reserve(size_t len) {
+    if (pending_len + len > pending_cap) {
+        size_t cap = pending_cap ? pending_cap : 4096;
+        while (cap < pending_len + len) cap *= 2;
+        char *grown = cap <= CLUSTER_PENDING_MAX ? (char*) realloc(pending, cap) : NULL;
+        if (grown == NULL) return NULL;
+        pending = grown;
+        pending_cap = cap;
+    }
+    return pending + pending_len;
+}
+
+// Wake the cluster thread if this is the first frame of a batch
+static void queued(size_t was_len) {
+    metrics_add(M_RELAY_OUT, 1);
+    if (was_len == 0) {
+        char c = 0;
+        if (write(wake_pipe[1], &c, 1) == -1 && errno != EAGAIN) {
+            perror("write cluster wake");
+        }
+    }
+}
+
+static void queue_frame(const char *verb, const char *room) {
+    if (!atomic_load(&connected)) return;
+
+    size_t len = strlen(verb) + 1 + strlen(room) + 1;
+    pthread_mutex_lock(&out_lock);
+    size_t was_len = pending_len;
+    char *dst = reserve(len);
+    if (dst == NULL) {
+        pthread_mutex_unlock(&out_lock);
+        metrics_add(M_RELAY_DROPPED, 1);
+        return;
+    }
+    sprintf(dst, "%s %s\n", verb, room);
+    pending_len += len;
+    queued(was_len);
+    pthread_mutex_unlock(&out_lock);
+}
+
+void cluster_room_created(const char *room) {
+    queue_frame("ROOM", room);
+}
+
+void cluster_subscribe(const char *room, int on) {
+    queue_frame(on ? "SUB" : "UNSUB", room);
+}
+
+void cluster_publish(const char **rooms, int nrooms, const char *record, size_t len) {
+    if (!atomic_load(&connected) || nrooms == 0) return;
+    if (nrooms > CLUSTER_MAX_ROOMS) nrooms = CLUSTER_MAX_ROOMS;
+
+    char count[16];
+    size_t frame_len = snprintf(count, sizeof(count), "MSG %d", nrooms) + 1 + len;
+    for (int i = 0; i < nrooms; i++) {
+        frame_len += strlen(rooms[i]) + 1;
+    }
+
+    pthread_mutex_lock(&out_lock);
+    size_t was_len = pending_len;
+    char *dst = reserve(frame_len);
+    if (dst == NULL) {
+        // Relay is not keeping up; other servers miss this line
+        pthread_mutex_unlock(&out_lock);
+        metrics_add(M_RELAY_DROPPED, 1);
+        return;
+    }
+    dst += sprintf(dst, "%s", count);
+    for (int i = 0; i < nrooms; i++) {
+        dst += sprintf(dst, " %s", rooms[i]);
+    }
+    *dst++ = ' ';
+    memcpy(dst, record, len);
+    pending_len += frame_len;
+    queued(was_len);
+    pthread_mutex_unlock(&out_lock);
+}
+
+// Write what we can without blocking. Returns -1 if the relay is gone.
+static int flush_out(int fd) {
+    while (1) {
+        if (out_off == out_len) {
+            // Batch done: take everything queued since
+            pthread_mutex_lock(&out_lock);
+            char *buf = out;
+            size_t cap = out_cap;
+            out = pending;
+            out_cap = pending_cap;
+            out_len = pending_len;
+            pending = buf;
+            pending_cap = cap;
+            pending_len = 0;
+            pthread_mutex_unlock(&out_lock);
+            out_off = 0;
+            if (out_len == 0) return 0;
+        }
+
+        ssize_t sent = write(fd, out + out_off, out_len - out_off);
+        if (sent > 0) {
+            out_off += sent;
+        } else if (sent == -1 && errno == EINTR) {
+            continue;
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+}
+
+/////////////////// RECEIVING //////////////////////////
+
+static void handle_frame(char *line, size_t len) {
+    char *space = memchr(line, ' ', len);
+    if (space == NULL) return;
+    *space = '\0';
+    char *rest = space + 1;
+
+    metrics_add(M_RELAY_IN, 1);
+
+    if (strcmp(line, "ROOM") == 0) {
+        line[len - 1] = '\0';
+        addRemoteRoom(rest);
+    } else if (strcmp(line, "MSG") == 0) {
+        char *rooms[CLUSTER_MAX_ROOMS];
+        char *end = line + len;   // Just past the newline
+        int nrooms = atoi(rest);
+        if (nrooms <= 0 || nrooms > CLUSTER_MAX_ROOMS) return;
+
+        char *p = memchr(rest, ' ', end - rest);
+        for (int i = 0; i < nrooms; i++) {
+            if (p == NULL) return;
+            rooms[i] = p + 1;
+            p = memchr(p + 1, ' ', end - (p + 1));
+            if (p != NULL) *p = '\0';
+        }
+        if (p == NULL) return;
+        deliverRemoteMessage(rooms, nrooms, p + 1, end - (p + 1));
+    }
+}
+
+// Read and handle every complete frame. Returns -1 if the relay is gone.
+static int read_in(int fd) {
+    while (1) {
+        if (in_cap - in_len < 4096) {
+            size_t cap = in_cap ? in_cap * 2 : 65536;
+            char *grown = (char*) realloc(in, cap);
+            if (grown == NULL) return -1;
+            in = grown;
+            in_cap = cap;
+        }
+
+        ssize_t received = read(fd, in + in_len, in_cap - in_len);
+        if (received == 0) return -1;
+        if (received == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        in_len += received;
+
+        size_t start = 0;
+        char *nl;
+        while ((nl = memchr(in + start, '\n', in_len - start)) != NULL) {
+            size_t len = nl + 1 - (in + start);
+            if (len > CLUSTER_MAX_FRAME) break;
+            handle_frame(in + start, len);
+            start += len;
+        }
+        memmove(in, in + start, in_len - start);
+        in_len -= start;
+
+        // Not a relay we understand; reconnect rather than buffer forever
+        if (in_len > CLUSTER_MAX_FRAME) {
+            fprintf(stderr, "Oversized frame from the relay\n");
+            return -1;
+        }
+    }
+}
+
+/////////////////// CONNECTION //////////////////////////
+
+static int relay_connect() {
+    struct sockaddr_un addr;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("relay socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, relay_path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+// Serve one relay connection until it fails
+static void relay_session(int fd) {
+    struct pollfd fds[2];
+
+    while (1) {
+        fds[0].fd = fd;
+        fds[0].events = POLLIN | (out_off < out_len ? POLLOUT : 0);
+        fds[1].fd = wake_pipe[0];
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("cluster poll");
+            return;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+                // Just emptying the pipe
+            }
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if (read_in(fd) == -1) return;
+        }
+        if (flush_out(fd) == -1) return;
+    }
+}
+
+static void *cluster_main(void *arg) {
+    int announced = 0;
+
+    while (1) {
+        int fd = relay_connect();
+        if (fd == -1) {
+            if (!announced) {
+                printf("Relay %s not reachable, retrying\n", relay_path);
+                announced = 1;
+            }
+            usleep(RELAY_RETRY_MS * 1000);
+            continue;
+        }
+        printf("Joined relay %s\n", relay_path);
+        announced = 0;
+
+        // Tell the relay what this server has before anything else
+        atomic_store(&connected, 1);
+        clusterResync();
+        relay_session(fd);
+
+        atomic_store(&connected, 0);
+        close(fd);
+        printf("Lost relay %s\n", relay_path);
+
+        pthread_mutex_lock(&out_lock);
+        pending_len = 0;
+        pthread_mutex_unlock(&out_lock);
+        out_len = out_off = 0;
+        in_len = 0;
+    }
+    return NULL;
+}
+
+int cluster_start(const char *path) {
+    relay_path = path;
+
+    if (pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        perror("cluster pipe");
+        return -1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, cluster_main, NULL) != 0) {
+        perror("pthread_create cluster");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
@@ -0,0 +1,64 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stddef.h>
+
+#include "parser.h"
+#include "list.h"
+
+// Federation of several server processes on one host.
+//
+// Every server connects to one relay process (./relay) over a Unix
+// domain socket. Rooms then exist on every server, and a chat line sent
+// in a room reaches its members on all of them. Users, DMs and the user
+// list stay local to the server a client is connected to.
+//
+// The relay speaks newline-terminated text frames:
+//
+//   ROOM <room>                 room exists (server -> relay -> servers)
+//   SUB <room>                  this server now has members in <room>
+//   UNSUB <room>                ... and now it has none
+//   MSG <n> <room>... <line>    chat line sent in n rooms
+//
+// The relay remembers every room and replays them to servers that join
+// later. It forwards a MSG only to the other servers subscribed to at
+// least one of its rooms, so a server never sees traffic for rooms none
+// of its clients are in. Chat lines never contain a newline, so frames
+// need no escaping.
+//
+// Frames are queued by the chat threads and written by one cluster
+// thread, which also reads the relay. If the relay goes away the thread
+// keeps reconnecting; on reconnect it resends its rooms and
+// subscriptions. Messages sent while disconnected stay local.
+//
+// The relay's socket is only open to the user running it.
+
+#define RELAY_PATH          "/tmp/chat-relay.sock"
+#define RELAY_RETRY_MS      1000
+#define CLUSTER_PENDING_MAX (8 * 1024 * 1024)   // Unsent frame bytes
+#define CLUSTER_MAX_ROOMS   256                 // Rooms per MSG frame
+
+// Longest frame: a MSG naming CLUSTER_MAX_ROOMS rooms, then a record
+// ("::<name>> <line>\n"). Either end drops a peer that sends a longer one.
+#define CLUSTER_MAX_FRAME   (16 + CLUSTER_MAX_ROOMS * MAX_NAME_LEN + MAX_NAME_LEN + MAX_LINE_LEN + 8)
+
+// Connect to the relay at `path` and start the cluster thread
+int cluster_start(const char *path);
+
+// Announce a room created by a local client
+void cluster_room_created(const char *room);
+
+// This server's membership of `room` went from empty to not (on = 1)
+// or back (on = 0). Call with the room lock held so the frames for one
+// room leave in the order the changes happened.
+void cluster_subscribe(const char *room, int on);
+
+// Forward a chat line (the history record, newline included) sent in
+// `rooms` to the other servers
+void cluster_publish(const char **rooms, int nrooms, const char *record, size_t len);
+
+#endif
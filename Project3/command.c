@@ -0,0 +1,120 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "command.h"
+
+#include <ctype.h>
+#include <string.h>
+
+// Arguments a command needs; with fewer the line is a chat message
+static const unsigned char min_args[CMD_COUNT] = {
+    [CMD_CREATE] = 1,
+    [CMD_JOIN] = 1,
+    [CMD_LEAVE] = 1,
+    [CMD_CONNECT] = 1,
+    [CMD_DISCONNECT] = 1,
+    [CMD_LOGIN] = 1,
+    [CMD_HISTORY] = 1,
+    [CMD_MSG] = 2,
+};
+
+// Commands whose last argument runs to the end of the line
+static const unsigned char rest_of_line[CMD_COUNT] = {
+    [CMD_MSG] = 1,
+};
+
+static CommandId match(const char *word, size_t len, const char *name, CommandId id) {
+    return memcmp(word, name, len) == 0 ? id : CMD_MESSAGE;
+}
+
+// Length and one character pick the only candidate; memcmp() confirms it
+static CommandId lookup(const char *w, size_t len) {
+    switch (len) {
+    case 3:
+        return match(w, len, "msg", CMD_MSG);
+    case 4:
+        switch (w[0]) {
+        case 'j': return match(w, len, "join", CMD_JOIN);
+        case 'h': return match(w, len, "help", CMD_HELP);
+        case 'e': return match(w, len, "exit", CMD_EXIT);
+        }
+        break;
+    case 5:
+        switch (w[0]) {
+        case 'l': return w[1] == 'e' ? match(w, len, "leave", CMD_LEAVE)
+                                     : match(w, len, "login", CMD_LOGIN);
+        case 'r': return match(w, len, "rooms", CMD_ROOMS);
+        case 'u': return match(w, len, "users", CMD_USERS);
+        }
+        break;
+    case 6:
+        switch (w[0]) {
+        case 'c': return match(w, len, "create", CMD_CREATE);
+        case 'l': return match(w, len, "logout", CMD_EXIT);
+        case 'b': return match(w, len, "binary", CMD_BINARY);
+        }
+        break;
+    case 7:
+        switch (w[0]) {
+        case 'c': return match(w, len, "connect", CMD_CONNECT);
+        case 'h': return match(w, len, "history", CMD_HISTORY);
+        }
+        break;
+    case 8:
+        return match(w, len, "compress", CMD_COMPRESS);
+    case 10:
+        return match(w, len, "disconnect", CMD_DISCONNECT);
+    }
+    return CMD_MESSAGE;
+}
+
+CommandId command_parse(char *line, size_t len, Command *cmd) {
+    char *p = line;
+    char *end = line + len;
+
+    cmd->argc = 0;
+    memset(cmd->args, 0, sizeof(cmd->args));
+
+    while (p < end && isspace((unsigned char) *p)) p++;
+    if (p == end) {
+        return cmd->id = CMD_EMPTY;
+    }
+
+    char *name = p;
+    while (p < end && !isspace((unsigned char) *p)) p++;
+    char *name_end = p;
+
+    CommandId id = lookup(name, name_end - name);
+    if (id == CMD_MESSAGE) {
+        return cmd->id = CMD_MESSAGE;
+    }
+
+    // Find the arguments first; the line must stay intact if it turns
+    // out to be a message after all
+    while (cmd->argc < COMMAND_MAX_ARGS) {
+        while (p < end && isspace((unsigned char) *p)) p++;
+        if (p == end) break;
+        Slice *arg = &cmd->args[cmd->argc++];
+        arg->ptr = p;
+        if (rest_of_line[id] && cmd->argc == COMMAND_MAX_ARGS) {
+            p = end;
+            while (p > arg->ptr && isspace((unsigned char) p[-1])) p--;
+        } else {
+            while (p < end && !isspace((unsigned char) *p)) p++;
+        }
+        arg->len = p - arg->ptr;
+    }
+    if (cmd->argc < min_args[id]) {
+        cmd->argc = 0;
+        memset(cmd->args, 0, sizeof(cmd->args));
+        return cmd->id = CMD_MESSAGE;
+    }
+
+    // Each word ends in whitespace or the line's own NUL
+    *name_end = '\0';
+    for (int i = 0; i < cmd->argc; i++) {
+        cmd->args[i].ptr[cmd->args[i].len] = '\0';
+    }
+    return cmd->id = id;
+}
@@ -0,0 +1,60 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stddef.h>
+
+// Command line parsing.
+//
+// Only the first word of a line is looked at until it is known to be a
+// command: it is matched by length, then by a character that differs
+// between the commands of that length, then by one memcmp(). A chat
+// message (any line not starting with a command name) usually costs a
+// length check and nothing else, and its line is left untouched.
+//
+// For a command, its arguments are slices into the line. They are also
+// NUL terminated in place so they can be passed on as C strings. A
+// command given fewer arguments than it needs is a chat message, as it
+// always was ("join" on its own is just chatter).
+
+#define COMMAND_MAX_ARGS 2          // Words after the command name
+
+typedef enum CommandId {
+    CMD_MESSAGE,                    // Not a command: chat
+    CMD_EMPTY,                      // Blank line
+    CMD_CREATE,
+    CMD_JOIN,
+    CMD_LEAVE,
+    CMD_CONNECT,
+    CMD_DISCONNECT,
+    CMD_ROOMS,
+    CMD_USERS,
+    CMD_LOGIN,
+    CMD_HISTORY,
+    CMD_HELP,
+    CMD_EXIT,                       // Also "logout"
+    CMD_COMPRESS,
+    CMD_MSG,                        // Its second argument is the rest of the line
+    CMD_BINARY,
+    CMD_COUNT
+} CommandId;
+
+typedef struct Slice {
+    char *ptr;
+    size_t len;
+} Slice;
+
+typedef struct Command {
+    CommandId id;
+    int argc;
+    Slice args[COMMAND_MAX_ARGS];   // Unused ones are {NULL, 0}
+} Command;
+
+// Classify `line` (NUL terminated, `len` bytes) and fill in `cmd`.
+// Returns cmd->id.
+CommandId command_parse(char *line, size_t len, Command *cmd);
+
+#endif
@@ -0,0 +1,103 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "compress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+struct Compressor {
+    z_stream strm;
+    char *out;                 // Scratch for one piece
+    size_t out_cap;
+};
+
+// deflate only matches strings within the window, and prefers the most
+// recent: the most common text goes last
+const char compress_dictionary[] =
+    "Commands:\nlogin <username>\ncreate <room>\njoin <room>\nleave <room>\n"
+    "history <room> [n]\nusers [offset] [limit]\nrooms [offset] [limit]\n"
+    "connect <user>\ndisconnect <user>\ncompress [off]\nexit\n"
+    "Too many messages, slow down.\n"
+    "Too many changes, try again in a moment.\n"
+    "Username '' is already taken.\n"
+    "Room '' does not exist.\nRoom '' created.\n"
+    "Disconnected from ''.\nConnected (DM) with ''.\nUser '' not found.\n"
+    "History of '':\n(0 messages)\n"
+    "Rooms:\n  - Lobby\nUsers:\n  - guest\n"
+    "Left room ''.\nJoined room ''.\nLogged in as ''.\n"
+    " the and you that have for with this what just are not but lol "
+    "\nchat>\n::guest> \nchat>\n::";
+const size_t compress_dictionary_len = sizeof(compress_dictionary) - 1;
+
+Compressor *compressor_new(int level, int use_dictionary) {
+    Compressor *z = (Compressor*) calloc(1, sizeof(Compressor));
+    if (z == NULL) {
+        perror("calloc failed for Compressor");
+        return NULL;
+    }
+    if (deflateInit2(&z->strm, level, Z_DEFLATED, -COMPRESS_WINDOW_BITS,
+                     COMPRESS_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(z);
+        return NULL;
+    }
+    if (use_dictionary &&
+        deflateSetDictionary(&z->strm, (const Bytef*) compress_dictionary,
+                             compress_dictionary_len) != Z_OK) {
+        deflateEnd(&z->strm);
+        free(z);
+        return NULL;
+    }
+    return z;
+}
+
+void compressor_free(Compressor *z) {
+    if (z == NULL) return;
+    deflateEnd(&z->strm);
+    free(z->out);
+    free(z);
+}
+
+size_t compressor_bound(size_t len) {
+    // Stored blocks cost 5 bytes per 16 KB, the sync flush an empty one
+    return len + 5 * (len / 16383 + 1) + 16;
+}
+
+static MsgBuf *run(Compressor *z, const char *data, size_t len, int flush) {
+    size_t used = 0;
+    size_t need = compressor_bound(len);
+
+    z->strm.next_in = (Bytef*) data;
+    z->strm.avail_in = len;
+
+    // The bound is only a guess for a stream with history, so keep
+    // going until deflate() leaves room to spare: then it is done
+    do {
+        if (need > z->out_cap) {
+            char *grown = (char*) realloc(z->out, need);
+            if (grown == NULL) return NULL;
+            z->out = grown;
+            z->out_cap = need;
+        }
+        z->strm.next_out = (Bytef*) z->out + used;
+        z->strm.avail_out = z->out_cap - used;
+
+        int rc = deflate(&z->strm, flush);
+        if (rc == Z_STREAM_ERROR) return NULL;
+        used = z->out_cap - z->strm.avail_out;
+        need = z->out_cap * 2;
+    } while (z->strm.avail_out == 0);
+
+    return msgbuf_new(z->out, used);
+}
+
+MsgBuf *compressor_push(Compressor *z, const char *data, size_t len) {
+    return run(z, data, len, Z_SYNC_FLUSH);
+}
+
+MsgBuf *compressor_finish(Compressor *z) {
+    return run(z, NULL, 0, Z_FINISH);
+}
@@ -0,0 +1,53 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+#include "msgbuf.h"
+
+// Outbound compression for clients that ask for it with `compress`.
+//
+// Everything the server sends after the "Compression on." reply is one
+// raw deflate stream (RFC 1951, no zlib header) with a 4 KB window,
+// primed with compress_dictionary. Each message is sync flushed, so a
+// client can inflate and show it as soon as it arrives, and later
+// messages refer back to earlier ones: the names, prompts and phrases
+// repeated on every chat line cost a few bits each.
+//
+// When the stream ends (deflate final block: `compress off`, or a hot
+// restart) the connection is back to plain text.
+//
+// Compression is per connection, so a broadcast is compressed once for
+// each recipient that asked for it; everyone else still shares the one
+// plain buffer.
+
+#define COMPRESS_LEVEL       1      // zlib level: chat lines are short, speed wins
+#define COMPRESS_WINDOW_BITS 12     // 4 KB window
+#define COMPRESS_MEM_LEVEL   5      // ~16 KB of match state per connection
+
+// Client side: inflateInit2(-COMPRESS_WINDOW_BITS), then
+// inflateSetDictionary() with these bytes before the first inflate()
+extern const char compress_dictionary[];
+extern const size_t compress_dictionary_len;
+
+typedef struct Compressor Compressor;
+
+// `use_dictionary` 0 is only for measuring what the dictionary buys
+Compressor *compressor_new(int level, int use_dictionary);
+void compressor_free(Compressor *z);
+
+// The next piece of the stream, carrying all of `data`. NULL means the
+// stream is broken and the connection must be dropped.
+MsgBuf *compressor_push(Compressor *z, const char *data, size_t len);
+
+// End the stream
+MsgBuf *compressor_finish(Compressor *z);
+
+// Largest piece compressor_push() can return for `len` bytes
+size_t compressor_bound(size_t len);
+
+#endif
@@ -0,0 +1,639 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "conn.h"
+#include "metrics.h"
+#include "wire.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+size_t conn_queue_limit = DEFAULT_QUEUE_LIMIT;   // Set with -q
+int conn_slow_policy = SLOW_DROP;                // Set with -p
+long conn_write_timeout_ms = DEFAULT_WRITE_TIMEOUT_MS;   // Set with -i
+atomic_int conn_binary_count = 0;
+
+static long write_deadline(Timer *t, long now);
+
+Conn *conn_create(int fd) {
+    Conn *c = (Conn*) calloc(1, sizeof(Conn));
+    if (c == NULL) {
+        perror("calloc failed for Conn");
+        return NULL;
+    }
+    c->fd = fd;
+    timer_init(&c->write_timer, write_deadline, c);
+    pthread_mutex_init(&c->out_lock, NULL);
+    pthread_cond_init(&c->out_space, NULL);
+    return c;
+}
+
+static size_t entry_len(const OutEntry *e) {
+    return e->msg != NULL ? e->msg->len : e->file_len;
+}
+
+static void entry_release(Conn *c, OutEntry *e) {
+    if (e->msg != NULL) {
+        msgbuf_unref(e->msg);
+    } else {
+        close(e->file_fd);
+        c->out_files--;
+    }
+}
+
+static void queue_clear(Conn *c) {
+    metrics_add(M_QUEUED_MSGS, -(long) c->out_count);
+    metrics_add(M_QUEUED_BYTES, -(long) c->out_bytes);
+    while (c->out_count > 0) {
+        entry_release(c, &c->out_q[c->out_head]);
+        c->out_head = (c->out_head + 1) & (c->out_cap - 1);
+        c->out_count--;
+    }
+    c->out_bytes = 0;
+}
+
+void conn_destroy(Conn *c) {
+    timer_cancel(&c->write_timer);
+    timer_cancel(&c->idle_timer);
+    queue_clear(c);
+    pthread_mutex_destroy(&c->out_lock);
+    pthread_cond_destroy(&c->out_space);
+    free(c->out_q);
+    compressor_free(c->zout);
+    if (c->binary) atomic_fetch_sub(&conn_binary_count, 1);
+    parser_free(&c->in);
+    free(c->held);
+    free(c);
+}
+
+/////////////////// MESSAGE RING //////////////////////////
+
+// Append an entry, taking over whatever reference or descriptor it holds
+static int queue_push_entry(Conn *c, const OutEntry *entry) {
+    if (c->out_count == c->out_cap) {
+        unsigned int cap = c->out_cap ? c->out_cap * 2 : 16;
+        OutEntry *q = (OutEntry*) malloc(cap * sizeof(OutEntry));
+        if (q == NULL) {
+            perror("malloc failed for outbound queue");
+            return -1;
+        }
+        // Unwrap the old ring into the front of the new one
+        for (unsigned int i = 0; i < c->out_count; i++) {
+            q[i] = c->out_q[(c->out_head + i) & (c->out_cap - 1)];
+        }
+        free(c->out_q);
+        c->out_q = q;
+        c->out_cap = cap;
+        c->out_head = 0;
+    }
+
+    // The clock for a stalled queue starts when it stops being empty
+    if (c->out_count == 0 && conn_write_timeout_ms > 0) {
+        c->out_progress = metrics_now_ns();
+        timer_arm(&c->write_timer, c->out_progress + conn_write_timeout_ms * 1000000L);
+    }
+
+    size_t left = entry_len(entry) - entry->off;
+    c->out_q[(c->out_head + c->out_count) & (c->out_cap - 1)] = *entry;
+    c->out_count++;
+    c->out_bytes += left;
+    if (entry->msg == NULL) c->out_files++;
+
+    metrics_add(M_QUEUED_MSGS, 1);
+    metrics_add(M_QUEUED_BYTES, left);
+    metrics_record(H_QUEUE_DEPTH, c->out_bytes);
+    return 0;
+}
+
+static int queue_push(Conn *c, MsgBuf *msg, size_t off) {
+    OutEntry e = { .msg = msg, .off = off, .file_fd = -1 };
+    if (queue_push_entry(c, &e) == -1) return -1;
+    msgbuf_ref(msg);
+    return 0;
+}
+
+// Retire the oldest entry once it is completely sent
+static void queue_pop(Conn *c) {
+    metrics_add(M_QUEUED_MSGS, -1);
+    entry_release(c, &c->out_q[c->out_head]);
+    c->out_head = (c->out_head + 1) & (c->out_cap - 1);
+    c->out_count--;
+}
+
+// sendfile() as much of the range as the socket takes. Returns the bytes
+// sent, 0 if the socket is full, -1 if the peer is gone.
+static ssize_t send_file_range(Conn *c, int fd, off_t off, size_t len) {
+    size_t sent = 0;
+
+    while (sent < len) {
+        off_t pos = off + sent;
+        ssize_t n = sendfile(c->fd, fd, &pos, len - sent);
+        if (n > 0) {
+            sent += n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return -1;   // Peer gone, or the file shrank under us
+        }
+    }
+    metrics_add(M_BYTES_OUT, sent);
+    return sent;
+}
+
+// Push the queue out with one sendmsg() per batch: it is writev() over up
+// to OUT_BATCH queued messages, plus MSG_NOSIGNAL. Caller holds out_lock.
+static void flush_locked(Conn *c) {
+    int drained = 0;
+
+    while (c->out_count > 0 && !c->closed) {
+        struct iovec iov[OUT_BATCH];
+        struct msghdr msg;
+        unsigned int n_iov = 0;
+
+        OutEntry *head = &c->out_q[c->out_head];
+        if (head->msg == NULL) {
+            size_t left = head->file_len - head->off;
+            ssize_t n = send_file_range(c, head->file_fd, head->file_off + head->off, left);
+            if (n == -1) {
+                queue_clear(c);
+                drained = 1;
+                break;
+            }
+            c->out_bytes -= n;
+            metrics_add(M_QUEUED_BYTES, -n);
+            if (n > 0) drained = 1;
+            if ((size_t) n < left) {
+                head->off += n;
+                break;   // Socket full
+            }
+            queue_pop(c);
+            continue;
+        }
+
+        // Gather messages up to the next file range
+        while (n_iov < c->out_count && n_iov < OUT_BATCH) {
+            OutEntry *e = &c->out_q[(c->out_head + n_iov) & (c->out_cap - 1)];
+            if (e->msg == NULL) break;
+            iov[n_iov].iov_base = e->msg->data + e->off;
+            iov[n_iov].iov_len = e->msg->len - e->off;
+            n_iov++;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n_iov;
+
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            c->out_bytes -= n;
+            drained = 1;
+            metrics_add(M_BYTES_OUT, n);
+            metrics_add(M_QUEUED_BYTES, -n);
+            // Retire fully written messages, remember where the last one stopped
+            while (n > 0) {
+                OutEntry *e = &c->out_q[c->out_head];
+                size_t left = e->msg->len - e->off;
+                if ((size_t) n < left) {
+                    e->off += n;
+                    break;
+                }
+                n -= left;
+                queue_pop(c);
+            }
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;   // The reactor calls back when the socket drains
+        } else {
+            // Peer is gone; the reader will notice and clean up
+            queue_clear(c);
+            drained = 1;
+        }
+    }
+
+    if (drained) {
+        c->out_progress = metrics_now_ns();
+        pthread_cond_broadcast(&c->out_space);
+    }
+}
+
+// The write timer went off. Checking on expiry, instead of re-arming on
+// every flush, keeps the timer wheel off the send path.
+static long write_deadline(Timer *t, long now) {
+    Conn *c = (Conn*) t->arg;
+    long again = 0;
+
+    pthread_mutex_lock(&c->out_lock);
+    if (!c->closed && c->out_count > 0) {
+        long deadline = c->out_progress + conn_write_timeout_ms * 1000000L;
+        if (now < deadline) {
+            again = deadline;
+        } else {
+            shutdown(c->fd, SHUT_RDWR);   // Owner sees EOF and cleans up
+            metrics_add(M_WRITE_TIMEOUTS, 1);
+        }
+    }
+    pthread_mutex_unlock(&c->out_lock);
+    return again;
+}
+
+/////////////////// SENDING //////////////////////////
+
+// Bytes that may still be queued. Queued history can push out_bytes past
+// the limit, so this must not go negative.
+static size_t queue_room(const Conn *c) {
+    return c->out_bytes < conn_queue_limit ? conn_queue_limit - c->out_bytes : 0;
+}
+
+// Add `ms` milliseconds to a CLOCK_REALTIME time
+static void add_ms(struct timespec *t, long ms) {
+    t->tv_nsec += ms * 1000000L;
+    t->tv_sec += t->tv_nsec / 1000000000L;
+    t->tv_nsec %= 1000000000L;
+}
+
+// Wait for queue space under SLOW_BLOCK. Returns -1 on timeout or close.
+//
+// The thread that would flush this queue may be the one waiting: in
+// sharded mode the recipient can live on the sender's own shard, and in
+// io_uring mode one thread runs everything. So the waiter flushes the
+// queue itself every BACKPRESSURE_SLICE_MS instead of only waiting for
+// out_space.
+static int wait_for_space(Conn *c, size_t len) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    add_ms(&deadline, BACKPRESSURE_WAIT_MS);
+
+    while (!c->closed && queue_room(c) < len) {
+        flush_locked(c);
+        if (c->closed || queue_room(c) >= len) break;
+
+        struct timespec slice;
+        clock_gettime(CLOCK_REALTIME, &slice);
+        add_ms(&slice, BACKPRESSURE_SLICE_MS);
+        int last = slice.tv_sec > deadline.tv_sec ||
+                   (slice.tv_sec == deadline.tv_sec && slice.tv_nsec >= deadline.tv_nsec);
+        if (pthread_cond_timedwait(&c->out_space, &c->out_lock, last ? &deadline : &slice) == ETIMEDOUT &&
+            last) {
+            flush_locked(c);
+            break;
+        }
+    }
+    return (!c->closed && queue_room(c) >= len) ? 0 : -1;
+}
+
+// Write to the socket straight away when nothing is queued ahead.
+// Returns the bytes written (possibly 0) or -1 if the peer is gone.
+static ssize_t send_direct(Conn *c, const char *data, size_t len) {
+    ssize_t n;
+
+    if (c->out_count > 0) return 0;
+    do {
+        n = send(c->fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    metrics_add(M_BYTES_OUT, n);
+    return n;
+}
+
+// wait_for_space() releases out_lock, and meanwhile the client's owner
+// may have turned compression on or off, or switched to frames. Nothing
+// of the message is on the wire yet then, so the sender starts over in
+// the new mode, framing it afresh.
+#define MODE_CHANGED -2
+
+// Queue the unsent part of a message, applying the slow-consumer policy.
+// `torn` means the start of the message is already on the wire, so the
+// rest must follow or the client would see a broken line. Returns
+// MODE_CHANGED if it waited for space and the output mode changed.
+// Caller holds out_lock.
+static int enqueue_locked(Conn *c, MsgBuf *msg, size_t off, int torn) {
+    size_t len = msg->len - off;
+    Compressor *zout = c->zout;
+    int binary = c->binary;
+
+    if (queue_room(c) < len &&
+        (torn || len > conn_queue_limit ||
+         conn_slow_policy != SLOW_BLOCK || wait_for_space(c, len) == -1)) {
+        if (torn || conn_slow_policy == SLOW_DISCONNECT) {
+            shutdown(c->fd, SHUT_RDWR);   // Owner sees EOF and cleans up
+            metrics_add(M_SLOW_DISCONNECTS, 1);
+        }
+        c->dropped++;
+        metrics_add(M_DROPPED, 1);
+        return -1;
+    }
+    if (c->zout != zout || c->binary != binary) return MODE_CHANGED;
+
+    if (queue_push(c, msg, off) == -1) {
+        c->dropped++;
+        metrics_add(M_DROPPED, 1);
+        return -1;
+    }
+    flush_locked(c);
+    return 0;
+}
+
+/////////////////// COMPRESSED OUTPUT //////////////////////////
+
+// Send or queue all of `z` regardless of the queue limit. Used for the
+// pieces of a compressed stream: every piece must reach the client or
+// none after it can be decoded, so a piece that cannot be queued ends
+// the connection. Caller holds out_lock.
+static int push_all_locked(Conn *c, MsgBuf *z) {
+    ssize_t n = send_direct(c, z->data, z->len);
+    if (n != -1 && ((size_t) n == z->len || queue_push(c, z, n) == 0)) {
+        return 0;
+    }
+    shutdown(c->fd, SHUT_RDWR);
+    return -1;
+}
+
+static int compress_locked(Conn *c, const char *data, size_t len) {
+    MsgBuf *z = compressor_push(c->zout, data, len);
+    if (z == NULL) {
+        shutdown(c->fd, SHUT_RDWR);
+        return -1;
+    }
+    metrics_add(M_COMPRESS_IN, len);
+    metrics_add(M_COMPRESS_OUT, z->len);
+    int status = push_all_locked(c, z);
+    msgbuf_unref(z);
+    return status;
+}
+
+// The slow-consumer policy for a compressed connection. It has to be
+// applied before compressing: a message the client never gets must not
+// become part of the stream. The plain length bounds the compressed one
+// closely enough. Returns MODE_CHANGED like enqueue_locked(), for a
+// stream stopped, restarted or switched to frames while it waited.
+// Caller holds out_lock.
+static int send_compressed_locked(Conn *c, const char *data, size_t len) {
+    Compressor *zout = c->zout;
+    int binary = c->binary;
+
+    if (c->out_count > 0 && queue_room(c) < len &&
+        (len > conn_queue_limit || conn_slow_policy != SLOW_BLOCK ||
+         wait_for_space(c, len) == -1)) {
+        if (conn_slow_policy == SLOW_DISCONNECT) {
+            shutdown(c->fd, SHUT_RDWR);
+            metrics_add(M_SLOW_DISCONNECTS, 1);
+        }
+        c->dropped++;
+        metrics_add(M_DROPPED, 1);
+        return -1;
+    }
+    if (c->zout != zout || c->binary != binary) return MODE_CHANGED;
+    return compress_locked(c, data, len);
+}
+
+int conn_start_compression(Conn *c, const char *reply, size_t len) {
+    Compressor *z = compressor_new(COMPRESS_LEVEL, 1);
+    if (z == NULL) return -1;
+
+    pthread_mutex_lock(&c->out_lock);
+    int status = -1;
+    MsgBuf *msg = msgbuf_new(reply, len);
+    if (!c->closed && c->zout == NULL && msg != NULL) {
+        // The reply is the last plain text; it must not be dropped, or
+        // the client would not know where the stream starts
+        status = push_all_locked(c, msg);
+        if (status == 0) {
+            c->zout = z;
+            z = NULL;
+        }
+    }
+    pthread_mutex_unlock(&c->out_lock);
+    msgbuf_unref(msg);
+    compressor_free(z);
+    return status;
+}
+
+void conn_stop_compression(Conn *c) {
+    pthread_mutex_lock(&c->out_lock);
+    if (c->zout != NULL) {
+        MsgBuf *end = c->closed ? NULL : compressor_finish(c->zout);
+        if (end != NULL) {
+            push_all_locked(c, end);
+            msgbuf_unref(end);
+        }
+        compressor_free(c->zout);
+        c->zout = NULL;
+    }
+    pthread_mutex_unlock(&c->out_lock);
+}
+
+int conn_compressed(Conn *c) {
+    pthread_mutex_lock(&c->out_lock);
+    int on = c->zout != NULL;
+    pthread_mutex_unlock(&c->out_lock);
+    return on;
+}
+
+/////////////////// BINARY OUTPUT //////////////////////////
+
+int conn_start_binary(Conn *c, const char *reply, size_t len) {
+    pthread_mutex_lock(&c->out_lock);
+    int status = -1;
+    if (!c->closed && !c->binary) {
+        if (reply == NULL) {
+            status = 0;
+        } else if (c->zout != NULL) {
+            status = compress_locked(c, reply, len);
+        } else {
+            // Like the compression reply, it marks where frames start and
+            // must not be dropped
+            MsgBuf *msg = msgbuf_new(reply, len);
+            status = msg != NULL ? push_all_locked(c, msg) : -1;
+            msgbuf_unref(msg);
+        }
+        if (status == 0) {
+            c->binary = 1;
+            atomic_fetch_add(&conn_binary_count, 1);
+        }
+    }
+    pthread_mutex_unlock(&c->out_lock);
+    return status;
+}
+
+// What a binary client gets for `msg`: a new reference to its frame, or
+// its text in a new TEXT frame. Caller holds out_lock.
+static MsgBuf *frame_for(MsgBuf *msg) {
+    if (msg->frame != NULL) return msgbuf_ref(msg->frame);
+    return wire_text(msg->data, msg->len);
+}
+
+/////////////////// PUBLIC SENDING //////////////////////////
+
+int conn_send_buf(Conn *c, MsgBuf *msg) {
+    if (c == NULL || msg == NULL) return -1;
+
+    pthread_mutex_lock(&c->out_lock);
+    int status = MODE_CHANGED;
+    MsgBuf *framed = NULL;
+    while (status == MODE_CHANGED) {
+        msgbuf_unref(framed);
+        framed = c->binary ? frame_for(msg) : NULL;
+        MsgBuf *out = framed != NULL ? framed : msg;
+        ssize_t n;
+
+        status = -1;
+        if (c->binary && framed == NULL) {
+            c->dropped++;                // Out of memory
+            metrics_add(M_DROPPED, 1);
+        } else if (c->zout != NULL) {
+            status = c->closed ? -1 : send_compressed_locked(c, out->data, out->len);
+        } else if (!c->closed && (n = send_direct(c, out->data, out->len)) != -1) {
+            status = ((size_t) n == out->len) ? 0 : enqueue_locked(c, out, n, n > 0);
+        }
+    }
+    pthread_mutex_unlock(&c->out_lock);
+    msgbuf_unref(framed);
+    return status;
+}
+
+// Like conn_send_buf() for bytes owned by the caller. They are only copied
+// into a message if the socket cannot take them right away.
+int conn_send(Conn *c, const char *buf, size_t len) {
+    if (c == NULL) return -1;
+
+    pthread_mutex_lock(&c->out_lock);
+    int status = MODE_CHANGED;
+    while (status == MODE_CHANGED) {
+        if (c->binary) {
+            // It goes out as a TEXT frame, which has to be built anyway
+            pthread_mutex_unlock(&c->out_lock);
+            MsgBuf *msg = msgbuf_new(buf, len);
+            status = conn_send_buf(c, msg);
+            msgbuf_unref(msg);
+            return status;
+        }
+
+        ssize_t n;
+        status = -1;
+        if (c->zout != NULL) {
+            status = c->closed ? -1 : send_compressed_locked(c, buf, len);
+        } else if (!c->closed && (n = send_direct(c, buf, len)) != -1) {
+            if ((size_t) n == len) {
+                status = 0;
+            } else {
+                MsgBuf *rest = msgbuf_new(buf + n, len - n);
+                if (rest != NULL) {
+                    status = enqueue_locked(c, rest, 0, n > 0);
+                    msgbuf_unref(rest);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&c->out_lock);
+    return status;
+}
+
+// A compressed client cannot take the file as it is: read it and
+// compress it in chunks. Like any file range it is never dropped.
+// Caller holds out_lock.
+static int send_file_compressed_locked(Conn *c, int fd, off_t off, size_t len) {
+    char chunk[16384];
+
+    while (len > 0) {
+        size_t want = len < sizeof(chunk) ? len : sizeof(chunk);
+        ssize_t n = pread(fd, chunk, want, off);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0 || compress_locked(c, chunk, n) == -1) {
+            shutdown(c->fd, SHUT_RDWR);   // The reply is torn
+            return -1;
+        }
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Send or queue a whole file range regardless of the queue limit.
+// Returns -1 if it could not be queued. Caller holds out_lock.
+static int push_file_locked(Conn *c, int fd, off_t off, size_t len) {
+    ssize_t n = 0;
+    if (c->out_count == 0 && (n = send_file_range(c, fd, off, len)) == -1) return -1;
+    if ((size_t) n == len) return 0;
+
+    // Each queued range holds a descriptor. A client that has this many
+    // waiting stopped reading; it must not run the server out of them.
+    if (c->out_files >= CONN_MAX_FILES) {
+        metrics_add(M_SLOW_DISCONNECTS, 1);
+        return -1;
+    }
+    OutEntry e = { .msg = NULL, .off = n, .file_off = off, .file_len = len };
+    if ((e.file_fd = dup(fd)) == -1) return -1;
+    if (queue_push_entry(c, &e) == -1) {
+        close(e.file_fd);
+        return -1;
+    }
+    return 0;
+}
+
+int conn_send_reply(Conn *c, const ReplyPart *parts, int nparts) {
+    if (c == NULL) return -1;
+
+    pthread_mutex_lock(&c->out_lock);
+    int status = c->closed ? -1 : 0;
+    for (int i = 0; i < nparts && status == 0; i++) {
+        const ReplyPart *p = &parts[i];
+        if (c->zout != NULL) {
+            status = p->msg != NULL ? compress_locked(c, p->msg->data, p->msg->len)
+                                    : send_file_compressed_locked(c, p->fd, p->off, p->len);
+        } else if (p->msg != NULL) {
+            status = push_all_locked(c, p->msg);
+        } else {
+            status = push_file_locked(c, p->fd, p->off, p->len);
+        }
+    }
+    if (status == -1 && !c->closed) {
+        // The reply is torn; hang up rather than send a broken stream
+        shutdown(c->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&c->out_lock);
+    return status;
+}
+
+void conn_flush(Conn *c) {
+    pthread_mutex_lock(&c->out_lock);
+    flush_locked(c);
+    pthread_mutex_unlock(&c->out_lock);
+}
+
+void conn_shutdown(Conn *c) {
+    timer_cancel(&c->write_timer);
+    pthread_mutex_lock(&c->out_lock);
+    c->closed = 1;
+    queue_clear(c);
+    pthread_cond_broadcast(&c->out_space);
+    pthread_mutex_unlock(&c->out_lock);
+    close(c->fd);
+}
+
+size_t conn_unsent(Conn *c) {
+    pthread_mutex_lock(&c->out_lock);
+    size_t unsent = c->closed ? 0 : c->out_bytes;
+    pthread_mutex_unlock(&c->out_lock);
+    return unsent;
+}
+
+int parse_slow_policy(const char *name) {
+    if (strcmp(name, "drop") == 0) return SLOW_DROP;
+    if (strcmp(name, "disconnect") == 0) return SLOW_DISCONNECT;
+    if (strcmp(name, "block") == 0) return SLOW_BLOCK;
+    return -1;
+}
@@ -0,0 +1,170 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef CONN_H
+#define CONN_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "msgbuf.h"
+#include "parser.h"
+#include "ratelimit.h"
+#include "compress.h"
+#include "timers.h"
+
+// What to do when a client's outbound queue is full
+#define SLOW_DROP        0   // Drop the new message for that client
+#define SLOW_DISCONNECT  1   // Hang up on the client
+#define SLOW_BLOCK       2   // Make the sender wait (bounded), then drop
+
+#define DEFAULT_QUEUE_LIMIT (64 * 1024)
+#define BACKPRESSURE_WAIT_MS 200
+#define BACKPRESSURE_SLICE_MS 5    // How often a blocked sender flushes for itself
+#define OUT_BATCH 64            // Messages per sendmsg() when draining
+#define DEFAULT_WRITE_TIMEOUT_MS (30 * 1000)
+#define CONN_MAX_FILES 16       // Queued file ranges per client, two full history replies
+
+// A queued message, or a range of a file, and how much of it is already
+// on the wire. File ranges (room history) go out with sendfile().
+typedef struct OutEntry {
+    MsgBuf *msg;               // NULL for a file range
+    size_t off;
+    int file_fd;               // File range: our own dup() of the file
+    off_t file_off;            // File range: where it starts
+    size_t file_len;
+} OutEntry;
+
+// One piece of a reply for conn_send_reply(): a message, or a range of
+// a file
+typedef struct ReplyPart {
+    MsgBuf *msg;               // NULL for a file range
+    int fd;
+    off_t off;
+    size_t len;
+} ReplyPart;
+
+// One connected client, in either server mode.
+//
+// Replies and broadcasts never block on the socket: conn_send_buf()
+// queues a reference to the message in a ring bounded by queued bytes and
+// writes as much as the socket takes right now. Whatever is left is
+// drained later by the reactor when epoll reports the socket writable
+// again, batching up to OUT_BATCH queued messages into one writev(). The
+// ring is only allocated once a client actually falls behind, so idle
+// connections stay small. A queue that makes no progress for
+// conn_write_timeout_ms means the peer stopped reading (or is gone): the
+// socket is shut down and its owner cleans up as if the client had left.
+typedef struct Conn {
+    int fd;
+
+    // Its user while registered. Set and cleared under the directory
+    // write lock, and read without a lock only by whoever handles the
+    // client's input, which is never concurrent with either.
+    struct User *user;
+
+    LineParser in;             // Partial command carried between reads
+
+    // Flood protection (see ratelimit.h), touched only by whoever is
+    // reading the client
+    RateBucket line_limit;     // Every line
+    RateBucket write_limit;    // create and login
+    int throttled;             // Told to slow down, not yet allowed again
+    unsigned int wire_tag;     // Binary protocol: tag of the request being run
+
+    // Idle reaping (see client_start_timers())
+    atomic_long last_input;    // metrics_now_ns() of the latest read
+    Timer idle_timer;
+    int idle_pinged;           // Asked whether it is still there
+
+    // Reactor bookkeeping (see reactor.c)
+    atomic_int pending;        // CONN_EV_* bits not yet handled
+    atomic_int scheduled;      // 1 while queued on or owned by a worker
+    struct Conn *next;         // Work queue / graveyard link
+    struct Conn *prev;         // io_uring mode: live list, with `next`
+    struct Reactor *reactor;   // Owning reactor (its shard when sharded)
+    int ring_ops;              // io_uring mode: requests in flight, RING_* bits
+    long retired_at;           // epoch_stamp() once closed; freed after it passed
+
+    // Input that arrived while input was held (io_uring mode, or handed
+    // over by a hot restart); it is run before anything read later
+    char *held;
+    size_t held_len;
+
+    // Outbound queue, guarded by out_lock
+    pthread_mutex_t out_lock;
+    pthread_cond_t out_space;  // Signalled when the ring drains
+    OutEntry *out_q;
+    unsigned int out_cap;      // Ring slots, zero or a power of two
+    unsigned int out_head;     // Index of the oldest entry
+    unsigned int out_count;    // Entries queued
+    unsigned int out_files;    // Of them file ranges, each holding a descriptor
+    size_t out_bytes;          // Unsent bytes across all entries
+    int closed;                // Socket is gone, discard all output
+    Compressor *zout;          // Set once the client asked for compression
+    int binary;                // Output is framed (see wire.h); never cleared
+    unsigned long dropped;     // Messages lost to SLOW_DROP / SLOW_BLOCK
+
+    // Pending-write deadline: armed when the queue stops being empty
+    Timer write_timer;
+    long out_progress;         // When queued bytes last reached the socket
+} Conn;
+
+extern size_t conn_queue_limit;
+extern int conn_slow_policy;
+extern long conn_write_timeout_ms;   // 0: a stalled queue is never timed out
+extern atomic_int conn_binary_count; // Connections using the binary protocol
+
+Conn *conn_create(int fd);
+void conn_destroy(Conn *c);
+
+// Queue a message for the client, taking a new reference to it.
+// Returns -1 if the message was dropped. A binary client gets the
+// message's frame, or its text in a TEXT frame if it has none.
+int conn_send_buf(Conn *c, MsgBuf *msg);
+
+// Send or queue `len` bytes owned by the caller, framed like
+// conn_send_buf() for a binary client
+int conn_send(Conn *c, const char *buf, size_t len);
+
+// Send or queue the parts of one reply in order. File ranges go out with
+// sendfile() and are dup()ed if they have to be queued, so the caller may
+// close its descriptors; a range must not change until it is sent. This
+// is a reply the client asked for, so none of it is dropped for being
+// over the queue limit: it all goes out, or the client is hung up on
+// (out of memory, or CONN_MAX_FILES ranges already waiting, since every
+// one holds a descriptor). Returns -1 then. Not for binary clients, whose
+// output must stay whole frames.
+int conn_send_reply(Conn *c, const ReplyPart *parts, int nparts);
+
+// Send `reply` as plain text, then compress everything after it (see
+// compress.h). Returns -1 if compression could not be started; the
+// reply is not sent then.
+int conn_start_compression(Conn *c, const char *reply, size_t len);
+
+// End the compressed stream; what follows is plain text again
+void conn_stop_compression(Conn *c);
+
+int conn_compressed(Conn *c);
+
+// Send `reply` as the last plain text, then frame all output (see
+// wire.h). `reply` may be NULL for a client that was already binary
+// (hot restart). Returns -1 if the reply could not be sent.
+int conn_start_binary(Conn *c, const char *reply, size_t len);
+
+// Write queued bytes until the socket would block
+void conn_flush(Conn *c);
+
+// Stop all output and close the socket. The Conn stays valid.
+// Cancels the pending-write deadline.
+void conn_shutdown(Conn *c);
+
+// Bytes still queued for the client; 0 once the socket is closed
+size_t conn_unsent(Conn *c);
+
+int parse_slow_policy(const char *name);
+
+#endif
@@ -0,0 +1,187 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "epoch.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Memory waiting for readers to move on
+typedef struct Retired {
+    void *ptr;
+    void (*fn)(void *);
+    long epoch;                // Global epoch when it was retired
+    struct Retired *next;
+} Retired;
+
+atomic_long epoch_global = 1;  // 0 marks a slot outside any section
+__thread EpochSlot *epoch_local = NULL;
+
+static _Atomic(EpochSlot*) all_slots = NULL;
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+
+// Retirement list, oldest first. The lock also orders every change of
+// epoch_global after the retirements it covers.
+static pthread_mutex_t retire_lock = PTHREAD_MUTEX_INITIALIZER;
+static Retired *retired_head = NULL;
+static Retired *retired_tail = NULL;
+static long retired_count = 0;
+
+/////////////////// PER-THREAD SLOTS //////////////////////////
+
+// Thread exit: the slot is outside any section and waits for a new owner
+static void detach_slot(void *arg) {
+    EpochSlot *s = (EpochSlot*) arg;
+    atomic_store(&s->in_use, 0);
+}
+
+static void make_epoch_key() {
+    pthread_key_create(&epoch_key, detach_slot);
+}
+
+EpochSlot *epoch_attach() {
+    EpochSlot *s;
+
+    pthread_once(&epoch_once, make_epoch_key);
+
+    // Reuse a slot left behind by a finished thread, as metrics blocks do
+    for (s = atomic_load(&all_slots); s != NULL; s = s->next) {
+        int idle = 0;
+        if (atomic_compare_exchange_strong(&s->in_use, &idle, 1)) break;
+    }
+
+    if (s == NULL) {
+        s = (EpochSlot*) calloc(1, sizeof(EpochSlot));
+        if (s == NULL) {
+            perror("calloc failed for EpochSlot");
+            exit(1);
+        }
+        atomic_store(&s->in_use, 1);
+        s->next = atomic_load(&all_slots);
+        while (!atomic_compare_exchange_weak(&all_slots, &s->next, s)) {
+            // s->next was reloaded, try again
+        }
+    }
+
+    s->depth = 0;
+    epoch_local = s;
+    pthread_setspecific(epoch_key, s);
+    return s;
+}
+
+/////////////////// RECLAIMING //////////////////////////
+
+// Move the epoch on unless a reader is still in an older one. Caller
+// holds retire_lock.
+static void advance() {
+    long e = atomic_load_explicit(&epoch_global, memory_order_relaxed);
+
+    // Pairs with the fence in epoch_enter(): a reader whose slot still
+    // reads 0 here sees everything unlinked before this point
+    atomic_thread_fence(memory_order_seq_cst);
+    for (EpochSlot *s = atomic_load(&all_slots); s != NULL; s = s->next) {
+        long seen = atomic_load_explicit(&s->epoch, memory_order_relaxed);
+        if (seen != 0 && seen != e) return;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    atomic_store_explicit(&epoch_global, e + 1, memory_order_release);
+}
+
+// Detach the retirements that are now safe to free. Caller holds
+// retire_lock.
+static Retired *take_due() {
+    long e = atomic_load_explicit(&epoch_global, memory_order_relaxed);
+    Retired *due = retired_head;
+    Retired *last = NULL;
+
+    for (Retired *r = retired_head; r != NULL && r->epoch + 2 <= e; r = r->next) {
+        last = r;
+        retired_count--;
+    }
+    if (last == NULL) return NULL;
+
+    retired_head = last->next;
+    if (retired_head == NULL) retired_tail = NULL;
+    last->next = NULL;
+    return due;
+}
+
+// Run the frees without the lock; they may take locks of their own
+static void free_due(Retired *r) {
+    long n = 0;
+    while (r != NULL) {
+        Retired *next = r->next;
+        r->fn(r->ptr);
+        free(r);
+        r = next;
+        n++;
+    }
+    if (n > 0) metrics_add(M_EPOCH_FREED, n);
+}
+
+void epoch_reclaim() {
+    pthread_mutex_lock(&retire_lock);
+    advance();
+    Retired *due = take_due();
+    pthread_mutex_unlock(&retire_lock);
+    free_due(due);
+}
+
+void epoch_retire(void *ptr, void (*fn)(void *)) {
+    if (ptr == NULL) return;
+
+    Retired *r = (Retired*) malloc(sizeof(Retired));
+    if (r == NULL) {
+        // A reader may still hold it; leaking is the only safe choice
+        perror("malloc failed for Retired");
+        return;
+    }
+    r->ptr = ptr;
+    r->fn = fn;
+    r->next = NULL;
+
+    pthread_mutex_lock(&retire_lock);
+    r->epoch = atomic_load_explicit(&epoch_global, memory_order_relaxed);
+    if (retired_tail != NULL) {
+        retired_tail->next = r;
+    } else {
+        retired_head = r;
+    }
+    retired_tail = r;
+    Retired *due = NULL;
+    if (++retired_count >= EPOCH_BATCH) {
+        advance();
+        due = take_due();
+    }
+    pthread_mutex_unlock(&retire_lock);
+
+    metrics_add(M_EPOCH_RETIRED, 1);
+    free_due(due);
+}
+
+long epoch_stamp() {
+    pthread_mutex_lock(&retire_lock);
+    long e = atomic_load_explicit(&epoch_global, memory_order_relaxed);
+    pthread_mutex_unlock(&retire_lock);
+    return e;
+}
+
+int epoch_passed(long stamp) {
+    return atomic_load_explicit(&epoch_global, memory_order_acquire) >= stamp + 2;
+}
+
+void epoch_drain() {
+    while (1) {
+        epoch_reclaim();
+        pthread_mutex_lock(&retire_lock);
+        int empty = retired_head == NULL;
+        pthread_mutex_unlock(&retire_lock);
+        if (empty) return;
+        usleep(1000);
+    }
+}
@@ -0,0 +1,73 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Epoch-based reclamation, for directory data read without locks.
+//
+// A reader brackets each lock-free look with epoch_enter() and
+// epoch_exit(). Both only write the calling thread's own slot (entering
+// adds one fence), so readers never contend with each other or with
+// writers. A writer, still holding whatever lock orders it against other
+// writers, unlinks the old version of something -- swaps a published
+// pointer, clears a table slot -- and passes it to epoch_retire(). It is
+// freed once every reader that might still see it has left its section:
+// the global epoch only advances when no reader is in an older one, and
+// retired memory waits for it to advance twice.
+//
+// Advancing is attempted by epoch_reclaim(), which the server runs every
+// EPOCH_TICK_MS, and by epoch_retire() once EPOCH_BATCH retirements are
+// waiting.
+
+#define EPOCH_TICK_MS 100
+#define EPOCH_BATCH   64
+
+typedef struct EpochSlot {
+    atomic_long epoch;         // Epoch entered, 0 outside a section
+    int depth;                 // Nested sections, owner only
+    atomic_int in_use;         // Owned by a live thread
+    struct EpochSlot *next;
+} EpochSlot;
+
+extern atomic_long epoch_global;
+extern __thread EpochSlot *epoch_local;
+EpochSlot *epoch_attach();
+
+static inline void epoch_enter() {
+    EpochSlot *s = epoch_local != NULL ? epoch_local : epoch_attach();
+    if (s->depth++ == 0) {
+        long e = atomic_load_explicit(&epoch_global, memory_order_acquire);
+        atomic_store_explicit(&s->epoch, e, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+static inline void epoch_exit() {
+    EpochSlot *s = epoch_local;
+    if (--s->depth == 0) {
+        atomic_store_explicit(&s->epoch, 0, memory_order_release);
+    }
+}
+
+// Free `ptr` with `fn` once no reader can still reach it. The caller has
+// already made it unreachable for readers entering from now on.
+void epoch_retire(void *ptr, void (*fn)(void *));
+
+// For memory whose owner frees it itself: take a stamp once it is
+// unreachable, and free it once epoch_passed() says so
+long epoch_stamp();
+int epoch_passed(long stamp);
+
+// Advance the epoch if every reader allows it, then free what is due
+void epoch_reclaim();
+
+// Free everything retired so far, waiting for readers as needed. For
+// shutdown, before the memory's pools go away.
+void epoch_drain();
+
+#endif
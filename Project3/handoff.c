@@ -0,0 +1,242 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "handoff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/close_range.h>
+
+typedef struct HandoffHeader {
+    uint64_t blob_len;
+    uint32_t nfds;
+} HandoffHeader;
+
+static pid_t child_pid = -1;
+
+/////////////////// PLAIN I/O //////////////////////////
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n == 0) return -1;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/////////////////// DESCRIPTORS //////////////////////////
+
+// One byte of payload carrying `n` descriptors
+static int send_fds(int sock, const int *fds, int n) {
+    char byte = 'F';
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    char control[CMSG_SPACE(HANDOFF_FD_BATCH * sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, n * sizeof(int));
+
+    while (sendmsg(sock, &msg, 0) == -1) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+}
+
+// Receive one batch into `out`. Returns how many arrived, or -1.
+static int recv_fds(int sock, int *out, int max) {
+    char byte;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    char control[CMSG_SPACE(HANDOFF_FD_BATCH * sizeof(int))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1) {
+        if (errno != EINTR) return -1;
+    }
+    if (n == 0 || (msg.msg_flags & MSG_CTRUNC)) return -1;
+
+    int got = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (got < max) {
+                out[got++] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+    return got;
+}
+
+/////////////////// PUBLIC API //////////////////////////
+
+int handoff_exec(char **argv) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("handoff socketpair");
+        return -1;
+    }
+
+    // Same arguments minus any "-X" from our own start, plus the new one.
+    // Built before fork(): the child may only make async-signal-safe calls.
+    int argc = 0;
+    while (argv[argc] != NULL) argc++;
+    char **args = (char**) calloc(argc + 3, sizeof(char*));
+    char fd_arg[16];
+    if (args == NULL) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    int n = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-X") == 0 && i + 1 < argc) {
+            i++;
+            continue;
+        }
+        args[n++] = argv[i];
+    }
+    snprintf(fd_arg, sizeof(fd_arg), "%d", sv[1]);
+    args[n++] = "-X";
+    args[n++] = fd_arg;
+    args[n] = NULL;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("handoff fork");
+        free(args);
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // Clients and listeners arrive over the socket; inherit nothing else
+        syscall(SYS_close_range, 3, ~0U, CLOSE_RANGE_CLOEXEC);
+        fcntl(sv[1], F_SETFD, 0);
+        execvp(args[0], args);
+        _exit(127);
+    }
+
+    free(args);
+    close(sv[1]);
+    child_pid = pid;
+    return sv[0];
+}
+
+int handoff_send(int sock, const char *blob, size_t len, const int *fds, int nfds) {
+    HandoffHeader hdr = { .blob_len = len, .nfds = nfds };
+
+    if (write_all(sock, (const char*) &hdr, sizeof(hdr)) == -1 ||
+        write_all(sock, blob, len) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < nfds; i += HANDOFF_FD_BATCH) {
+        int batch = nfds - i < HANDOFF_FD_BATCH ? nfds - i : HANDOFF_FD_BATCH;
+        if (send_fds(sock, fds + i, batch) == -1) return -1;
+    }
+    return 0;
+}
+
+int handoff_recv(int sock, char **blob, size_t *len, int **fds, int *nfds) {
+    HandoffHeader hdr;
+
+    if (read_all(sock, (char*) &hdr, sizeof(hdr)) == -1) return -1;
+
+    *blob = (char*) malloc(hdr.blob_len + 1);
+    *fds = (int*) malloc((hdr.nfds ? hdr.nfds : 1) * sizeof(int));
+    if (*blob == NULL || *fds == NULL ||
+        read_all(sock, *blob, hdr.blob_len) == -1) {
+        free(*blob);
+        free(*fds);
+        return -1;
+    }
+    (*blob)[hdr.blob_len] = '\0';
+    *len = hdr.blob_len;
+
+    int got = 0;
+    while (got < (int) hdr.nfds) {
+        int n = recv_fds(sock, *fds + got, hdr.nfds - got);
+        if (n <= 0) {
+            for (int i = 0; i < got; i++) close((*fds)[i]);
+            free(*blob);
+            free(*fds);
+            return -1;
+        }
+        got += n;
+    }
+    *nfds = got;
+    return 0;
+}
+
+int handoff_ack(int sock) {
+    return write_all(sock, "OK\n", 3);
+}
+
+int handoff_wait(int sock) {
+    char reply[3];
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+
+    int ready = poll(&pfd, 1, HANDOFF_TIMEOUT_MS);
+    if (ready == 1 && read_all(sock, reply, sizeof(reply)) == 0 &&
+        memcmp(reply, "OK\n", 3) == 0) {
+        return 0;
+    }
+
+    // Failed or too slow: make sure it cannot take over later
+    if (child_pid > 0) {
+        kill(child_pid, SIGKILL);
+        waitpid(child_pid, NULL, 0);
+        child_pid = -1;
+    }
+    return -1;
+}
@@ -0,0 +1,39 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+
+// Hot restart transport.
+//
+// The running server starts the new binary with one end of a Unix
+// socketpair (handoff_exec) and sends it a state blob plus a list of
+// descriptors over it (handoff_send): the listeners, then every client
+// socket. Descriptors travel as SCM_RIGHTS in batches, so the new
+// process gets the same open sockets and clients see no disconnect.
+// The new process replies with handoff_ack() once it has taken over;
+// until then the old one can still back out and keep serving.
+
+#define HANDOFF_FD_BATCH   250      // Descriptors per message (kernel max 253)
+#define HANDOFF_TIMEOUT_MS 10000    // How long the old process waits for the ack
+
+// Start `argv` with a handoff socket. The new process sees
+// "-X <fd>" appended to its arguments and inherits no other descriptor.
+// Returns our end of the socket, or -1.
+int handoff_exec(char **argv);
+
+int handoff_send(int sock, const char *blob, size_t len, const int *fds, int nfds);
+
+// Receive what handoff_send() sent. `*blob` is NUL terminated; free both.
+int handoff_recv(int sock, char **blob, size_t *len, int **fds, int *nfds);
+
+// New process: report that it is serving
+int handoff_ack(int sock);
+
+// Old process: wait for the ack. Returns 0 once the new process serves.
+int handoff_wait(int sock);
+
+#endif
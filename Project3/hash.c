@@ -0,0 +1,226 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_CAPACITY 64
+
+// Grow once the table is 70% full; probe runs stay short below that
+static int needs_grow(size_t count, size_t cap) {
+    return cap == 0 || (count + 1) * 10 > cap * 7;
+}
+
+static uint32_t hash_int(int key) {
+    // Fibonacci hashing spreads consecutive file descriptors apart
+    return (uint32_t) key * 2654435769u;
+}
+
+// FNV-1a
+static uint32_t hash_str(const char *key) {
+    uint32_t h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char) *key++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/////////////////// INT KEYS (sockets) //////////////////////////
+
+static int intmap_resize(IntMap *map, size_t cap) {
+    IntSlot *slots = (IntSlot*) malloc(cap * sizeof(IntSlot));
+    if (slots == NULL) {
+        perror("malloc failed for IntMap");
+        return -1;
+    }
+    for (size_t i = 0; i < cap; i++) {
+        slots[i].key = -1;
+    }
+
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->slots[i].key == -1) continue;
+        size_t j = hash_int(map->slots[i].key) & (cap - 1);
+        while (slots[j].key != -1) {
+            j = (j + 1) & (cap - 1);
+        }
+        slots[j] = map->slots[i];
+    }
+
+    free(map->slots);
+    map->slots = slots;
+    map->cap = cap;
+    return 0;
+}
+
+void *intmap_get(const IntMap *map, int key) {
+    if (map->cap == 0) return NULL;
+
+    size_t mask = map->cap - 1;
+    size_t i = hash_int(key) & mask;
+    while (map->slots[i].key != -1) {
+        if (map->slots[i].key == key) {
+            return map->slots[i].value;
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+// Insert or replace. Returns -1 if the table could not grow.
+int intmap_put(IntMap *map, int key, void *value) {
+    if (needs_grow(map->count, map->cap) &&
+        intmap_resize(map, map->cap ? map->cap * 2 : MIN_CAPACITY) == -1) {
+        return -1;
+    }
+
+    size_t mask = map->cap - 1;
+    size_t i = hash_int(key) & mask;
+    while (map->slots[i].key != -1) {
+        if (map->slots[i].key == key) {
+            map->slots[i].value = value;
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    map->slots[i].key = key;
+    map->slots[i].value = value;
+    map->count++;
+    return 0;
+}
+
+void intmap_remove(IntMap *map, int key) {
+    if (map->cap == 0) return;
+
+    size_t mask = map->cap - 1;
+    size_t i = hash_int(key) & mask;
+    while (map->slots[i].key != key) {
+        if (map->slots[i].key == -1) return;
+        i = (i + 1) & mask;
+    }
+
+    // Backward-shift the rest of the probe run into the hole so lookups
+    // never need tombstones
+    size_t hole = i;
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (map->slots[j].key == -1) break;
+        size_t home = hash_int(map->slots[j].key) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            map->slots[hole] = map->slots[j];
+            hole = j;
+        }
+    }
+    map->slots[hole].key = -1;
+    map->count--;
+}
+
+void intmap_free(IntMap *map) {
+    free(map->slots);
+    map->slots = NULL;
+    map->cap = 0;
+    map->count = 0;
+}
+
+/////////////////// STRING KEYS (names) //////////////////////////
+
+static int strmap_resize(StrMap *map, size_t cap) {
+    StrSlot *slots = (StrSlot*) calloc(cap, sizeof(StrSlot));
+    if (slots == NULL) {
+        perror("calloc failed for StrMap");
+        return -1;
+    }
+
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->slots[i].key == NULL) continue;
+        size_t j = map->slots[i].hash & (cap - 1);
+        while (slots[j].key != NULL) {
+            j = (j + 1) & (cap - 1);
+        }
+        slots[j] = map->slots[i];
+    }
+
+    free(map->slots);
+    map->slots = slots;
+    map->cap = cap;
+    return 0;
+}
+
+void *strmap_get(const StrMap *map, const char *key) {
+    if (map->cap == 0) return NULL;
+
+    uint32_t h = hash_str(key);
+    size_t mask = map->cap - 1;
+    size_t i = h & mask;
+    while (map->slots[i].key != NULL) {
+        if (map->slots[i].hash == h && strcmp(map->slots[i].key, key) == 0) {
+            return map->slots[i].value;
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+// Insert or replace. `key` must stay valid while it is in the table.
+int strmap_put(StrMap *map, const char *key, void *value) {
+    if (needs_grow(map->count, map->cap) &&
+        strmap_resize(map, map->cap ? map->cap * 2 : MIN_CAPACITY) == -1) {
+        return -1;
+    }
+
+    uint32_t h = hash_str(key);
+    size_t mask = map->cap - 1;
+    size_t i = h & mask;
+    while (map->slots[i].key != NULL) {
+        if (map->slots[i].hash == h && strcmp(map->slots[i].key, key) == 0) {
+            map->slots[i].key = key;
+            map->slots[i].value = value;
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    map->slots[i].hash = h;
+    map->slots[i].key = key;
+    map->slots[i].value = value;
+    map->count++;
+    return 0;
+}
+
+void strmap_remove(StrMap *map, const char *key) {
+    if (map->cap == 0) return;
+
+    uint32_t h = hash_str(key);
+    size_t mask = map->cap - 1;
+    size_t i = h & mask;
+    while (1) {
+        if (map->slots[i].key == NULL) return;
+        if (map->slots[i].hash == h && strcmp(map->slots[i].key, key) == 0) break;
+        i = (i + 1) & mask;
+    }
+
+    size_t hole = i;
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (map->slots[j].key == NULL) break;
+        size_t home = map->slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            map->slots[hole] = map->slots[j];
+            hole = j;
+        }
+    }
+    map->slots[hole].key = NULL;
+    map->count--;
+}
+
+void strmap_free(StrMap *map) {
+    free(map->slots);
+    map->slots = NULL;
+    map->cap = 0;
+    map->count = 0;
+}
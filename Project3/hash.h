@@ -0,0 +1,52 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Open-addressing hash tables (linear probing, backward-shift deletion)
+// used to index the user and room lists. The tables never own the
+// values, and string keys point into the indexed record (User->username,
+// Room->name), so a record must be removed before its key is changed.
+// A zero-initialized table is empty and ready to use.
+
+typedef struct IntSlot {
+    int key;                   // -1 marks an empty slot
+    void *value;
+} IntSlot;
+
+typedef struct IntMap {
+    IntSlot *slots;
+    size_t cap;                // Always zero or a power of two
+    size_t count;
+} IntMap;
+
+typedef struct StrSlot {
+    uint32_t hash;
+    const char *key;           // NULL marks an empty slot
+    void *value;
+} StrSlot;
+
+typedef struct StrMap {
+    StrSlot *slots;
+    size_t cap;
+    size_t count;
+} StrMap;
+
+/////////////////// INT KEYS (sockets) //////////////////////////
+void *intmap_get(const IntMap *map, int key);
+int intmap_put(IntMap *map, int key, void *value);
+void intmap_remove(IntMap *map, int key);
+void intmap_free(IntMap *map);
+
+/////////////////// STRING KEYS (names) //////////////////////////
+void *strmap_get(const StrMap *map, const char *key);
+int strmap_put(StrMap *map, const char *key, void *value);
+void strmap_remove(StrMap *map, const char *key);
+void strmap_free(StrMap *map);
+
+#endif
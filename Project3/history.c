@@ -0,0 +1,542 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "history.h"
+#include "wire.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static char *history_dir = NULL;          // NULL: history disabled
+
+static pthread_mutex_t hist_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hist_cond = PTHREAD_COND_INITIALIZER;
+static RoomLog *dirty_head = NULL;        // Logs with pending records
+static RoomLog *all_logs = NULL;
+static int stopping = 0;
+static int committing = 0;                // Writer holds records not yet synced
+static pthread_t writer_tid;
+
+/////////////////// SEGMENT FILES //////////////////////////
+
+static void segment_name(const RoomLog *log, unsigned int seq, char *out, size_t cap) {
+    snprintf(out, cap, "%s/%08u.log", log->path, seq);
+}
+
+static int open_segment(RoomLog *log, unsigned int seq, LogSegment *seg) {
+    char name[4096];
+    struct stat st;
+
+    segment_name(log, seq, name, sizeof(name));
+    seg->fd = open(name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (seg->fd == -1 || fstat(seg->fd, &st) == -1) {
+        perror("open history segment");
+        if (seg->fd != -1) close(seg->fd);
+        return -1;
+    }
+    seg->seq = seq;
+    seg->size = st.st_size;
+    return 0;
+}
+
+// A crash can leave half a record at the end of the newest segment
+static void trim_partial_line(LogSegment *seg) {
+    if (seg->size == 0) return;
+
+    char *map = (char*) mmap(NULL, seg->size, PROT_READ, MAP_SHARED, seg->fd, 0);
+    if (map == MAP_FAILED) return;
+    char *nl = (char*) memrchr(map, '\n', seg->size);
+    size_t keep = nl != NULL ? (size_t) (nl - map) + 1 : 0;
+    munmap(map, seg->size);
+
+    if (keep < seg->size && ftruncate(seg->fd, keep) == 0) {
+        seg->size = keep;
+    }
+}
+
+static int cmp_uint(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int*) a;
+    unsigned int y = *(const unsigned int*) b;
+    return (x > y) - (x < y);
+}
+
+// Open the newest segments that are already on disk, oldest first
+static int recover_segments(RoomLog *log) {
+    DIR *dir = opendir(log->path);
+    if (dir == NULL) return -1;
+
+    unsigned int *seqs = NULL;
+    int nseqs = 0, cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        unsigned int seq;
+        char tail;
+        if (sscanf(ent->d_name, "%8u.lo%c", &seq, &tail) != 2 || tail != 'g') continue;
+        if (nseqs == cap) {
+            cap = cap ? cap * 2 : 16;
+            unsigned int *grown = (unsigned int*) realloc(seqs, cap * sizeof(unsigned int));
+            if (grown == NULL) break;
+            seqs = grown;
+        }
+        seqs[nseqs++] = seq;
+    }
+    closedir(dir);
+    qsort(seqs, nseqs, sizeof(unsigned int), cmp_uint);
+
+    char name[4096];
+    for (int i = 0; i < nseqs; i++) {
+        if (i < nseqs - HISTORY_SEGMENTS) {
+            segment_name(log, seqs[i], name, sizeof(name));
+            unlink(name);
+        } else if (open_segment(log, seqs[i], &log->segs[log->nsegs]) == 0) {
+            log->nsegs++;
+        }
+    }
+    free(seqs);
+
+    if (log->nsegs > 0) {
+        trim_partial_line(&log->segs[log->nsegs - 1]);
+    }
+    return 0;
+}
+
+// Start a new newest segment, retiring the oldest one if needed.
+// Writer thread only.
+static int roll_segment(RoomLog *log) {
+    LogSegment seg;
+    unsigned int seq = log->nsegs > 0 ? log->segs[log->nsegs - 1].seq + 1 : 0;
+
+    if (log->nsegs > 0) {
+        fdatasync(log->segs[log->nsegs - 1].fd);
+    }
+    if (open_segment(log, seq, &seg) == -1) return -1;
+
+    pthread_mutex_lock(&log->lock);
+    if (log->nsegs == HISTORY_SEGMENTS) {
+        // Replays already queued hold their own descriptors
+        char name[4096];
+        segment_name(log, log->segs[0].seq, name, sizeof(name));
+        unlink(name);
+        close(log->segs[0].fd);
+        memmove(&log->segs[0], &log->segs[1], (HISTORY_SEGMENTS - 1) * sizeof(LogSegment));
+        log->nsegs--;
+    }
+    log->segs[log->nsegs++] = seg;
+    pthread_mutex_unlock(&log->lock);
+    return 0;
+}
+
+/////////////////// GROUP COMMIT //////////////////////////
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Move one log's pending records to disk. Returns the fd to sync or -1.
+static int commit_log(RoomLog *log) {
+    pthread_mutex_lock(&log->lock);
+    char *buf = log->pending;
+    size_t len = log->pending_len;
+    size_t cap = log->pending_cap;
+    log->pending = log->spare;
+    log->pending_cap = log->spare_cap;
+    log->pending_len = 0;
+    log->spare = buf;
+    log->spare_cap = cap;
+    log->writing_len = len;
+    int full = log->nsegs == 0 ||
+               (log->segs[log->nsegs - 1].size > 0 &&
+                log->segs[log->nsegs - 1].size + len > HISTORY_SEGMENT_SIZE);
+    pthread_mutex_unlock(&log->lock);
+
+    if (len == 0) return -1;
+
+    // Only this thread changes the newest segment, so it is safe to use
+    // without the lock; readers only look at the first `size` bytes, and
+    // at `spare` until it is counted there.
+    LogSegment *seg = NULL;
+    int fd = -1;
+    if (!full || roll_segment(log) == 0) {
+        seg = &log->segs[log->nsegs - 1];
+        if (write_all(seg->fd, buf, len) == -1) {
+            perror("write history");
+            // Drop back to the last whole record so replays stay line aligned
+            if (ftruncate(seg->fd, seg->size) == -1) perror("ftruncate history");
+        } else {
+            fd = seg->fd;
+        }
+    }
+
+    pthread_mutex_lock(&log->lock);
+    if (fd != -1) seg->size += len;
+    log->writing_len = 0;
+    pthread_mutex_unlock(&log->lock);
+    return fd;
+}
+
+static void *writer_main(void *arg) {
+    int *sync_fds = NULL;
+    int sync_cap = 0;
+
+    while (1) {
+        pthread_mutex_lock(&hist_lock);
+        while (dirty_head == NULL && !stopping) {
+            pthread_cond_wait(&hist_cond, &hist_lock);
+        }
+        int last = stopping;
+        pthread_mutex_unlock(&hist_lock);
+
+        // Let more records pile up so one fdatasync() covers them all
+        if (!last) usleep(HISTORY_COMMIT_MS * 1000);
+
+        pthread_mutex_lock(&hist_lock);
+        RoomLog *batch = dirty_head;
+        dirty_head = NULL;
+        committing = batch != NULL;
+        pthread_mutex_unlock(&hist_lock);
+
+        int nsync = 0;
+        while (batch != NULL) {
+            RoomLog *log = batch;
+            pthread_mutex_lock(&log->lock);
+            batch = log->next_dirty;
+            log->dirty = 0;
+            pthread_mutex_unlock(&log->lock);
+
+            int fd = commit_log(log);
+            if (fd == -1) continue;
+            if (nsync == sync_cap) {
+                sync_cap = sync_cap ? sync_cap * 2 : 64;
+                int *grown = (int*) realloc(sync_fds, sync_cap * sizeof(int));
+                if (grown == NULL) {
+                    fdatasync(fd);
+                    sync_cap = nsync;
+                    continue;
+                }
+                sync_fds = grown;
+            }
+            sync_fds[nsync++] = fd;
+        }
+        for (int i = 0; i < nsync; i++) {
+            fdatasync(sync_fds[i]);
+        }
+
+        pthread_mutex_lock(&hist_lock);
+        committing = 0;
+        pthread_mutex_unlock(&hist_lock);
+
+        if (last) break;
+    }
+    free(sync_fds);
+    return NULL;
+}
+
+/////////////////// PUBLIC API //////////////////////////
+
+int history_init(const char *dir) {
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        perror("mkdir history");
+        return -1;
+    }
+    if ((history_dir = strdup(dir)) == NULL) return -1;
+
+    if (pthread_create(&writer_tid, NULL, writer_main, NULL) != 0) {
+        perror("pthread_create history writer");
+        free(history_dir);
+        history_dir = NULL;
+        return -1;
+    }
+    printf("Room history: %s/\n", dir);
+    return 0;
+}
+
+RoomLog *history_open(const char *room) {
+    if (history_dir == NULL) return NULL;
+
+    RoomLog *log = (RoomLog*) calloc(1, sizeof(RoomLog));
+    if (log == NULL) {
+        perror("calloc failed for RoomLog");
+        return NULL;
+    }
+
+    // Hex keeps any room name a safe single path component
+    size_t dlen = strlen(history_dir);
+    size_t rlen = strlen(room);
+    log->path = (char*) malloc(dlen + 1 + 2 * rlen + 1);
+    if (log->path == NULL) {
+        free(log);
+        return NULL;
+    }
+    memcpy(log->path, history_dir, dlen);
+    log->path[dlen] = '/';
+    for (size_t i = 0; i < rlen; i++) {
+        sprintf(log->path + dlen + 1 + 2 * i, "%02x", (unsigned char) room[i]);
+    }
+    log->path[dlen + 1 + 2 * rlen] = '\0';
+
+    pthread_mutex_init(&log->lock, NULL);
+    if ((mkdir(log->path, 0755) == -1 && errno != EEXIST) || recover_segments(log) == -1) {
+        perror("open room history");
+        pthread_mutex_destroy(&log->lock);
+        free(log->path);
+        free(log);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&hist_lock);
+    log->next = all_logs;
+    all_logs = log;
+    pthread_mutex_unlock(&hist_lock);
+    return log;
+}
+
+void history_append(RoomLog *log, const char *record, size_t len) {
+    if (log == NULL) return;
+
+    pthread_mutex_lock(&log->lock);
+    if (log->pending_len + len > log->pending_cap) {
+        size_t cap = log->pending_cap ? log->pending_cap : 4096;
+        while (cap < log->pending_len + len) cap *= 2;
+        char *grown = cap <= HISTORY_PENDING_MAX ? (char*) realloc(log->pending, cap) : NULL;
+        if (grown == NULL) {
+            // Disk is not keeping up; lose history rather than chat
+            pthread_mutex_unlock(&log->lock);
+            return;
+        }
+        log->pending = grown;
+        log->pending_cap = cap;
+    }
+    memcpy(log->pending + log->pending_len, record, len);
+    log->pending_len += len;
+
+    if (!log->dirty) {
+        log->dirty = 1;
+        pthread_mutex_lock(&hist_lock);
+        log->next_dirty = dirty_head;
+        dirty_head = log;
+        pthread_cond_signal(&hist_cond);
+        pthread_mutex_unlock(&hist_lock);
+    }
+    pthread_mutex_unlock(&log->lock);
+}
+
+// The last records of a log, taken out under its lock so the reply can
+// be sent without it
+typedef struct Tail {
+    struct {
+        int fd;                // Our own dup() of the segment
+        off_t off;
+        size_t len;
+    } files[HISTORY_SEGMENTS]; // Newest first
+    int nfiles;
+    MsgBuf *recent;            // Records not in a segment yet, or NULL
+    int count;
+} Tail;
+
+// Step back over up to `*need` records ending at `end` in `buf`. Returns
+// where the oldest of them starts. Every record ends in '\n'; the one
+// before the start ends the previous record.
+static size_t tail_start(const char *buf, size_t end, int *need) {
+    size_t start = end;
+    while (*need > 0 && start > 0) {
+        const char *nl = start >= 2 ? (const char*) memrchr(buf, '\n', start - 1) : NULL;
+        start = nl != NULL ? (size_t) (nl - buf) + 1 : 0;
+        (*need)--;
+    }
+    return start;
+}
+
+// Copy out the last records still in memory: the ones the writer is
+// writing right now, then the ones it has yet to pick up. A line posted
+// within the last commit window is only there. Caller holds the log's lock.
+static int memory_tail(RoomLog *log, Tail *t, int *need) {
+    size_t pending = tail_start(log->pending, log->pending_len, need);
+    size_t writing = tail_start(log->spare, log->writing_len, need);
+    size_t len = (log->writing_len - writing) + (log->pending_len - pending);
+
+    if (len == 0) return 0;
+    if ((t->recent = msgbuf_alloc(len)) == NULL) return -1;
+    memcpy(t->recent->data, log->spare + writing, log->writing_len - writing);
+    memcpy(t->recent->data + log->writing_len - writing, log->pending + pending,
+           log->pending_len - pending);
+    return 0;
+}
+
+// Collect up to `n` records, walking back from the newest: memory first,
+// then segment by segment. Returns -1 if out of memory.
+static int collect_tail(RoomLog *log, int n, Tail *t) {
+    int need = n;
+    t->nfiles = 0;
+    t->recent = NULL;
+
+    pthread_mutex_lock(&log->lock);
+    int status = memory_tail(log, t, &need);
+    for (int i = log->nsegs - 1; i >= 0 && need > 0 && status == 0; i--) {
+        LogSegment *seg = &log->segs[i];
+        if (seg->size == 0) continue;
+
+        // A descriptor of our own, so the segment may be retired before
+        // the reply is out
+        int fd = dup(seg->fd);
+        if (fd == -1) break;
+        char *map = (char*) mmap(NULL, seg->size, PROT_READ, MAP_SHARED, seg->fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            break;
+        }
+        size_t start = tail_start(map, seg->size, &need);
+        munmap(map, seg->size);
+
+        t->files[t->nfiles].fd = fd;
+        t->files[t->nfiles].off = start;
+        t->files[t->nfiles].len = seg->size - start;
+        t->nfiles++;
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    t->count = n - need;
+    return status;
+}
+
+static void release_tail(Tail *t) {
+    for (int i = 0; i < t->nfiles; i++) close(t->files[i].fd);
+    msgbuf_unref(t->recent);
+}
+
+// A binary client gets the records in one RECORDS frame (see wire.h).
+// They are read rather than sent from the file: broadcasts may not land
+// between the ranges the way they can in a queued text reply.
+static void send_records_frame(Conn *c, const Tail *t) {
+    size_t total = t->recent != NULL ? t->recent->len : 0;
+    for (int i = 0; i < t->nfiles; i++) total += t->files[i].len;
+
+    MsgBuf *frame = wire_frame(WIRE_RECORDS, WIRE_OK, c->wire_tag, 4 + total);
+    if (frame == NULL) {
+        frame = wire_reply(c->wire_tag, WIRE_UNAVAILABLE, NULL);
+    } else {
+        char *p = wire_put32(frame->data + WIRE_HEADER, t->count);
+        int whole = 1;
+        for (int i = t->nfiles - 1; i >= 0 && whole; i--) {
+            size_t done = 0;
+            while (done < t->files[i].len) {
+                ssize_t got = pread(t->files[i].fd, p + done, t->files[i].len - done,
+                                    t->files[i].off + done);
+                if (got == -1 && errno == EINTR) continue;
+                if (got <= 0) break;
+                done += got;
+            }
+            whole = done == t->files[i].len;
+            p += done;
+        }
+        if (!whole) {
+            // A segment is shorter than it was mapped as; not a reply
+            // worth sending
+            msgbuf_unref(frame);
+            frame = wire_reply(c->wire_tag, WIRE_UNAVAILABLE, NULL);
+        } else if (t->recent != NULL) {
+            memcpy(p, t->recent->data, t->recent->len);
+        }
+    }
+    conn_send_buf(c, frame);
+    msgbuf_unref(frame);
+}
+
+// A text client gets one reply that is never cut short by the queue
+// limit: the header, the records oldest first, then how many there were
+static int send_records_text(Conn *c, const char *room, const Tail *t) {
+    ReplyPart parts[HISTORY_SEGMENTS + 3];
+    int nparts = 0;
+
+    MsgBuf *head = msgbuf_printf("History of '%s':\n", room);
+    MsgBuf *foot = msgbuf_printf("(%d message%s)\nchat>", t->count, t->count == 1 ? "" : "s");
+    int status = -1;
+    if (head != NULL && foot != NULL) {
+        parts[nparts++] = (ReplyPart) { .msg = head };
+        for (int i = t->nfiles - 1; i >= 0; i--) {
+            parts[nparts++] = (ReplyPart) { .fd = t->files[i].fd, .off = t->files[i].off,
+                                            .len = t->files[i].len };
+        }
+        if (t->recent != NULL) parts[nparts++] = (ReplyPart) { .msg = t->recent };
+        parts[nparts++] = (ReplyPart) { .msg = foot };
+        status = conn_send_reply(c, parts, nparts);
+    }
+    msgbuf_unref(head);
+    msgbuf_unref(foot);
+    return status;
+}
+
+int history_send_tail(RoomLog *log, Conn *c, const char *room, int n) {
+    Tail t;
+    int status = collect_tail(log, n, &t);
+
+    if (status == -1 && c->binary) {
+        MsgBuf *failed = wire_reply(c->wire_tag, WIRE_UNAVAILABLE, room);
+        conn_send_buf(c, failed);
+        msgbuf_unref(failed);
+    } else if (status == -1) {
+        static const char failed[] = "History is unavailable right now.\nchat>";
+        conn_send(c, failed, sizeof(failed) - 1);
+    } else if (c->binary) {
+        send_records_frame(c, &t);
+    } else {
+        status = send_records_text(c, room, &t);
+    }
+    release_tail(&t);
+    return status == -1 ? -1 : t.count;
+}
+
+void history_flush() {
+    if (history_dir == NULL) return;
+
+    pthread_mutex_lock(&hist_lock);
+    while (dirty_head != NULL || committing) {
+        pthread_mutex_unlock(&hist_lock);
+        usleep(1000);
+        pthread_mutex_lock(&hist_lock);
+    }
+    pthread_mutex_unlock(&hist_lock);
+}
+
+void history_shutdown() {
+    if (history_dir == NULL) return;
+
+    pthread_mutex_lock(&hist_lock);
+    stopping = 1;
+    pthread_cond_signal(&hist_cond);
+    pthread_mutex_unlock(&hist_lock);
+    pthread_join(writer_tid, NULL);
+
+    RoomLog *log = all_logs;
+    while (log != NULL) {
+        RoomLog *temp = log;
+        log = log->next;
+        for (int i = 0; i < temp->nsegs; i++) {
+            close(temp->segs[i].fd);
+        }
+        pthread_mutex_destroy(&temp->lock);
+        free(temp->pending);
+        free(temp->spare);
+        free(temp->path);
+        free(temp);
+    }
+    all_logs = NULL;
+    free(history_dir);
+    history_dir = NULL;
+}
@@ -0,0 +1,81 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "conn.h"
+
+// Persistent room history.
+//
+// Every room has an append-only log split into numbered segment files
+// under <dir>/<hex of room name>/. Records are the chat lines as clients
+// see them ("::name> text\n"), so a replay is just a byte range of a
+// segment and goes out with sendfile() without being copied or parsed.
+//
+// The send path only copies the record into the room's pending buffer.
+// A single writer thread collects every room with pending records once
+// per HISTORY_COMMIT_MS, write()s each buffer to the room's newest
+// segment and then fdatasync()s all of them together (group commit).
+// `history` finds the last lines by scanning mmap()ed segments backwards,
+// after the records still in memory.
+
+#define HISTORY_SEGMENT_SIZE (4 * 1024 * 1024)   // Roll to a new file past this
+#define HISTORY_SEGMENTS     8                   // Newest segments kept per room
+#define HISTORY_COMMIT_MS    5                   // Group commit window
+#define HISTORY_PENDING_MAX  (8 * 1024 * 1024)   // Unwritten bytes per room
+#define HISTORY_DEFAULT_LINES 20
+#define HISTORY_MAX_LINES    1000
+
+typedef struct LogSegment {
+    int fd;
+    unsigned int seq;          // File name number
+    size_t size;               // Bytes written, always whole lines
+} LogSegment;
+
+typedef struct RoomLog {
+    pthread_mutex_t lock;      // Guards everything below but `spare`
+    char *path;                // Directory holding the segments
+    LogSegment segs[HISTORY_SEGMENTS];   // Oldest first
+    int nsegs;
+
+    char *pending;             // Records waiting for the writer
+    size_t pending_len;
+    size_t pending_cap;
+    char *spare;               // Writer's buffer, swapped with `pending`
+    size_t spare_cap;
+    size_t writing_len;        // Bytes of `spare` being written, not yet in a segment
+
+    int dirty;                 // On the writer's list
+    struct RoomLog *next_dirty;
+    struct RoomLog *next;      // All logs, for shutdown
+} RoomLog;
+
+// Enable history under `dir` and start the writer thread
+int history_init(const char *dir);
+
+// Open (or recover) a room's log. NULL when history is disabled.
+RoomLog *history_open(const char *room);
+
+// Add a record; it reaches disk in the next group commit
+void history_append(RoomLog *log, const char *record, size_t len);
+
+// Reply to "history <room> n": the last `n` records, taken out under the
+// log's lock and sent after it is released, so a slow client never holds
+// up appends. A text client gets a header, the records and their count
+// as one reply; a binary client one RECORDS frame. Returns how many
+// records were sent, -1 if none were.
+int history_send_tail(RoomLog *log, Conn *c, const char *room, int n);
+
+// Wait until everything appended so far is written and synced. Only
+// waits for records that are already in, so callers stop appends first.
+void history_flush();
+
+// Write and sync everything pending, stop the writer, close all logs
+void history_shutdown();
+
+#endif
@@ -0,0 +1,202 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "idset.h"
+#include "epoch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/////////////////// BITSETS //////////////////////////
+
+static int bitset_grow(Bitset *b, size_t nwords) {
+    if (nwords <= b->nwords) return 0;
+
+    size_t cap = b->nwords ? b->nwords : 1;
+    while (cap < nwords) cap *= 2;
+
+    uint64_t *words = (uint64_t*) realloc(b->words, cap * sizeof(uint64_t));
+    if (words == NULL) {
+        perror("realloc failed for Bitset");
+        return -1;
+    }
+    memset(words + b->nwords, 0, (cap - b->nwords) * sizeof(uint64_t));
+    b->words = words;
+    b->nwords = cap;
+    return 0;
+}
+
+int bitset_set(Bitset *b, int id) {
+    if (bitset_grow(b, (size_t) id / 64 + 1) == -1) return -1;
+    b->words[id / 64] |= (uint64_t) 1 << (id % 64);
+    return 0;
+}
+
+void bitset_clear(Bitset *b, int id) {
+    if ((size_t) id / 64 < b->nwords) {
+        b->words[id / 64] &= ~((uint64_t) 1 << (id % 64));
+    }
+}
+
+int bitset_test(const Bitset *b, int id) {
+    if (id < 0 || (size_t) id / 64 >= b->nwords) return 0;
+    return (b->words[id / 64] >> (id % 64)) & 1;
+}
+
+int bitset_or(Bitset *dst, const Bitset *src) {
+    if (bitset_grow(dst, src->nwords) == -1) return -1;
+    for (size_t i = 0; i < src->nwords; i++) {
+        dst->words[i] |= src->words[i];
+    }
+    return 0;
+}
+
+int bitset_next(const Bitset *b, int from) {
+    size_t w = (size_t) from / 64;
+    if (from < 0 || w >= b->nwords) return -1;
+
+    uint64_t word = b->words[w] & (~(uint64_t) 0 << (from % 64));
+    while (word == 0) {
+        if (++w >= b->nwords) return -1;
+        word = b->words[w];
+    }
+    return (int) (w * 64) + __builtin_ctzll(word);
+}
+
+int bitset_count(const Bitset *b) {
+    int n = 0;
+    for (size_t i = 0; i < b->nwords; i++) {
+        n += __builtin_popcountll(b->words[i]);
+    }
+    return n;
+}
+
+void bitset_zero(Bitset *b) {
+    if (b->words != NULL) {
+        memset(b->words, 0, b->nwords * sizeof(uint64_t));
+    }
+}
+
+void bitset_free(Bitset *b) {
+    free(b->words);
+    b->words = NULL;
+    b->nwords = 0;
+}
+
+/////////////////// ID LISTS //////////////////////////
+
+int idlist_add(IdList *l, int id) {
+    if (l->count == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 4;
+        int *ids = (int*) realloc(l->ids, cap * sizeof(int));
+        if (ids == NULL) {
+            perror("realloc failed for IdList");
+            return -1;
+        }
+        l->ids = ids;
+        l->cap = cap;
+    }
+    l->ids[l->count++] = id;
+    return 0;
+}
+
+void idlist_remove(IdList *l, int id) {
+    for (int i = 0; i < l->count; i++) {
+        if (l->ids[i] == id) {
+            l->ids[i] = l->ids[--l->count];
+            return;
+        }
+    }
+}
+
+void idlist_free(IdList *l) {
+    free(l->ids);
+    memset(l, 0, sizeof(IdList));
+}
+
+/////////////////// ID TABLES //////////////////////////
+
+// Room for `cap` ids. The old array may still be in a reader's hands,
+// so it is copied and retired rather than realloc()ed.
+static int idtable_grow(IdTable *t, int cap) {
+    int old_cap = atomic_load_explicit(&t->cap, memory_order_relaxed);
+    _Atomic(void*) *old = atomic_load_explicit(&t->items, memory_order_relaxed);
+    _Atomic(void*) *items = (_Atomic(void*)*) calloc(cap, sizeof(void*));
+    int *free_ids = (int*) realloc(t->free_ids, cap * sizeof(int));
+    if (free_ids != NULL) t->free_ids = free_ids;
+    IdLimbo *limbo = (IdLimbo*) realloc(t->limbo, cap * sizeof(IdLimbo));
+    if (limbo != NULL) t->limbo = limbo;
+    if (items == NULL || free_ids == NULL || limbo == NULL) {
+        perror("realloc failed for IdTable");
+        free(items);
+        return -1;
+    }
+
+    for (int i = 0; i < old_cap; i++) {
+        atomic_init(&items[i], atomic_load_explicit(&old[i], memory_order_relaxed));
+    }
+    // A reader that sees the new cap also sees the array it belongs to
+    atomic_store_explicit(&t->items, items, memory_order_release);
+    atomic_store_explicit(&t->cap, cap, memory_order_release);
+    epoch_retire(old, free);
+    return 0;
+}
+
+// Move ids no reader can still hold from limbo to the free stack
+static void idtable_release(IdTable *t) {
+    int n = 0;
+    while (n < t->nlimbo && epoch_passed(t->limbo[n].stamp)) {
+        t->free_ids[t->nfree++] = t->limbo[n++].id;
+    }
+    if (n > 0) {
+        memmove(t->limbo, t->limbo + n, (t->nlimbo - n) * sizeof(IdLimbo));
+        t->nlimbo -= n;
+    }
+}
+
+int idtable_add(IdTable *t, void *item) {
+    int id;
+
+    idtable_release(t);
+    if (t->nfree > 0) {
+        id = t->free_ids[--t->nfree];
+    } else {
+        int cap = atomic_load_explicit(&t->cap, memory_order_relaxed);
+        if (t->next == cap && idtable_grow(t, cap ? cap * 2 : 64) == -1) {
+            return -1;
+        }
+        id = t->next++;
+    }
+
+    atomic_store_explicit(&t->items[id], item, memory_order_release);
+    return id;
+}
+
+void idtable_remove(IdTable *t, int id) {
+    if (idtable_get(t, id) == NULL) return;
+    atomic_store_explicit(&t->items[id], NULL, memory_order_release);
+    t->limbo[t->nlimbo].id = id;
+    t->limbo[t->nlimbo].stamp = epoch_stamp();
+    t->nlimbo++;
+}
+
+void *idtable_get(const IdTable *t, int id) {
+    if (id < 0 || id >= t->next) return NULL;
+    return atomic_load_explicit(&t->items[id], memory_order_relaxed);
+}
+
+void *idtable_peek(const IdTable *t, int id) {
+    int cap = atomic_load_explicit(&t->cap, memory_order_acquire);
+    if (id < 0 || id >= cap) return NULL;
+    _Atomic(void*) *items = atomic_load_explicit(&t->items, memory_order_acquire);
+    return atomic_load_explicit(&items[id], memory_order_acquire);
+}
+
+void idtable_free(IdTable *t) {
+    free(t->items);
+    free(t->free_ids);
+    free(t->limbo);
+    memset(t, 0, sizeof(IdTable));
+}
@@ -0,0 +1,82 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef IDSET_H
+#define IDSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Users and rooms are numbered with small dense integer ids so that
+// membership can be stored as bits instead of copied name strings.
+
+// Growable bitset over ids. A zero-initialized Bitset is empty.
+typedef struct Bitset {
+    uint64_t *words;
+    size_t nwords;
+} Bitset;
+
+// Unordered list of ids, for sets that are small but drawn from a large
+// id space: walking it costs its size, not the highest id.
+typedef struct IdList {
+    int *ids;
+    int count;
+    int cap;
+} IdList;
+
+// A released id and the epoch_stamp() it was released at
+typedef struct IdLimbo {
+    int id;
+    long stamp;
+} IdLimbo;
+
+// Id allocator plus id -> record table. Freed ids are handed out again
+// before new ones, which keeps ids (and so bitsets) dense.
+//
+// Changes need the caller's lock, but idtable_peek() works without one
+// inside an epoch section (see epoch.h): an outgrown array is retired,
+// not freed, and a released id stays in limbo until no reader can still
+// be holding it, so an old bitset never reaches the id's next owner.
+typedef struct IdTable {
+    _Atomic(void*) *_Atomic items;
+    atomic_int cap;    // Slots in items; stored after items grows
+    int next;          // Lowest id never handed out
+    int *free_ids;     // Stack of ids ready for reuse
+    int nfree;
+    IdLimbo *limbo;    // Released ids not yet reusable, oldest first
+    int nlimbo;
+} IdTable;
+
+/////////////////// BITSETS //////////////////////////
+int bitset_set(Bitset *b, int id);
+void bitset_clear(Bitset *b, int id);
+int bitset_test(const Bitset *b, int id);
+int bitset_or(Bitset *dst, const Bitset *src);
+int bitset_next(const Bitset *b, int from);   // First set id >= from, or -1
+int bitset_count(const Bitset *b);
+void bitset_zero(Bitset *b);                  // Clear all bits, keep storage
+void bitset_free(Bitset *b);
+
+// Visit every id in a bitset
+#define BITSET_FOREACH(id, b) \
+    for (int id = bitset_next((b), 0); id != -1; id = bitset_next((b), id + 1))
+
+/////////////////// ID LISTS //////////////////////////
+int idlist_add(IdList *l, int id);            // Caller knows it is absent
+void idlist_remove(IdList *l, int id);        // Moves the last id into its place
+void idlist_free(IdList *l);
+
+// Visit every id in a list. The list must not change meanwhile.
+#define IDLIST_FOREACH(id, l) \
+    for (int id##_at = 0, id = 0; id##_at < (l)->count && ((id = (l)->ids[id##_at]), 1); id##_at++)
+
+/////////////////// ID TABLES //////////////////////////
+int idtable_add(IdTable *t, void *item);      // Returns the new id or -1
+void idtable_remove(IdTable *t, int id);
+void *idtable_get(const IdTable *t, int id);
+void *idtable_peek(const IdTable *t, int id); // Without the lock, see above
+void idtable_free(IdTable *t);
+
+#endif
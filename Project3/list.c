@@ -3,6 +3,40 @@
 // Utsav Shah
 
 #include "list.h"
+#include "metrics.h"
+#include "epoch.h"
+
+SlabPool user_pool = SLAB_POOL_INITIALIZER(User, "user");
+SlabPool room_pool = SLAB_POOL_INITIALIZER(Room, "room");
+
+/////////////////// PUBLISHED COPIES //////////////////////////
+
+// Replace the copy in `slot` with a fresh one of `src`. The copy is one
+// allocation, trimmed of trailing empty words, and never changes again;
+// the one it replaces goes to epoch_retire(). If it cannot be allocated
+// readers see an empty set rather than a stale one.
+static void publishBitset(_Atomic(Bitset*) *slot, const Bitset *src) {
+    size_t n = src->nwords;
+    while (n > 0 && src->words[n - 1] == 0) n--;
+
+    Bitset *copy = NULL;
+    if (n > 0) {
+        copy = (Bitset*) malloc(sizeof(Bitset) + n * sizeof(uint64_t));
+        if (copy != NULL) {
+            copy->words = (uint64_t*) (copy + 1);
+            copy->nwords = n;
+            memcpy(copy->words, src->words, n * sizeof(uint64_t));
+        } else {
+            perror("malloc failed for published Bitset");
+        }
+    }
+    epoch_retire(atomic_exchange(slot, copy), free);
+}
+
+// Readers may still be looking at a removed user's conn
+static void freeUserRecord(void *user) {
+    slab_free(&user_pool, user);
+}
 
 /////////////////// USER FUNCTIONS //////////////////////////
 
@@ -14,19 +48,35 @@ User* insertFirstU(User *head, int socket, char *username) {
         return head;
     }
     
+    return prependU(head, socket, username);
+}
+
+// Insert user at the first location without the duplicate scan.
+// Callers that keep a name index check for duplicates there.
+User* prependU(User *head, int socket, const char *username) {
     // Create a new user node
-    User *newUser = (User*) malloc(sizeof(User));
+    User *newUser = (User*) slab_alloc(&user_pool);
     if (newUser == NULL) {
         perror("malloc failed for User");
         return head;
     }
     
+    newUser->id = -1;
     newUser->socket = socket;
+    newUser->conn = NULL;
     strncpy(newUser->username, username, MAX_NAME_LEN - 1);
     newUser->username[MAX_NAME_LEN - 1] = '\0';
-    newUser->rooms = NULL;
-    newUser->directConns = NULL;
+    memset(&newUser->rooms, 0, sizeof(Bitset));
+    memset(&newUser->directConns, 0, sizeof(Bitset));
+    memset(&newUser->dmPeers, 0, sizeof(IdList));
+    atomic_init(&newUser->publishedRooms, NULL);
+    atomic_init(&newUser->publishedConns, NULL);
+    pthread_mutex_init(&newUser->lock, NULL);
+    newUser->prev = NULL;
     newUser->next = head;
+    if (head != NULL) {
+        head->prev = newUser;
+    }
     
     return newUser;
 }
@@ -59,39 +109,33 @@ User* findUBySocket(User *head, int socket) {
 
 // Delete a user by socket
 User* deleteU(User *head, int socket) {
-    User *current = head;
-    User *prev = NULL;
+    User *user = findUBySocket(head, socket);
+    if (user == NULL) {
+        return head;
+    }
+    return unlinkU(head, user);
+}
+
+// Remove a user known to be in the list and free it. The record itself
+// is freed once lock-free readers are done with it.
+User* unlinkU(User *head, User *user) {
+    bitset_free(&user->rooms);
+    bitset_free(&user->directConns);
+    idlist_free(&user->dmPeers);
+    epoch_retire(atomic_exchange(&user->publishedRooms, NULL), free);
+    epoch_retire(atomic_exchange(&user->publishedConns, NULL), free);
     
-    while (current != NULL) {
-        if (current->socket == socket) {
-            // Free room list
-            RoomList *rCurrent = current->rooms;
-            while (rCurrent != NULL) {
-                RoomList *rTemp = rCurrent;
-                rCurrent = rCurrent->next;
-                free(rTemp);
-            }
-            
-            // Free direct connections
-            DirectConn *dCurrent = current->directConns;
-            while (dCurrent != NULL) {
-                DirectConn *dTemp = dCurrent;
-                dCurrent = dCurrent->next;
-                free(dTemp);
-            }
-            
-            // Remove from list
-            if (prev == NULL) {
-                head = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            free(current);
-            return head;
-        }
-        prev = current;
-        current = current->next;
+    // Remove from list
+    if (user->prev == NULL) {
+        head = user->next;
+    } else {
+        user->prev->next = user->next;
+    }
+    if (user->next != NULL) {
+        user->next->prev = user->prev;
     }
+    pthread_mutex_destroy(&user->lock);
+    epoch_retire(user, freeUserRecord);
     return head;
 }
 
@@ -114,16 +158,27 @@ Room* insertFirstR(Room *head, const char *roomname) {
         return head;
     }
     
+    return prependR(head, roomname);
+}
+
+// Insert room at the first location without the duplicate scan
+Room* prependR(Room *head, const char *roomname) {
     // Create a new room node
-    Room *newRoom = (Room*) malloc(sizeof(Room));
+    Room *newRoom = (Room*) slab_alloc(&room_pool);
     if (newRoom == NULL) {
         perror("malloc failed for Room");
         return head;
     }
     
+    newRoom->id = -1;
     strncpy(newRoom->name, roomname, MAX_NAME_LEN - 1);
     newRoom->name[MAX_NAME_LEN - 1] = '\0';
-    newRoom->users = NULL;
+    memset(&newRoom->users, 0, sizeof(Bitset));
+    atomic_init(&newRoom->publishedUsers, NULL);
+    rwlock_init(&newRoom->lock);
+    newRoom->lock.lock_class = LOCK_CLASS_ROOM;
+    atomic_init(&newRoom->limit.tat, 0);
+    newRoom->log = NULL;
     newRoom->next = head;
     
     return newRoom;
@@ -143,207 +198,96 @@ Room* findR(Room *head, const char *roomname) {
 }
 
 // Add a user to a room
-void addUserToR(Room *room, const char *username) {
-    if (room == NULL) return;
-    
-    // Check if user already in room
-    RoomUser *current = room->users;
-    while (current != NULL) {
-        if (strcmp(current->username, username) == 0) {
-            return; // Already in room
-        }
-        current = current->next;
-    }
-    
-    // Add new user to room
-    RoomUser *newRoomUser = (RoomUser*) malloc(sizeof(RoomUser));
-    if (newRoomUser == NULL) {
-        perror("malloc failed for RoomUser");
-        return;
-    }
-    
-    strncpy(newRoomUser->username, username, MAX_NAME_LEN - 1);
-    newRoomUser->username[MAX_NAME_LEN - 1] = '\0';
-    newRoomUser->next = room->users;
-    room->users = newRoomUser;
+void addUserToR(Room *room, int userId) {
+    if (room == NULL || userId < 0) return;
+    bitset_set(&room->users, userId);
+    publishBitset(&room->publishedUsers, &room->users);
 }
 
 // Remove a user from a room
-void removeUserFromR(Room *room, const char *username) {
-    if (room == NULL) return;
-    
-    RoomUser *current = room->users;
-    RoomUser *prev = NULL;
-    
-    while (current != NULL) {
-        if (strcmp(current->username, username) == 0) {
-            if (prev == NULL) {
-                room->users = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            free(current);
-            return;
-        }
-        prev = current;
-        current = current->next;
-    }
+void removeUserFromR(Room *room, int userId) {
+    if (room == NULL || userId < 0) return;
+    bitset_clear(&room->users, userId);
+    publishBitset(&room->publishedUsers, &room->users);
 }
 
 /////////////////// DIRECT CONNECTION FUNCTIONS //////////////////////////
 
-// Add a direct connection to a user
-void addDirectConn(User *user, const char *targetUsername) {
-    if (user == NULL) return;
-    
-    // Check if already connected
-    if (findDirectConn(user, targetUsername) != NULL) {
-        return;
+// Add a direct connection to a user. The bitset answers "connected?" in
+// one lookup; the list is for visiting every peer.
+void addDirectConn(User *user, int targetId) {
+    if (user == NULL || targetId < 0 || bitset_test(&user->directConns, targetId)) return;
+    if (bitset_set(&user->directConns, targetId) == 0 &&
+        idlist_add(&user->dmPeers, targetId) == -1) {
+        bitset_clear(&user->directConns, targetId);
     }
-    
-    DirectConn *newConn = (DirectConn*) malloc(sizeof(DirectConn));
-    if (newConn == NULL) {
-        perror("malloc failed for DirectConn");
-        return;
-    }
-    
-    strncpy(newConn->username, targetUsername, MAX_NAME_LEN - 1);
-    newConn->username[MAX_NAME_LEN - 1] = '\0';
-    newConn->next = user->directConns;
-    user->directConns = newConn;
+    publishBitset(&user->publishedConns, &user->directConns);
 }
 
 // Remove a direct connection from a user
-void removeDirectConn(User *user, const char *targetUsername) {
-    if (user == NULL) return;
-    
-    DirectConn *current = user->directConns;
-    DirectConn *prev = NULL;
-    
-    while (current != NULL) {
-        if (strcmp(current->username, targetUsername) == 0) {
-            if (prev == NULL) {
-                user->directConns = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            free(current);
-            return;
-        }
-        prev = current;
-        current = current->next;
-    }
+void removeDirectConn(User *user, int targetId) {
+    if (user == NULL || !bitset_test(&user->directConns, targetId)) return;
+    bitset_clear(&user->directConns, targetId);
+    idlist_remove(&user->dmPeers, targetId);
+    publishBitset(&user->publishedConns, &user->directConns);
 }
 
-// Find a direct connection
-DirectConn* findDirectConn(User *user, const char *targetUsername) {
-    if (user == NULL) return NULL;
-    
-    DirectConn *current = user->directConns;
-    while (current != NULL) {
-        if (strcmp(current->username, targetUsername) == 0) {
-            return current;
-        }
-        current = current->next;
-    }
-    return NULL;
+// Check for a direct connection
+bool findDirectConn(User *user, int targetId) {
+    if (user == NULL) return false;
+    return bitset_test(&user->directConns, targetId);
 }
 
 /////////////////// ROOM LIST FUNCTIONS //////////////////////////
 
 // Add a room to a user's room list
-void addRoomToUser(User *user, const char *roomname) {
-    if (user == NULL) return;
-    
-    // Check if already in room
-    RoomList *current = user->rooms;
-    while (current != NULL) {
-        if (strcmp(current->roomname, roomname) == 0) {
-            return;
-        }
-        current = current->next;
-    }
-    
-    RoomList *newRoomEntry = (RoomList*) malloc(sizeof(RoomList));
-    if (newRoomEntry == NULL) {
-        perror("malloc failed for RoomList");
-        return;
-    }
-    
-    strncpy(newRoomEntry->roomname, roomname, MAX_NAME_LEN - 1);
-    newRoomEntry->roomname[MAX_NAME_LEN - 1] = '\0';
-    newRoomEntry->next = user->rooms;
-    user->rooms = newRoomEntry;
+void addRoomToUser(User *user, int roomId) {
+    if (user == NULL || roomId < 0) return;
+    bitset_set(&user->rooms, roomId);
+    publishBitset(&user->publishedRooms, &user->rooms);
 }
 
 // Remove a room from a user's room list
-void removeRoomFromUser(User *user, const char *roomname) {
-    if (user == NULL) return;
-    
-    RoomList *current = user->rooms;
-    RoomList *prev = NULL;
-    
-    while (current != NULL) {
-        if (strcmp(current->roomname, roomname) == 0) {
-            if (prev == NULL) {
-                user->rooms = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            free(current);
-            return;
-        }
-        prev = current;
-        current = current->next;
-    }
+void removeRoomFromUser(User *user, int roomId) {
+    if (user == NULL || roomId < 0) return;
+    bitset_clear(&user->rooms, roomId);
+    publishBitset(&user->publishedRooms, &user->rooms);
 }
 
 /////////////////// CLEANUP FUNCTIONS //////////////////////////
 
-// Free all users
+// Free all users. The records themselves go back with the whole pool,
+// after any retired ones went back to it.
 void freeAllUsers(User **head) {
+    epoch_drain();
+
     User *current = *head;
     while (current != NULL) {
         User *temp = current;
         current = current->next;
         
-        // Free room list
-        RoomList *rCurrent = temp->rooms;
-        while (rCurrent != NULL) {
-            RoomList *rTemp = rCurrent;
-            rCurrent = rCurrent->next;
-            free(rTemp);
-        }
-        
-        // Free direct connections
-        DirectConn *dCurrent = temp->directConns;
-        while (dCurrent != NULL) {
-            DirectConn *dTemp = dCurrent;
-            dCurrent = dCurrent->next;
-            free(dTemp);
-        }
-        
-        free(temp);
+        bitset_free(&temp->rooms);
+        bitset_free(&temp->directConns);
+        idlist_free(&temp->dmPeers);
+        free(atomic_load(&temp->publishedRooms));
+        free(atomic_load(&temp->publishedConns));
+        pthread_mutex_destroy(&temp->lock);
     }
+    slab_release(&user_pool);
     *head = NULL;
 }
 
-// Free all rooms
+// Free all rooms, releasing the room pool in one go
 void freeAllRooms(Room **head) {
     Room *current = *head;
     while (current != NULL) {
         Room *temp = current;
         current = current->next;
         
-        // Free users in room
-        RoomUser *uCurrent = temp->users;
-        while (uCurrent != NULL) {
-            RoomUser *uTemp = uCurrent;
-            uCurrent = uCurrent->next;
-            free(uTemp);
-        }
-        
-        free(temp);
+        bitset_free(&temp->users);
+        free(atomic_load(&temp->publishedUsers));
+        rwlock_destroy(&temp->lock);
     }
+    slab_release(&room_pool);
     *head = NULL;
 }
\ No newline at end of file
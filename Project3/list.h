@@ -5,68 +5,88 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
+
+#include "rwlock.h"
+#include "idset.h"
+#include "slab.h"
+#include "ratelimit.h"
 
 #define MAX_NAME_LEN 50
 
 // Forward declarations
 struct User;
 struct Room;
+struct Conn;
+struct RoomLog;
 
-// Node for user list within a room
-typedef struct RoomUser {
-    char username[MAX_NAME_LEN];
-    struct RoomUser *next;
-} RoomUser;
-
-// Node for direct message connections
-typedef struct DirectConn {
-    char username[MAX_NAME_LEN];
-    struct DirectConn *next;
-} DirectConn;
-
-// Node for room list within a user
-typedef struct RoomList {
-    char roomname[MAX_NAME_LEN];
-    struct RoomList *next;
-} RoomList;
+// Membership is stored as bitsets over dense ids (see idset.h): a user
+// joining a room sets one bit on each side instead of copying names, and
+// renaming a user touches nothing but the User itself.
+//
+// Each membership bitset also has a published copy for the broadcast
+// path, which reads it without locks inside an epoch section (see
+// epoch.h). The functions below that change a bitset republish it, so
+// callers keep locking exactly as before; a replaced copy, and a removed
+// User, are freed once no reader can still see them.
 
 // User structure
 typedef struct User {
+    int id;                    // Dense user id, -1 until registered
     int socket;
+    struct Conn *conn;         // Outbound side of the socket
     char username[MAX_NAME_LEN];
-    RoomList *rooms;           // Rooms this user belongs to
-    DirectConn *directConns;   // Direct connections (DMs)
+    Bitset rooms;              // Ids of rooms this user belongs to
+    Bitset directConns;        // Ids of users with a DM connection
+    IdList dmPeers;            // The same ids, to walk in O(connections)
+    pthread_mutex_t lock;      // Guards rooms, directConns and dmPeers
+    _Atomic(Bitset*) publishedRooms;   // Copies of rooms and directConns,
+    _Atomic(Bitset*) publishedConns;   // NULL when empty
+    struct User *prev;         // Back link so removal is O(1)
     struct User *next;
 } User;
 
 // Room structure  
 typedef struct Room {
+    int id;                    // Dense room id, -1 until registered
     char name[MAX_NAME_LEN];
-    RoomUser *users;           // Users in this room
+    Bitset users;              // Ids of users in this room
+    RWLock lock;               // Guards users
+    _Atomic(Bitset*) publishedUsers;   // Copy of users, NULL when empty
+    RateBucket limit;          // Messages posted to the room
+    struct RoomLog *log;       // Message history, NULL if disabled
     struct Room *next;
 } Room;
 
+// Users and rooms come from these pools, so connect/disconnect churn
+// reuses memory and freeAllUsers()/freeAllRooms() release it in bulk
+extern SlabPool user_pool;
+extern SlabPool room_pool;
+
 /////////////////// USER FUNCTIONS //////////////////////////
 User* insertFirstU(User *head, int socket, char *username);
+User* prependU(User *head, int socket, const char *username);
 User* findU(User *head, char* username);
 User* findUBySocket(User *head, int socket);
 User* deleteU(User *head, int socket);
+User* unlinkU(User *head, User *user);
 void renameU(User *head, int socket, const char *newName);
 
 /////////////////// ROOM FUNCTIONS //////////////////////////
 Room* insertFirstR(Room *head, const char *roomname);
+Room* prependR(Room *head, const char *roomname);
 Room* findR(Room *head, const char *roomname);
-void addUserToR(Room *room, const char *username);
-void removeUserFromR(Room *room, const char *username);
+void addUserToR(Room *room, int userId);
+void removeUserFromR(Room *room, int userId);
 
 /////////////////// DIRECT CONNECTION FUNCTIONS //////////////////////////
-void addDirectConn(User *user, const char *targetUsername);
-void removeDirectConn(User *user, const char *targetUsername);
-DirectConn* findDirectConn(User *user, const char *targetUsername);
+void addDirectConn(User *user, int targetId);
+void removeDirectConn(User *user, int targetId);
+bool findDirectConn(User *user, int targetId);
 
 /////////////////// ROOM LIST FUNCTIONS //////////////////////////
-void addRoomToUser(User *user, const char *roomname);
-void removeRoomFromUser(User *user, const char *roomname);
+void addRoomToUser(User *user, int roomId);
+void removeRoomFromUser(User *user, int roomId);
 
 /////////////////// CLEANUP FUNCTIONS //////////////////////////
 void freeAllUsers(User **head);
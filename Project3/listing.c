@@ -0,0 +1,235 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "listing.h"
+#include "conn.h"
+#include "wire.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROMPT "chat>"
+
+/////////////////// BUILDING //////////////////////////
+
+static void append(ListingBuilder *b, const char *data, size_t len) {
+    if (b->failed) return;
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + len) cap *= 2;
+        char *grown = (char*) realloc(b->buf, cap);
+        if (grown == NULL) {
+            b->failed = 1;
+            return;
+        }
+        b->buf = grown;
+        b->cap = cap;
+    }
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+}
+
+static void mark_line(ListingBuilder *b) {
+    if (b->failed) return;
+    if (b->count + 1 > b->lines_cap) {
+        int cap = b->lines_cap ? b->lines_cap * 2 : 256;
+        size_t *grown = (size_t*) realloc(b->lines, cap * sizeof(size_t));
+        if (grown == NULL) {
+            b->failed = 1;
+            return;
+        }
+        b->lines = grown;
+        b->lines_cap = cap;
+    }
+    b->lines[b->count] = b->len;
+}
+
+void listing_add(ListingBuilder *b, const char *name) {
+    mark_line(b);
+    append(b, "  - ", 4);
+    append(b, name, strlen(name));
+    append(b, "\n", 1);
+    if (!b->failed) b->count++;
+}
+
+static void listing_unref(Listing *l) {
+    if (l != NULL && atomic_fetch_sub_explicit(&l->refs, 1, memory_order_acq_rel) == 1) {
+        msgbuf_unref(l->text);
+        free(l->lines);
+        free(l);
+    }
+}
+
+// Walk the directory into a new snapshot tagged `version`
+static Listing *build(ListingCache *cache, long version) {
+    ListingBuilder b;
+    memset(&b, 0, sizeof(b));
+
+    append(&b, cache->title, strlen(cache->title));
+    append(&b, ":\n", 2);
+    cache->fill(&b);
+    mark_line(&b);              // The prompt's start ends the last name
+    append(&b, PROMPT, strlen(PROMPT));
+
+    Listing *l = b.failed ? NULL : (Listing*) malloc(sizeof(Listing));
+    if (l != NULL && (l->text = msgbuf_new(b.buf, b.len)) == NULL) {
+        free(l);
+        l = NULL;
+    }
+    free(b.buf);
+    if (l == NULL) {
+        perror("listing rebuild failed");
+        free(b.lines);
+        return NULL;
+    }
+    atomic_init(&l->refs, 1);
+    l->version = version;
+    l->count = b.count;
+    l->lines = b.lines;
+    return l;
+}
+
+/////////////////// SNAPSHOTS //////////////////////////
+
+static Listing *current(ListingCache *cache) {
+    pthread_mutex_lock(&cache->lock);
+    Listing *l = cache->current;
+    if (l != NULL) atomic_fetch_add_explicit(&l->refs, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&cache->lock);
+    return l;
+}
+
+// A reference to a snapshot at least as new as the directory was on entry
+static Listing *snapshot(ListingCache *cache) {
+    Listing *l = current(cache);
+    long version = atomic_load_explicit(&cache->version, memory_order_acquire);
+    if (l != NULL && l->version == version) return l;
+    listing_unref(l);
+
+    // Whoever gets here first rebuilds; the rest use its result
+    pthread_mutex_lock(&cache->rebuild);
+    l = current(cache);
+    version = atomic_load_explicit(&cache->version, memory_order_acquire);
+    if (l == NULL || l->version != version) {
+        // A change made while building makes the version stale again,
+        // so the snapshot may be newer than its tag but never older
+        Listing *fresh = build(cache, version);
+        if (fresh != NULL) {
+            atomic_fetch_add_explicit(&fresh->refs, 1, memory_order_relaxed);
+            pthread_mutex_lock(&cache->lock);
+            Listing *old = cache->current;
+            cache->current = fresh;
+            pthread_mutex_unlock(&cache->lock);
+            listing_unref(old);
+            listing_unref(l);
+            l = fresh;
+        }
+        // Out of memory: serve the stale snapshot, if there is one
+    }
+    pthread_mutex_unlock(&cache->rebuild);
+    return l;
+}
+
+/////////////////// REPLIES //////////////////////////
+
+// A binary client gets the page as one LIST frame (see wire.h), names cut
+// out of the cached lines
+static void send_frame(Listing *l, Conn *conn, long offset, long limit) {
+    if (offset > l->count) offset = l->count;
+    long end = limit < l->count - offset ? offset + limit : l->count;
+
+    // Each line is "  - <name>\n"; its two bytes of padding and its
+    // newline become the name's length field
+    size_t body = l->lines[end] - l->lines[offset];
+    size_t len = 8 + body - (end - offset) * 3;
+    MsgBuf *frame = wire_frame(WIRE_LIST, WIRE_OK, conn->wire_tag, len);
+    if (frame == NULL) {
+        frame = wire_reply(conn->wire_tag, WIRE_UNAVAILABLE, NULL);
+    } else {
+        char *p = wire_put32(frame->data + WIRE_HEADER, l->count);
+        p = wire_put32(p, offset);
+        for (long i = offset; i < end; i++) {
+            const char *name = l->text->data + l->lines[i] + 4;
+            p = wire_put_string(p, name, l->lines[i + 1] - l->lines[i] - 5);
+        }
+    }
+    conn_send_buf(conn, frame);
+    msgbuf_unref(frame);
+}
+
+void listing_send(ListingCache *cache, Conn *conn, long offset, long limit) {
+    if (limit <= 0) limit = LIST_PAGE_DEFAULT;
+    if (limit > LIST_PAGE_MAX) limit = LIST_PAGE_MAX;
+    if (offset < 0) offset = 0;
+
+    Listing *l = snapshot(cache);
+    if (l == NULL && conn->binary) {
+        MsgBuf *failed = wire_reply(conn->wire_tag, WIRE_UNAVAILABLE, NULL);
+        conn_send_buf(conn, failed);
+        msgbuf_unref(failed);
+        return;
+    } else if (l == NULL) {
+        conn_send(conn, PROMPT, strlen(PROMPT));
+        return;
+    }
+
+    if (conn->binary) {
+        send_frame(l, conn, offset, limit);
+        listing_unref(l);
+        return;
+    }
+
+    // Everything fits: the cached reply as it is
+    if (offset == 0 && l->count <= limit) {
+        conn_send_buf(conn, l->text);
+        listing_unref(l);
+        return;
+    }
+
+    char head[128];
+    char tail[128];
+    // Compared this way round, a huge offset cannot overflow
+    long end = limit < l->count - offset ? offset + limit : l->count;
+    int head_len, tail_len = 0;
+
+    if (offset >= l->count) {
+        head_len = snprintf(head, sizeof(head), "%s: none from %ld (%d in all).\n",
+                            cache->title, offset, l->count);
+        offset = end = l->count;
+    } else {
+        head_len = snprintf(head, sizeof(head), "%s %ld-%ld of %d:\n",
+                            cache->title, offset + 1, end, l->count);
+    }
+    if (end < l->count) {
+        tail_len = snprintf(tail, sizeof(tail), "  (%ld more: %s %ld %ld)\n",
+                            l->count - end, cache->command, end, limit);
+    }
+
+    // One message, so no broadcast can land in the middle of the list
+    size_t body = l->lines[end] - l->lines[offset];
+    size_t len = head_len + body + tail_len + strlen(PROMPT);
+    char *page = (char*) malloc(len);
+    if (page != NULL) {
+        char *p = page;
+        memcpy(p, head, head_len);
+        p += head_len;
+        memcpy(p, l->text->data + l->lines[offset], body);
+        p += body;
+        memcpy(p, tail, tail_len);
+        p += tail_len;
+        memcpy(p, PROMPT, strlen(PROMPT));
+        conn_send(conn, page, len);
+        free(page);
+    }
+    listing_unref(l);
+}
+
+void listing_free(ListingCache *cache) {
+    pthread_mutex_lock(&cache->lock);
+    Listing *l = cache->current;
+    cache->current = NULL;
+    pthread_mutex_unlock(&cache->lock);
+    listing_unref(l);
+}
@@ -0,0 +1,75 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "msgbuf.h"
+
+struct Conn;
+
+// Cached `users` / `rooms` replies.
+//
+// The full reply is kept as one immutable MsgBuf together with where
+// each name's line starts, tagged with the directory version it was
+// built from. Every change to the directory bumps the version (one
+// atomic add, done under the writer lock anyway); the next listing
+// request sees the mismatch and rebuilds once, under a read lock. All
+// other requests just take a reference to the current snapshot: no
+// directory lock, and O(output) to reply. An unpaged listing that fits
+// on one page goes out as the cached buffer itself.
+
+#define LIST_PAGE_DEFAULT 200   // Names per reply when no limit is given
+#define LIST_PAGE_MAX     1000  // Largest page a client may ask for
+
+typedef struct Listing {
+    atomic_int refs;
+    long version;              // Directory version it was built from
+    int count;                 // Names listed
+    MsgBuf *text;              // Whole reply: title, one line per name, prompt
+    size_t *lines;             // count + 1 line starts; the last is the prompt
+} Listing;
+
+typedef struct ListingBuilder {
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t *lines;
+    int count;
+    int lines_cap;
+    int failed;
+} ListingBuilder;
+
+typedef struct ListingCache {
+    const char *title;         // "Users", "Rooms"
+    const char *command;       // "users", "rooms": named in the paging hint
+    void (*fill)(ListingBuilder *b);   // Adds every name, takes its own locks
+    atomic_long version;
+    pthread_mutex_t lock;      // Guards `current` (the pointer, not the snapshot)
+    pthread_mutex_t rebuild;   // One rebuild at a time
+    Listing *current;
+} ListingCache;
+
+#define LISTING_CACHE_INITIALIZER(title, command, fill) \
+    { (title), (command), (fill), 1, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, NULL }
+
+// The directory behind `cache` changed
+static inline void listing_changed(ListingCache *cache) {
+    atomic_fetch_add_explicit(&cache->version, 1, memory_order_release);
+}
+
+// For fill(): one name
+void listing_add(ListingBuilder *b, const char *name);
+
+// Send names [offset, offset + limit) to `conn`. limit <= 0 means the
+// default page size. A binary client gets them as a LIST frame.
+void listing_send(ListingCache *cache, struct Conn *conn, long offset, long limit);
+
+void listing_free(ListingCache *cache);
+
+#endif
@@ -0,0 +1,168 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+__thread MetricsBlock *metrics_local = NULL;
+
+static _Atomic(MetricsBlock*) all_blocks = NULL;
+static pthread_key_t metrics_key;
+static pthread_once_t metrics_once = PTHREAD_ONCE_INIT;
+
+static const char *counter_names[M_COUNT] = {
+    "conn_opened", "conn_closed", "bytes_in", "lines_in", "oversized_lines",
+    "broadcasts", "deliveries", "bytes_out", "queued_bytes", "queued_msgs",
+    "dropped", "slow_disconnects", "cross_shard_posts",
+    "relay_frames_out", "relay_frames_in", "relay_dropped",
+    "limited_lines", "limited_writes", "limited_room",
+    "compress_in_bytes", "compress_out_bytes",
+    "ring_waits", "ring_completions",
+    "idle_pings", "idle_closed", "write_timeouts",
+    "direct_messages",
+    "epoch_retired", "epoch_freed",
+    "frames_in", "bad_frames",
+};
+
+// Counters that are levels, not running totals, get no rate
+static const int counter_is_gauge[M_COUNT] = {
+    [M_QUEUED_BYTES] = 1,
+    [M_QUEUED_MSGS] = 1,
+};
+
+static const char *hist_names[H_COUNT] = {
+    "dir_read_wait_ns", "dir_write_wait_ns", "room_read_wait_ns",
+    "room_write_wait_ns", "broadcast_ns", "fanout", "queue_depth_bytes",
+};
+
+/////////////////// PER-THREAD BLOCKS //////////////////////////
+
+// Thread exit: the block keeps its counts and waits for a new owner
+static void detach_block(void *arg) {
+    MetricsBlock *b = (MetricsBlock*) arg;
+    atomic_store(&b->in_use, 0);
+}
+
+static void make_metrics_key() {
+    pthread_key_create(&metrics_key, detach_block);
+}
+
+MetricsBlock *metrics_attach() {
+    MetricsBlock *b;
+
+    pthread_once(&metrics_once, make_metrics_key);
+
+    // Reuse a block left behind by a finished thread (thread-per-client
+    // mode would otherwise grow one block per connection)
+    for (b = atomic_load(&all_blocks); b != NULL; b = b->next) {
+        int idle = 0;
+        if (atomic_compare_exchange_strong(&b->in_use, &idle, 1)) break;
+    }
+
+    if (b == NULL) {
+        b = (MetricsBlock*) calloc(1, sizeof(MetricsBlock));
+        if (b == NULL) {
+            perror("calloc failed for MetricsBlock");
+            exit(1);
+        }
+        atomic_store(&b->in_use, 1);
+        b->next = atomic_load(&all_blocks);
+        while (!atomic_compare_exchange_weak(&all_blocks, &b->next, b)) {
+            // b->next was reloaded, try again
+        }
+    }
+
+    metrics_local = b;
+    pthread_setspecific(metrics_key, b);
+    return b;
+}
+
+void metrics_lock_acquired(int lock_class, int write, long waited_ns) {
+    if (lock_class == LOCK_CLASS_DIR) {
+        metrics_record(write ? H_DIR_WRITE_WAIT : H_DIR_READ_WAIT, waited_ns);
+    } else if (lock_class == LOCK_CLASS_ROOM) {
+        metrics_record(write ? H_ROOM_WRITE_WAIT : H_ROOM_READ_WAIT, waited_ns);
+    }
+}
+
+/////////////////// READING //////////////////////////
+
+void metrics_snapshot(MetricsSnapshot *out) {
+    memset(out, 0, sizeof(MetricsSnapshot));
+
+    for (MetricsBlock *b = atomic_load(&all_blocks); b != NULL; b = b->next) {
+        for (int i = 0; i < M_COUNT; i++) {
+            out->counters[i] += atomic_load_explicit(&b->counters[i], memory_order_relaxed);
+        }
+        for (int h = 0; h < H_COUNT; h++) {
+            for (int i = 0; i < HIST_BUCKETS; i++) {
+                out->hist[h][i] += atomic_load_explicit(&b->hist[h][i], memory_order_relaxed);
+            }
+            out->hist_sum[h] += atomic_load_explicit(&b->hist_sum[h], memory_order_relaxed);
+        }
+    }
+}
+
+// Upper bound of the bucket holding the p-th value
+static long hist_percentile(const long *buckets, long count, double p) {
+    long rank = (long) (p * count);
+    long seen = 0;
+    if (count == 0) return 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > rank) return i == 0 ? 0 : (1L << i) - 1;
+    }
+    return (1L << (HIST_BUCKETS - 2));
+}
+
+size_t metrics_format(char *buf, size_t cap, const MetricsSnapshot *now,
+                      const MetricsSnapshot *prev, long interval_ns) {
+    size_t len = 0;
+    double secs = interval_ns > 0 ? interval_ns / 1e9 : 1.0;
+
+#define EMIT(...) do { \
+        int n = snprintf(buf + len, cap - len, __VA_ARGS__); \
+        if (n > 0) len = ((size_t) n < cap - len) ? len + n : cap - 1; \
+    } while (0)
+
+    EMIT("connections %ld\n", now->counters[M_CONN_OPENED] - now->counters[M_CONN_CLOSED]);
+    for (int i = 0; i < M_COUNT; i++) {
+        if (counter_is_gauge[i]) {
+            EMIT("%s %ld\n", counter_names[i], now->counters[i]);
+        } else {
+            EMIT("%s %ld (%.1f/s)\n", counter_names[i], now->counters[i],
+                 (now->counters[i] - prev->counters[i]) / secs);
+        }
+    }
+
+    // Latency and size distributions. Buckets are powers of two, so the
+    // percentiles are upper bounds.
+    for (int h = 0; h < H_COUNT; h++) {
+        long count = 0;
+        for (int i = 0; i < HIST_BUCKETS; i++) count += now->hist[h][i];
+
+        long max_bucket = 0;
+        for (int i = HIST_BUCKETS - 1; i >= 0; i--) {
+            if (now->hist[h][i] != 0) {
+                max_bucket = i;
+                break;
+            }
+        }
+
+        EMIT("%s count %ld nonzero %ld mean %.1f p50 %ld p99 %ld p999 %ld max %ld\n",
+             hist_names[h], count, count - now->hist[h][0],
+             count ? (double) now->hist_sum[h] / count : 0.0,
+             hist_percentile(now->hist[h], count, 0.50),
+             hist_percentile(now->hist[h], count, 0.99),
+             hist_percentile(now->hist[h], count, 0.999),
+             max_bucket == 0 ? 0 : (1L << max_bucket) - 1);
+    }
+
+#undef EMIT
+    return len;
+}
@@ -0,0 +1,129 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// Runtime counters and latency histograms.
+//
+// Every thread updates its own MetricsBlock, so the hot paths do a plain
+// load and store with no lock and no shared cache line. Readers (the
+// admin port) add up all blocks; a value can be a few updates behind,
+// never torn. Blocks are never freed: when a thread exits its block is
+// handed to the next new thread, which keeps adding to the same totals.
+
+typedef enum MetricCounter {
+    M_CONN_OPENED,
+    M_CONN_CLOSED,
+    M_BYTES_IN,
+    M_LINES_IN,
+    M_OVERSIZED_LINES,
+    M_BROADCASTS,
+    M_DELIVERIES,
+    M_BYTES_OUT,
+    M_QUEUED_BYTES,            // Gauge: bytes waiting in outbound queues
+    M_QUEUED_MSGS,             // Gauge: messages waiting in outbound queues
+    M_DROPPED,                 // Messages a slow client never got
+    M_SLOW_DISCONNECTS,
+    M_CROSS_SHARD_POSTS,       // Broadcast batches handed to another shard
+    M_RELAY_OUT,               // Frames queued for the cluster relay
+    M_RELAY_IN,                // Frames received from it
+    M_RELAY_DROPPED,           // Frames lost to a full relay queue
+    M_LIMITED_LINES,           // Lines ignored: client over its line rate
+    M_LIMITED_WRITES,          // create/login refused: over the write rate
+    M_LIMITED_ROOM,            // Room deliveries skipped: room over its rate
+    M_COMPRESS_IN,             // Bytes given to compressed connections
+    M_COMPRESS_OUT,            // What they compressed to
+    M_RING_WAITS,              // io_uring mode: submit-and-wait rounds
+    M_RING_COMPLETIONS,        // Completions reaped in those rounds
+    M_IDLE_PINGS,              // Idle clients asked if they are still there
+    M_IDLE_CLOSED,             // ... and disconnected for not answering
+    M_WRITE_TIMEOUTS,          // Disconnected: queued output made no progress
+    M_DIRECT_MESSAGES,         // "msg" lines sent to one DM peer
+    M_EPOCH_RETIRED,           // Directory memory handed to epoch_retire()
+    M_EPOCH_FREED,             // ... and freed once readers moved on
+    M_FRAMES_IN,               // Binary protocol requests
+    M_BAD_FRAMES,              // ... that did not decode
+    M_COUNT
+} MetricCounter;
+
+typedef enum MetricHist {
+    H_DIR_READ_WAIT,           // ns to get rw_lock for reading
+    H_DIR_WRITE_WAIT,
+    H_ROOM_READ_WAIT,          // ns to get a room lock
+    H_ROOM_WRITE_WAIT,
+    H_BROADCAST,               // ns spent in sendMessageToRecipients()
+    H_FANOUT,                  // Recipients per broadcast
+    H_QUEUE_DEPTH,             // Queued bytes after each enqueue
+    H_COUNT
+} MetricHist;
+
+// RWLock::lock_class values; 0 leaves a lock uninstrumented
+#define LOCK_CLASS_DIR  1
+#define LOCK_CLASS_ROOM 2
+
+// Bucket 0 holds zeros, bucket b holds values in [2^(b-1), 2^b)
+#define HIST_BUCKETS 64
+
+typedef struct MetricsBlock {
+    atomic_long counters[M_COUNT];
+    atomic_long hist[H_COUNT][HIST_BUCKETS];
+    atomic_long hist_sum[H_COUNT];
+    atomic_int in_use;
+    struct MetricsBlock *next;
+} MetricsBlock;
+
+// Summed over all threads
+typedef struct MetricsSnapshot {
+    long counters[M_COUNT];
+    long hist[H_COUNT][HIST_BUCKETS];
+    long hist_sum[H_COUNT];
+} MetricsSnapshot;
+
+extern __thread MetricsBlock *metrics_local;
+MetricsBlock *metrics_attach();
+
+static inline MetricsBlock *metrics_block() {
+    return metrics_local != NULL ? metrics_local : metrics_attach();
+}
+
+// Only the owning thread writes a block, so no read-modify-write is needed
+static inline void metrics_bump(atomic_long *slot, long n) {
+    long v = atomic_load_explicit(slot, memory_order_relaxed);
+    atomic_store_explicit(slot, v + n, memory_order_relaxed);
+}
+
+static inline void metrics_add(MetricCounter m, long n) {
+    metrics_bump(&metrics_block()->counters[m], n);
+}
+
+static inline void metrics_record(MetricHist h, long value) {
+    MetricsBlock *b = metrics_block();
+    int bucket = value > 0 ? 64 - __builtin_clzl((unsigned long) value) : 0;
+    if (bucket >= HIST_BUCKETS) bucket = HIST_BUCKETS - 1;
+    metrics_bump(&b->hist[h][bucket], 1);
+    metrics_bump(&b->hist_sum[h], value);
+}
+
+static inline long metrics_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Called by RWLock after every acquisition of an instrumented lock
+void metrics_lock_acquired(int lock_class, int write, long waited_ns);
+
+void metrics_snapshot(MetricsSnapshot *out);
+
+// Write the `stats` report into buf, rates measured against `prev` over
+// `interval_ns`. Returns the length written.
+size_t metrics_format(char *buf, size_t cap, const MetricsSnapshot *now,
+                      const MetricsSnapshot *prev, long interval_ns);
+
+#endif
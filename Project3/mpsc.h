@@ -0,0 +1,79 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Intrusive lock-free multi-producer / single-consumer queue (Vyukov).
+// Any thread may push; only the owning thread pops. A push is one atomic
+// exchange plus one store, and never waits for the consumer.
+//
+// Between those two steps a push is half done: the node is claimed but
+// not yet reachable, so mpsc_pop() reports MPSC_BUSY rather than empty.
+// A consumer that needs everything pushed so far must retry until it
+// gets MPSC_EMPTY.
+
+typedef struct MpscNode {
+    _Atomic(struct MpscNode*) next;
+} MpscNode;
+
+typedef struct Mpsc {
+    _Atomic(MpscNode*) head;   // Producers swap themselves in here
+    MpscNode *tail;            // Consumer only
+    MpscNode stub;
+} Mpsc;
+
+#define MPSC_EMPTY 0
+#define MPSC_BUSY  1
+
+static inline void mpsc_init(Mpsc *q) {
+    atomic_store(&q->stub.next, NULL);
+    atomic_store(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+static inline void mpsc_push(Mpsc *q, MpscNode *n) {
+    atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+    MpscNode *prev = atomic_exchange_explicit(&q->head, n, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, n, memory_order_release);
+}
+
+// Oldest node, or NULL with *state set to MPSC_EMPTY or MPSC_BUSY
+static inline MpscNode *mpsc_pop(Mpsc *q, int *state) {
+    MpscNode *tail = q->tail;
+    MpscNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (next == NULL) {
+            *state = atomic_load(&q->head) == tail ? MPSC_EMPTY : MPSC_BUSY;
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    if (atomic_load(&q->head) != tail) {
+        *state = MPSC_BUSY;
+        return NULL;
+    }
+
+    // `tail` is the last node: put the stub behind it so it can be taken
+    mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    *state = MPSC_BUSY;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,55 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "msgbuf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+MsgBuf *msgbuf_alloc(size_t len) {
+    MsgBuf *m = (MsgBuf*) malloc(sizeof(MsgBuf) + len + 1);
+    if (m == NULL) {
+        perror("malloc failed for MsgBuf");
+        return NULL;
+    }
+    atomic_init(&m->refs, 1);
+    m->frame = NULL;
+    m->len = len;
+    m->data[len] = '\0';
+    return m;
+}
+
+MsgBuf *msgbuf_new(const char *data, size_t len) {
+    MsgBuf *m = msgbuf_alloc(len);
+    if (m == NULL) return NULL;
+    memcpy(m->data, data, len);
+    m->data[len] = '\0';
+    return m;
+}
+
+MsgBuf *msgbuf_printf(const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (len < 0) return NULL;
+
+    MsgBuf *m = msgbuf_alloc(len);
+    if (m == NULL) return NULL;
+
+    va_start(ap, fmt);
+    vsnprintf(m->data, len + 1, fmt, ap);
+    va_end(ap);
+    return m;
+}
+
+void msgbuf_unref(MsgBuf *m) {
+    if (m != NULL && atomic_fetch_sub_explicit(&m->refs, 1, memory_order_acq_rel) == 1) {
+        if (m->frame != m) msgbuf_unref(m->frame);
+        free(m);
+    }
+}
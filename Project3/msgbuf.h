@@ -0,0 +1,42 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef MSGBUF_H
+#define MSGBUF_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Immutable, reference-counted message. A broadcast is formatted once
+// into a MsgBuf and the same buffer is queued by pointer on every
+// recipient's connection; whoever drops the last reference frees it.
+// `data` is always NUL terminated, `len` excludes the terminator.
+//
+// A message for both kinds of client also carries its binary-protocol
+// encoding in `frame` (see wire.h); it owns one reference to it. A
+// frame's own `frame` points back to itself.
+typedef struct MsgBuf {
+    atomic_int refs;
+    struct MsgBuf *frame;
+    size_t len;
+    char data[];
+} MsgBuf;
+
+// New buffer of `len` bytes for the caller to fill in, with one reference
+MsgBuf *msgbuf_alloc(size_t len);
+
+// New buffer holding a copy of `data`, with one reference
+MsgBuf *msgbuf_new(const char *data, size_t len);
+
+// New buffer formatted with printf rules, with one reference
+MsgBuf *msgbuf_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static inline MsgBuf *msgbuf_ref(MsgBuf *m) {
+    atomic_fetch_add_explicit(&m->refs, 1, memory_order_relaxed);
+    return m;
+}
+
+void msgbuf_unref(MsgBuf *m);
+
+#endif
@@ -0,0 +1,115 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "parser.h"
+#include "wire.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Room for the longest line plus its newline, so a pending partial line
+// always leaves at least one byte to read into. A partial frame is
+// shorter than WIRE_MAX_FRAME, which is the same size.
+#define CARRY_SIZE (MAX_LINE_LEN + 1)
+
+char *parser_space(LineParser *p, char *scratch, size_t *room) {
+    if (p->carry != NULL) {
+        *room = CARRY_SIZE - p->len;
+        return p->carry + p->len;
+    }
+    *room = PARSER_SCRATCH;
+    return scratch;
+}
+
+int parser_feed(LineParser *p, char *data, size_t n, line_handler handler, void *arg) {
+    char *pos, *end;
+
+    if (p->carry != NULL) {
+        // `data` was read in right behind the pending partial line
+        pos = p->carry;
+        end = p->carry + p->len + n;
+    } else {
+        pos = data;
+        end = data + n;
+    }
+
+    while (pos < end) {
+        if (p->framed) {
+            if (p->skip > 0) {
+                // Rest of an oversized frame that was already reported
+                size_t gap = (size_t) (end - pos) < p->skip ? (size_t) (end - pos) : p->skip;
+                pos += gap;
+                p->skip -= gap;
+                continue;
+            }
+            if (end - pos < WIRE_HEADER) break;
+
+            size_t len = wire_frame_len(pos);
+            char *frame = pos;
+            if (len > WIRE_MAX_FRAME) {
+                p->skip = len;
+                if (handler(arg, frame, len) == -1) return -1;
+                continue;
+            }
+            if ((size_t) (end - pos) < len) break;
+            pos += len;
+            if (handler(arg, frame, len) == -1) return -1;
+            continue;
+        }
+
+        char *nl = (char*) memchr(pos, '\n', end - pos);
+        if (nl == NULL) break;
+        size_t len = nl - pos;
+        char *line = pos;
+        pos = nl + 1;
+
+        if (p->discarding) {
+            // Tail of an oversized line that was already reported
+            p->discarding = 0;
+            continue;
+        }
+        if (len > 0 && line[len - 1] == '\r') len--;
+        if (len > MAX_LINE_LEN) {
+            if (handler(arg, NULL, 0) == -1) return -1;
+            continue;
+        }
+
+        line[len] = '\0';
+        if (handler(arg, line, len) == -1) return -1;
+    }
+
+    // Keep the partial line, if any, for the next read
+    size_t rest = end - pos;
+    if (p->discarding) {
+        rest = 0;
+    } else if (!p->framed && rest > MAX_LINE_LEN) {
+        p->discarding = 1;
+        rest = 0;
+        if (handler(arg, NULL, 0) == -1) return -1;
+    }
+
+    if (rest == 0) {
+        parser_free(p);
+        return 0;
+    }
+    if (p->carry == NULL) {
+        p->carry = (char*) malloc(CARRY_SIZE);
+        if (p->carry == NULL) {
+            perror("malloc failed for line buffer");
+            return 0;
+        }
+        memcpy(p->carry, pos, rest);
+    } else {
+        memmove(p->carry, pos, rest);
+    }
+    p->len = rest;
+    return 0;
+}
+
+void parser_free(LineParser *p) {
+    free(p->carry);
+    p->carry = NULL;
+    p->len = 0;
+}
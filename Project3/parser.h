@@ -0,0 +1,53 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stddef.h>
+
+#define MAX_LINE_LEN 2095        // Longest command line (MAXBUFF - 1)
+#define PARSER_SCRATCH 16384     // Caller's read buffer; many lines per read()
+
+// Incremental splitter for the newline-framed command stream.
+//
+// TCP may deliver several commands in one read() or cut one in half, so
+// every complete line in a read is handed to the caller and only a
+// trailing partial line is kept. Lines are NUL terminated in place in
+// whichever buffer they were read into; nothing is copied except that
+// partial tail. The carry buffer is only allocated while a partial line
+// is pending, so idle connections cost nothing here. A line longer than
+// MAX_LINE_LEN is reported once and skipped up to its newline.
+//
+// Once `framed` is set (the client switched to the binary protocol, see
+// wire.h) the stream is split into frames by their length field instead,
+// with the same carry buffer. It may be set by the handler itself: the
+// rest of the same read is already split as frames.
+typedef struct LineParser {
+    char *carry;        // Pending partial line or frame, or NULL
+    size_t len;         // Bytes in carry
+    int discarding;     // Skipping the rest of an oversized line
+    int framed;         // Frames, not lines
+    size_t skip;        // Bytes left of an oversized frame
+} LineParser;
+
+// Called for each complete line (without "\n" or "\r\n", NUL terminated,
+// writable). `line` is NULL when an oversized line was dropped.
+// In framed mode it is called with each complete frame instead, not NUL
+// terminated. An oversized frame is reported with only its header
+// readable and `len` its declared size, over WIRE_MAX_FRAME.
+// Return -1 to stop parsing, e.g. when the client logged out.
+typedef int (*line_handler)(void *arg, char *line, size_t len);
+
+// Where the next read() should land: the carry buffer when a partial
+// line is pending, otherwise `scratch` (PARSER_SCRATCH bytes).
+char *parser_space(LineParser *p, char *scratch, size_t *room);
+
+// Account for `n` bytes just read into parser_space() and pass every
+// complete line to `handler`. Returns -1 if the handler asked to stop.
+int parser_feed(LineParser *p, char *data, size_t n, line_handler handler, void *arg);
+
+void parser_free(LineParser *p);
+
+#endif
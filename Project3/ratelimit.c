@@ -0,0 +1,46 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "ratelimit.h"
+
+#include <stdlib.h>
+
+#define NS_PER_SEC 1000000000L
+
+// A RateSpec for `per_sec`, as ratelimit_set() would make it; 0 is off
+#define RATE_INTERVAL(per_sec) ((per_sec) ? NS_PER_SEC / (per_sec) : 0)
+#define RATE_SPEC(per_sec) { RATE_INTERVAL(per_sec), \
+                             (RATE_BURST * (per_sec) - 1) * RATE_INTERVAL(per_sec) }
+
+RateSpec rate_lines = RATE_SPEC(RATE_LINES);
+RateSpec rate_writes = RATE_SPEC(RATE_WRITES);
+RateSpec rate_room = RATE_SPEC(RATE_ROOM);
+
+void ratelimit_set(RateSpec *spec, long per_sec, long burst) {
+    if (per_sec <= 0) {
+        spec->interval_ns = 0;
+        spec->tolerance_ns = 0;
+        return;
+    }
+    if (per_sec > NS_PER_SEC) per_sec = NS_PER_SEC;
+    if (burst < 1) burst = 1;
+    spec->interval_ns = NS_PER_SEC / per_sec;
+    spec->tolerance_ns = (burst - 1) * spec->interval_ns;
+}
+
+int parse_rate_limits(const char *arg) {
+    RateSpec *specs[] = { &rate_lines, &rate_writes, &rate_room };
+    const char *p = arg;
+
+    for (int i = 0; i < 3; i++) {
+        char *end;
+        long per_sec = strtol(p, &end, 10);
+        if (end == p || per_sec < 0) return -1;
+        ratelimit_set(specs[i], per_sec, RATE_BURST * per_sec);
+        if (*end == '\0') return 0;     // Unlisted limits keep their default
+        if (*end != ',') return -1;
+        p = end + 1;
+    }
+    return -1;
+}
@@ -0,0 +1,63 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdatomic.h>
+
+// Token buckets for flood protection.
+//
+// A bucket is kept as the time it will next be full (GCRA): taking a
+// token pushes that time one interval further, and a take is refused
+// once it lies more than `burst` intervals ahead of now. That is one
+// compare-and-swap per take, with no timer and no lock, so the same
+// bucket works for a connection (one thread at a time) and for a room
+// (every sender in it at once).
+//
+// A zeroed bucket is full.
+
+#define RATE_LINES     0        // Lines per second from one client, 0 = off:
+                                // the costly commands have the limits below
+#define RATE_WRITES    2        // create/login per second from one client
+#define RATE_ROOM      200      // Messages per second into one room
+#define RATE_BURST     2        // Bucket size, in seconds worth of tokens
+
+typedef struct RateSpec {
+    long interval_ns;          // Time to earn one token, 0 = unlimited
+    long tolerance_ns;         // How far ahead a bucket may run
+} RateSpec;
+
+typedef struct RateBucket {
+    atomic_long tat;           // When the bucket is full again (ns)
+} RateBucket;
+
+extern RateSpec rate_lines;    // Per connection: every line read (opt-in)
+extern RateSpec rate_writes;   // Per connection: commands that take rw_lock for writing
+extern RateSpec rate_room;     // Per room: messages posted to it
+
+// `per_sec` tokens a second, up to `burst` at once. 0 disables.
+void ratelimit_set(RateSpec *spec, long per_sec, long burst);
+
+// Parse "-r lines,writes,room" (per second; 0 disables one). Returns -1
+// if malformed.
+int parse_rate_limits(const char *arg);
+
+// Take one token at time `now` (metrics_now_ns()). Returns 1 if allowed.
+static inline int ratelimit_take(RateBucket *b, const RateSpec *spec, long now) {
+    if (spec->interval_ns == 0) return 1;
+
+    long tat = atomic_load_explicit(&b->tat, memory_order_relaxed);
+    long next;
+    do {
+        long base = tat > now ? tat : now;
+        if (base - now > spec->tolerance_ns) return 0;
+        next = base + spec->interval_ns;
+    } while (!atomic_compare_exchange_weak_explicit(&b->tat, &tat, next,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed));
+    return 1;
+}
+
+#endif
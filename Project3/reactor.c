@@ -0,0 +1,1056 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "server.h"
+#include "reactor.h"
+#include "metrics.h"
+#include "mpsc.h"
+#include "uring.h"
+#include "epoch.h"
+
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#define MAX_EVENTS 256
+#define READ_BUDGET 16   // Reads per turn before yielding to other clients
+
+// epoll tags for the two non-client descriptors
+#define TAG_LISTENER ((void*) 0)
+#define TAG_INBOX    ((void*) 1)
+
+// io_uring user_data: small numbers for the reactor's own requests, or a
+// Conn pointer with the request in its low bits
+#define UD_ACCEPT  1
+#define UD_INBOX   2
+#define UD_CANCEL  3
+#define UD_CONN_MIN 4096
+
+// Conn->ring_ops bits; the first two double as the user_data tag
+#define RING_RECV    0x1       // Multishot receive armed
+#define RING_POLLOUT 0x2       // Multishot POLLOUT armed
+#define RING_DEAD    0x4       // Closed, freed once nothing is in flight
+#define RING_TAGS    (RING_RECV | RING_POLLOUT)
+
+#define ACCEPT_RETRY_MS 100    // After accept fails, e.g. out of descriptors
+
+// Reactor state. The reactor thread owns the epoll set; workers pull
+// ready connections off `ready_head` and hand dead ones back through
+// `graveyard` so that only the reactor ever frees a Conn.
+//
+// In sharded mode there is one Reactor per core, each with its own
+// listener and connections, and no workers: the reactor thread services
+// its ready queue itself. Broadcasts to another shard's clients arrive
+// through `inbox`.
+typedef struct Reactor {
+    int id;
+    int epfd;
+    int listen_fd;             // -1 in thread-per-client mode
+    int sharded;
+
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    Conn *ready_head;
+    Conn *ready_tail;
+
+    pthread_mutex_t grave_lock;
+    Conn *graveyard;
+
+    // Cross-shard deliveries
+    Mpsc inbox;
+    int inbox_fd;              // eventfd, readable when inbox needs a look
+    atomic_int inbox_woken;    // 1 once an eventfd write is outstanding
+
+    // io_uring backend (see the IO_URING section). Only the ring thread
+    // touches these, except the two atomics.
+    Uring *ring;               // NULL: epoll
+    Conn *ring_conns;          // Live connections
+    Conn *dying;               // Closed, waiting for their last completion
+    int holding;               // Receives cancelled while input is held
+    int accept_armed;
+    long accept_retry_ns;      // Do not re-arm accept before this
+    atomic_int rearm;          // Look for connections to arm
+    atomic_int quiet;          // Holding, and nothing can receive
+} Reactor;
+
+// Staged cross-shard deliveries for one broadcast
+typedef struct ShardPost {
+    MpscNode node;             // Must stay first
+    MsgBuf *msg;
+    int count;
+    Conn *conns[];
+} ShardPost;
+
+typedef struct Staging {
+    Conn **conns;
+    int count;
+    int cap;
+} Staging;
+
+static Reactor reactor = {
+    .epfd = -1,
+    .listen_fd = -1,
+    .queue_lock = PTHREAD_MUTEX_INITIALIZER,
+    .queue_cond = PTHREAD_COND_INITIALIZER,
+    .grave_lock = PTHREAD_MUTEX_INITIALIZER,
+    .inbox_fd = -1,
+};
+
+static Reactor *shards = NULL;
+static int num_shards = 0;
+
+static __thread Reactor *current_shard = NULL;
+static __thread Staging staged[MAX_SHARDS];
+
+/////////////////// WORK QUEUE //////////////////////////
+
+static void workq_push(Reactor *r, Conn *c) {
+    c->next = NULL;
+    pthread_mutex_lock(&r->queue_lock);
+    if (r->ready_tail == NULL) {
+        r->ready_head = c;
+    } else {
+        r->ready_tail->next = c;
+    }
+    r->ready_tail = c;
+    pthread_cond_signal(&r->queue_cond);
+    pthread_mutex_unlock(&r->queue_lock);
+}
+
+static Conn *workq_pop(Reactor *r, int wait) {
+    pthread_mutex_lock(&r->queue_lock);
+    while (wait && r->ready_head == NULL) {
+        pthread_cond_wait(&r->queue_cond, &r->queue_lock);
+    }
+    Conn *c = r->ready_head;
+    if (c != NULL) {
+        r->ready_head = c->next;
+        if (r->ready_head == NULL) {
+            r->ready_tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&r->queue_lock);
+    return c;
+}
+
+// Record events for a connection and queue it unless a worker already has it
+static void conn_post(Reactor *r, Conn *c, int ev) {
+    atomic_fetch_or(&c->pending, ev);
+    if (!atomic_exchange(&c->scheduled, 1)) {
+        workq_push(r, c);
+    }
+}
+
+/////////////////// CONNECTION LIFECYCLE //////////////////////////
+
+int reactor_add(Conn *c) {
+    struct epoll_event ev;
+    ev.events = EPOLLOUT | EPOLLET;
+    ev.data.ptr = c;
+    c->reactor = &reactor;
+    if (epoll_ctl(reactor.epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+        perror("epoll_ctl add client");
+        return -1;
+    }
+    return 0;
+}
+
+// In event loop mode `scheduled` is left set so the reactor never queues
+// the connection again. The memory itself is released by the reactor
+// once no epoll batch or broadcast can still refer to it.
+static void ring_close(Reactor *r, Conn *c);
+
+void reactor_close(Conn *c) {
+    Reactor *r = c->reactor;
+
+    if (r->ring != NULL) {
+        ring_close(r, c);
+        return;
+    }
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    conn_shutdown(c);
+    c->retired_at = epoch_stamp();
+
+    pthread_mutex_lock(&r->grave_lock);
+    c->next = r->graveyard;
+    r->graveyard = c;
+    pthread_mutex_unlock(&r->grave_lock);
+}
+
+// Closed connections that no broadcast can still be delivering to: the
+// epoch has moved on since they left the directory (see epoch.h). The
+// others stay for a later round.
+static Conn *take_graveyard(Reactor *r) {
+    Conn *dead = NULL;
+
+    pthread_mutex_lock(&r->grave_lock);
+    Conn **link = &r->graveyard;
+    while (*link != NULL) {
+        Conn *c = *link;
+        if (!epoch_passed(c->retired_at)) {
+            link = &c->next;
+            continue;
+        }
+        *link = c->next;
+        c->next = dead;
+        dead = c;
+    }
+    pthread_mutex_unlock(&r->grave_lock);
+    return dead;
+}
+
+static void free_conns(Conn *c) {
+    while (c != NULL) {
+        Conn *temp = c;
+        c = c->next;
+        conn_destroy(temp);
+    }
+}
+
+// Watch a client socket and queue `ev` for it. Returns -1 on failure.
+static int reactor_register(Reactor *r, Conn *c, int ev) {
+    c->reactor = r;
+
+    // Hold the connection until a worker has handled `ev`, so an early
+    // readable event cannot race the guest user creation.
+    atomic_store(&c->scheduled, 1);
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = c;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, c->fd, &event) == -1) {
+        perror("epoll_ctl add client");
+        return -1;
+    }
+
+    atomic_store(&c->pending, ev);
+    workq_push(r, c);
+    return 0;
+}
+
+static void accept_clients(Reactor *r) {
+    // While stopping, new clients wait in the backlog (for the next
+    // process, on a hot restart)
+    while (!atomic_load(&server_stopping)) {
+        int fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept4");
+            }
+            return;
+        }
+
+        Conn *c = conn_create(fd);
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        if (reactor_register(r, c, CONN_EV_OPEN | CONN_EV_READ) == -1) {
+            close(fd);
+            conn_destroy(c);
+        }
+    }
+}
+
+/////////////////// WORKERS //////////////////////////
+
+// Run `n` bytes through the parser as if read() had put them where
+// parser_space() asked. Returns -1 if the connection must be closed.
+static int feed_input(Conn *c, char *data, size_t n) {
+    while (n > 0) {
+        size_t room;
+        char *space = parser_space(&c->in, data, &room);
+        size_t chunk = n < room ? n : room;
+        if (space != data) {
+            // A partial line is pending: append behind it
+            memcpy(space, data, chunk);
+        }
+        if (client_input(c, space, chunk) == -1) {
+            return -1;
+        }
+        data += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+// Input held back earlier goes first. Caller is counted in as input.
+static int replay_held(Conn *c) {
+    char *held = c->held;
+    size_t len = c->held_len;
+
+    c->held = NULL;
+    c->held_len = 0;
+    int rc = held != NULL ? feed_input(c, held, len) : 0;
+    free(held);
+    return rc;
+}
+
+// Drain the socket, running every complete line through the command
+// handler. Returns -1 if the connection must be closed.
+static int conn_read(Conn *c) {
+    char scratch[PARSER_SCRATCH];
+
+    if (replay_held(c) == -1) {
+        return -1;
+    }
+
+    for (int i = 0; i < READ_BUDGET; i++) {
+        size_t room;
+        char *space = parser_space(&c->in, scratch, &room);
+        ssize_t received = read(c->fd, space, room);
+        if (received > 0) {
+            if (client_input(c, space, received) == -1) {
+                return -1;
+            }
+        } else if (received == 0) {
+            return -1;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+
+    // Budget used up: edge-triggered epoll will not tell us again, so
+    // requeue ourselves behind the other ready connections.
+    atomic_fetch_or(&c->pending, CONN_EV_READ);
+    return 0;
+}
+
+// Handle whatever was posted to a connection we now own
+static void conn_service(Reactor *r, Conn *c) {
+    int ev = atomic_exchange(&c->pending, 0);
+
+    // A client that got in before a stop is still greeted, so it has a
+    // user to hand over
+    if (ev & CONN_EV_OPEN) {
+        beginClientInput(1);
+        client_connected(c);
+        endClientInput();
+    }
+
+    // While stopping, input stays in the socket until reactor_resume()
+    // or the next process picks it up
+    if ((ev & CONN_EV_READ) && beginClientInput(0)) {
+        if (conn_read(c) == -1) {
+            client_disconnected(c);
+            endClientInput();
+            reactor_close(c);
+            return;
+        }
+        endClientInput();
+    }
+
+    atomic_store(&c->scheduled, 0);
+    if (atomic_load(&c->pending) != 0 && !atomic_exchange(&c->scheduled, 1)) {
+        workq_push(r, c);
+    }
+}
+
+static void *worker_main(void *arg) {
+    Reactor *r = (Reactor*) arg;
+
+    while (1) {
+        conn_service(r, workq_pop(r, 1));
+    }
+    return NULL;
+}
+
+/////////////////// CROSS-SHARD DELIVERY //////////////////////////
+
+static void inbox_wake(Reactor *r) {
+    if (!atomic_exchange(&r->inbox_woken, 1)) {
+        uint64_t one = 1;
+        if (write(r->inbox_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            perror("write inbox eventfd");
+        }
+    }
+}
+
+// Hand every staged post to its owner. With `complete` set, wait out
+// pushes that are half done so nothing queued before now is left behind.
+static void inbox_drain(Reactor *r, int complete) {
+    while (1) {
+        int state = MPSC_EMPTY;
+        MpscNode *node = mpsc_pop(&r->inbox, &state);
+        if (node == NULL) {
+            if (state == MPSC_BUSY && complete) {
+                sched_yield();
+                continue;
+            }
+            return;
+        }
+
+        ShardPost *post = (ShardPost*) node;
+        for (int i = 0; i < post->count; i++) {
+            conn_send_buf(post->conns[i], post->msg);
+        }
+        msgbuf_unref(post->msg);
+        free(post);
+    }
+}
+
+void reactor_deliver(Conn *c, MsgBuf *msg) {
+    Reactor *owner = c->reactor;
+
+    if (!owner || !owner->sharded || owner == current_shard) {
+        conn_send_buf(c, msg);
+        return;
+    }
+
+    Staging *s = &staged[owner->id];
+    if (s->count == s->cap) {
+        int cap = s->cap ? s->cap * 2 : 64;
+        Conn **grown = (Conn**) realloc(s->conns, cap * sizeof(Conn*));
+        if (grown == NULL) {
+            conn_send_buf(c, msg);   // Slow path, but still delivered
+            return;
+        }
+        s->conns = grown;
+        s->cap = cap;
+    }
+    s->conns[s->count++] = c;
+}
+
+void reactor_deliver_flush(MsgBuf *msg) {
+    for (int i = 0; i < num_shards; i++) {
+        Staging *s = &staged[i];
+        if (s->count == 0) continue;
+
+        ShardPost *post = (ShardPost*) malloc(sizeof(ShardPost) + s->count * sizeof(Conn*));
+        if (post == NULL) {
+            // Deliver from here instead; out_lock keeps it safe
+            for (int j = 0; j < s->count; j++) conn_send_buf(s->conns[j], msg);
+            s->count = 0;
+            continue;
+        }
+        post->msg = msgbuf_ref(msg);
+        post->count = s->count;
+        memcpy(post->conns, s->conns, s->count * sizeof(Conn*));
+        s->count = 0;
+
+        mpsc_push(&shards[i].inbox, &post->node);
+        inbox_wake(&shards[i]);
+        metrics_add(M_CROSS_SHARD_POSTS, 1);
+    }
+}
+
+/////////////////// REACTOR //////////////////////////
+
+// Lift the soft descriptor limit to the hard limit so one process can
+// hold tens of thousands of idle clients.
+static void raise_fd_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// Create the epoll set and register the listener, if any
+static int reactor_setup(Reactor *r, int listen_fd) {
+    if ((r->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    if (listen_fd == -1) {
+        return 0;
+    }
+
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("fcntl listen socket");
+        return -1;
+    }
+    r->listen_fd = listen_fd;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = TAG_LISTENER;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+        perror("epoll_ctl add listener");
+        return -1;
+    }
+    return 0;
+}
+
+int reactor_init(int listen_fd, int num_workers) {
+    Reactor *r = &reactor;
+
+    raise_fd_limit();
+
+    if (reactor_setup(r, listen_fd) == -1) {
+        return -1;
+    }
+    if (listen_fd == -1) {
+        return 0;   // Outbound queues only
+    }
+
+    if (num_workers <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = cpus > 0 ? (int) cpus : 1;
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, worker_main, r) != 0) {
+            perror("pthread_create worker");
+            return -1;
+        }
+        pthread_detach(worker);
+    }
+
+    printf("Event loop mode: %d worker thread(s)\n", num_workers);
+    return 0;
+}
+
+static int reactor_loop(Reactor *r) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        // Nothing from the previous batch is still being looked at, so
+        // connections closed before this point are safe to free. Posts
+        // from other shards may still name them, so deliver those first.
+        Conn *dead = take_graveyard(r);
+        if (r->sharded) {
+            inbox_drain(r, dead != NULL);
+        }
+        free_conns(dead);
+
+        int timeout = (r->sharded && r->ready_head != NULL) ? 0 : 1000;
+        int n = epoll_wait(r->epfd, events, MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == TAG_LISTENER) {
+                accept_clients(r);
+                continue;
+            }
+            if (tag == TAG_INBOX) {
+                uint64_t count;
+                if (read(r->inbox_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+                    perror("read inbox eventfd");
+                }
+                atomic_store(&r->inbox_woken, 0);
+                inbox_drain(r, 0);
+                continue;
+            }
+
+            Conn *c = (Conn*) tag;
+            if (events[i].events & EPOLLOUT) {
+                conn_flush(c);
+            }
+            if (r->listen_fd != -1 &&
+                (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                conn_post(r, c, CONN_EV_READ);
+            }
+        }
+
+        // A shard is its own worker. Connections requeued while being
+        // serviced wait for the next round.
+        if (r->sharded) {
+            Conn *last = r->ready_tail;
+            Conn *c;
+            while (last != NULL && (c = workq_pop(r, 0)) != NULL) {
+                conn_service(r, c);
+                if (c == last) break;
+            }
+        }
+    }
+    return 0;
+}
+
+/////////////////// IO_URING //////////////////////////
+
+// The io_uring backend runs like a single shard: one thread owns the
+// ring and the listener, and runs its clients' commands itself. Instead
+// of waiting for readiness and then reading, it keeps three multishot
+// requests in flight:
+//   - one accept on the listener, posting a completion per new client
+//   - one receive per client, completing with a buffer the kernel took
+//     from the provided buffer ring; lines are parsed straight out of it
+//     and the buffer goes back to the ring
+//   - one POLLOUT poll per client, standing in for EPOLLOUT|EPOLLET so
+//     that queued output is flushed with conn_flush()
+// Output itself still goes through conn.c (a direct send, then the
+// queue): replies and broadcasts come from any thread, and only the ring
+// thread may fill in submission entries.
+//
+// While input is held the ring thread cancels the accept and every
+// receive. Bytes that complete before a cancellation lands are kept in
+// Conn->held and run first once input resumes (or by the next process).
+// reactor_hold() waits for all receives to be gone, so nothing read
+// after the directory was serialized can be lost.
+
+static void ring_cancel(Reactor *r, unsigned long user_data) {
+    struct io_uring_sqe *sqe = uring_sqe(r->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = user_data;
+    sqe->user_data = UD_CANCEL;
+}
+
+static void ring_arm_accept(Reactor *r) {
+    struct io_uring_sqe *sqe = uring_sqe(r->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = r->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = UD_ACCEPT;
+    r->accept_armed = 1;
+}
+
+static void ring_arm_inbox(Reactor *r) {
+    struct io_uring_sqe *sqe = uring_sqe(r->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = r->inbox_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = UD_INBOX;
+}
+
+static void ring_arm_recv(Reactor *r, Conn *c) {
+    struct io_uring_sqe *sqe = uring_sqe(r->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = (unsigned long) c | RING_RECV;
+    c->ring_ops |= RING_RECV;
+}
+
+static void ring_arm_pollout(Reactor *r, Conn *c) {
+    struct io_uring_sqe *sqe = uring_sqe(r->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (unsigned long) c | RING_POLLOUT;
+    c->ring_ops |= RING_POLLOUT;
+}
+
+// Arm whatever a live connection is missing. Receives wait while input
+// is held.
+static void ring_arm(Reactor *r, Conn *c) {
+    if (!(c->ring_ops & RING_POLLOUT)) {
+        ring_arm_pollout(r, c);
+    }
+    if (!r->holding && !(c->ring_ops & RING_RECV)) {
+        ring_arm_recv(r, c);
+    }
+}
+
+static void ring_link(Reactor *r, Conn *c) {
+    c->reactor = r;
+    c->prev = NULL;
+    c->next = r->ring_conns;
+    if (r->ring_conns != NULL) {
+        r->ring_conns->prev = c;
+    }
+    r->ring_conns = c;
+}
+
+// Cancel what is in flight and close the socket; the Conn is freed once
+// its last completion is in and the epoch has passed (see ring_sweep()). The file stays open in
+// the kernel until then, so a reused descriptor number is no concern.
+static void ring_close(Reactor *r, Conn *c) {
+    if (c->ring_ops & RING_DEAD) return;
+
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        r->ring_conns = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+
+    if (c->ring_ops & RING_RECV) ring_cancel(r, (unsigned long) c | RING_RECV);
+    if (c->ring_ops & RING_POLLOUT) ring_cancel(r, (unsigned long) c | RING_POLLOUT);
+    c->ring_ops |= RING_DEAD;
+    conn_shutdown(c);
+    c->retired_at = epoch_stamp();
+
+    c->next = r->dying;
+    r->dying = c;
+}
+
+static void ring_sweep(Reactor *r) {
+    Conn **link = &r->dying;
+    while (*link != NULL) {
+        Conn *c = *link;
+        if ((c->ring_ops & RING_TAGS) || !epoch_passed(c->retired_at)) {
+            link = &c->next;
+            continue;
+        }
+        *link = c->next;
+        conn_destroy(c);
+    }
+}
+
+static void ring_disconnect(Reactor *r, Conn *c) {
+    client_disconnected(c);
+    endClientInput();
+    ring_close(r, c);
+}
+
+// Keep bytes that arrived while input is held
+static void ring_hold_bytes(Conn *c, const char *data, size_t n) {
+    char *grown = (char*) realloc(c->held, c->held_len + n);
+    if (grown == NULL) {
+        perror("realloc failed for held input");
+        return;
+    }
+    memcpy(grown + c->held_len, data, n);
+    c->held = grown;
+    c->held_len += n;
+}
+
+static void ring_accepted(Reactor *r, int fd) {
+    Conn *c = conn_create(fd);
+    if (c == NULL) {
+        close(fd);
+        return;
+    }
+    ring_link(r, c);
+
+    // Got in before a stop, if there is one: greet it anyway so that it
+    // has a user to hand over
+    beginClientInput(1);
+    client_connected(c);
+    endClientInput();
+    ring_arm(r, c);
+}
+
+static void ring_received(Reactor *r, Conn *c, struct io_uring_cqe *cqe) {
+    int more = cqe->flags & IORING_CQE_F_MORE;
+    int res = cqe->res;
+
+    if (!more) {
+        c->ring_ops &= ~RING_RECV;
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char *data = uring_buffer(r->ring, id);
+
+        if (res > 0 && !(c->ring_ops & RING_DEAD)) {
+            if (!beginClientInput(0)) {
+                ring_hold_bytes(c, data, res);
+            } else if (replay_held(c) == -1 || feed_input(c, data, res) == -1) {
+                uring_recycle(r->ring, id);
+                ring_disconnect(r, c);
+                return;
+            } else {
+                endClientInput();
+            }
+        }
+        uring_recycle(r->ring, id);
+    }
+    if (c->ring_ops & RING_DEAD) return;
+
+    // End of stream or a socket error. While input is held it is left
+    // for later: the socket reports it again to the next receive.
+    if (res == 0 || (res < 0 && res != -ENOBUFS && res != -ECANCELED)) {
+        if (beginClientInput(0)) {
+            replay_held(c);
+            ring_disconnect(r, c);
+        }
+        return;
+    }
+
+    // A receive also ends when the buffer ring runs dry
+    if (!more && !r->holding) {
+        ring_arm_recv(r, c);
+    }
+}
+
+static void ring_writable(Reactor *r, Conn *c, struct io_uring_cqe *cqe) {
+    int more = cqe->flags & IORING_CQE_F_MORE;
+
+    if (!more) {
+        c->ring_ops &= ~RING_POLLOUT;
+    }
+    if (c->ring_ops & RING_DEAD) return;
+
+    if (cqe->res > 0) {
+        conn_flush(c);
+    }
+    if (!more) {
+        ring_arm_pollout(r, c);
+    }
+}
+
+static void ring_complete(Reactor *r, struct io_uring_cqe *cqe) {
+    unsigned long user_data = cqe->user_data;
+
+    switch (user_data) {
+    case UD_ACCEPT:
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            r->accept_armed = 0;
+        }
+        if (cqe->res >= 0) {
+            ring_accepted(r, cqe->res);
+        } else if (cqe->res != -ECANCELED) {
+            fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+            r->accept_retry_ns = metrics_now_ns() + ACCEPT_RETRY_MS * 1000000L;
+        }
+        return;
+    case UD_INBOX: {
+        uint64_t count;
+        if (read(r->inbox_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+            perror("read inbox eventfd");
+        }
+        atomic_store(&r->inbox_woken, 0);
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            ring_arm_inbox(r);
+        }
+        return;
+    }
+    case UD_CANCEL:
+        return;
+    }
+
+    if (user_data < UD_CONN_MIN) return;
+    Conn *c = (Conn*) (user_data & ~(unsigned long) RING_TAGS);
+    if (user_data & RING_RECV) {
+        ring_received(r, c, cqe);
+    } else {
+        ring_writable(r, c, cqe);
+    }
+}
+
+// Follow server_stopping: cancel receives when input is held, arm them
+// again (after running held input) once it is not
+static void ring_follow_input(Reactor *r) {
+    int stopping = atomic_load(&server_stopping);
+
+    if (stopping && !r->holding) {
+        r->holding = 1;
+        if (r->accept_armed) ring_cancel(r, UD_ACCEPT);
+        for (Conn *c = r->ring_conns; c != NULL; c = c->next) {
+            if (c->ring_ops & RING_RECV) ring_cancel(r, (unsigned long) c | RING_RECV);
+        }
+    } else if (!stopping && (r->holding || atomic_exchange(&r->rearm, 0))) {
+        r->holding = 0;
+        atomic_store(&r->quiet, 0);
+        Conn *next;
+        for (Conn *c = r->ring_conns; c != NULL; c = next) {
+            next = c->next;
+            if (c->held != NULL && beginClientInput(0)) {
+                if (replay_held(c) == -1) {
+                    ring_disconnect(r, c);
+                    continue;
+                }
+                endClientInput();
+            }
+            ring_arm(r, c);
+        }
+    }
+
+    if (r->holding) {
+        int receiving = r->accept_armed;
+        for (Conn *c = r->ring_conns; c != NULL && !receiving; c = c->next) {
+            receiving = c->ring_ops & RING_RECV;
+        }
+        atomic_store(&r->quiet, !receiving);
+    } else if (!r->accept_armed && metrics_now_ns() >= r->accept_retry_ns) {
+        ring_arm_accept(r);
+    }
+}
+
+static int ring_loop(Reactor *r) {
+    ring_arm_inbox(r);
+
+    while (1) {
+        ring_sweep(r);
+        ring_follow_input(r);
+
+        int timeout = (r->holding || r->accept_armed) ? 1000 : ACCEPT_RETRY_MS;
+        if (uring_wait(r->ring, timeout) == -1) {
+            return -1;
+        }
+
+        // Copy each completion out first: handling it may submit, and a
+        // full submission queue makes room by entering the kernel
+        struct io_uring_cqe *cqe;
+        long n = 0;
+        while ((cqe = uring_peek(r->ring)) != NULL) {
+            struct io_uring_cqe done = *cqe;
+            uring_seen(r->ring);
+            ring_complete(r, &done);
+            n++;
+        }
+        metrics_add(M_RING_WAITS, 1);
+        metrics_add(M_RING_COMPLETIONS, n);
+    }
+    return 0;
+}
+
+int reactor_init_uring(int listen_fd) {
+    Reactor *r = &reactor;
+
+    raise_fd_limit();
+
+    Uring *ring = (Uring*) malloc(sizeof(Uring));
+    if (ring == NULL || uring_init(ring) == -1) {
+        free(ring);
+        return -1;
+    }
+
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+        (r->inbox_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror("io_uring reactor setup");
+        uring_free(ring);
+        free(ring);
+        return -1;
+    }
+    r->listen_fd = listen_fd;
+    r->ring = ring;
+
+    printf("io_uring mode: %d receive buffers of %d bytes\n", URING_BUF_COUNT, URING_BUF_SIZE);
+    return 0;
+}
+
+void reactor_hold() {
+    Reactor *r = &reactor;
+    if (r->ring == NULL) return;
+
+    long deadline = metrics_now_ns() + SHUTDOWN_DRAIN_MS * 1000000L;
+    inbox_wake(r);
+    while (!atomic_load(&r->quiet) && metrics_now_ns() < deadline) {
+        usleep(1000);
+    }
+}
+
+int reactor_adopt(Conn *c) {
+    Reactor *r = &reactor;
+    if (r->ring != NULL) {
+        // Before reactor_run(): the ring thread arms it when input resumes
+        ring_link(r, c);
+        atomic_store(&r->rearm, 1);
+        return 0;
+    }
+    if (num_shards > 0) {
+        static int next_shard = 0;
+        r = &shards[next_shard++ % num_shards];
+    }
+    if (reactor_register(r, c, CONN_EV_READ) == -1) {
+        return -1;
+    }
+    if (r->sharded) {
+        inbox_wake(r);
+    }
+    return 0;
+}
+
+void reactor_resume() {
+    Reactor *all = num_shards > 0 ? shards : &reactor;
+    int count = num_shards > 0 ? num_shards : 1;
+
+    if (reactor.ring != NULL) {
+        inbox_wake(&reactor);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        if (all[i].listen_fd != -1) {
+            accept_clients(&all[i]);
+        }
+    }
+}
+
+void reactor_rearm(Conn *c) {
+    Reactor *r = c->reactor;
+    if (r->listen_fd == -1) return;   // Client threads resume on their own
+    if (r->ring != NULL) {
+        atomic_store(&r->rearm, 1);
+        inbox_wake(r);
+        return;
+    }
+
+    conn_post(r, c, CONN_EV_READ);
+    if (r->sharded) {
+        inbox_wake(r);
+    }
+}
+
+int reactor_run() {
+    if (reactor.ring != NULL) {
+        return ring_loop(&reactor);
+    }
+    return reactor_loop(&reactor);
+}
+
+void *reactor_thread(void *arg) {
+    reactor_run();
+    return NULL;
+}
+
+static void *shard_main(void *arg) {
+    Reactor *r = (Reactor*) arg;
+    current_shard = r;
+    reactor_loop(r);
+    return NULL;
+}
+
+int reactor_init_shards(int *listen_fds, int nshards) {
+    raise_fd_limit();
+
+    shards = (Reactor*) calloc(nshards, sizeof(Reactor));
+    if (shards == NULL) {
+        perror("calloc failed for shards");
+        return -1;
+    }
+
+    for (int i = 0; i < nshards; i++) {
+        Reactor *r = &shards[i];
+        r->id = i;
+        r->sharded = 1;
+        r->listen_fd = -1;
+        pthread_mutex_init(&r->queue_lock, NULL);
+        pthread_cond_init(&r->queue_cond, NULL);
+        pthread_mutex_init(&r->grave_lock, NULL);
+        mpsc_init(&r->inbox);
+
+        if (reactor_setup(r, listen_fds[i]) == -1) return -1;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = TAG_INBOX;
+        if ((r->inbox_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+            epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->inbox_fd, &ev) == -1) {
+            perror("shard inbox");
+            return -1;
+        }
+    }
+    num_shards = nshards;
+
+    printf("Sharded mode: %d reactor(s)\n", nshards);
+    return 0;
+}
+
+int reactor_run_shards() {
+    // Shard 0 runs on the calling thread
+    for (int i = 1; i < num_shards; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, shard_main, &shards[i]) != 0) {
+            perror("pthread_create shard");
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+    shard_main(&shards[0]);
+    return -1;
+}
@@ -0,0 +1,85 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "conn.h"
+
+// Event bits posted to a connection by the reactor thread
+#define CONN_EV_OPEN   0x01   // Connection was just accepted
+#define CONN_EV_READ   0x02   // Socket became readable (or hung up)
+
+#define MAX_SHARDS 64
+
+// The reactor owns one epoll set. In event loop mode it also owns the
+// listener and every client socket: it never reads a socket itself, it
+// only records what happened in Conn->pending and hands the connection
+// to a worker. Conn->scheduled guarantees that at most one worker is
+// handling a given connection, so commands from one client are still
+// processed in order.
+//
+// In both modes the reactor drains outbound queues: when a socket with
+// queued output becomes writable it calls conn_flush() directly.
+//
+// Sharded mode runs one reactor per core instead, each with its own
+// SO_REUSEPORT listener and its own connections, and no worker pool: a
+// shard handles its clients' commands on its own thread. A broadcast
+// reaching clients of other shards hands each of them one batch through
+// a lock-free MPSC inbox, so a shard's sockets are only written to by
+// their own thread unless an outbound queue must be drained elsewhere.
+
+// Set up the reactor. With listen_fd == -1 it starts no workers and only
+// drains outbound queues (thread-per-client mode). Otherwise
+// `num_workers` 0 means one worker per online CPU.
+int reactor_init(int listen_fd, int num_workers);
+
+// Run the event loop. Only returns on a fatal error.
+int reactor_run();
+void *reactor_thread(void *arg);
+
+// Sharded mode: set up one reactor per listener, then run them, shard 0
+// on the calling thread. reactor_run_shards() only returns on a fatal
+// error.
+int reactor_init_shards(int *listen_fds, int nshards);
+int reactor_run_shards();
+
+// io_uring mode: one ring thread (the one calling reactor_run()) owns
+// the listener and every client, with multishot accept, receive and
+// POLLOUT requests in place of epoll (see reactor.c). Returns -1 if this
+// kernel cannot do it; the caller may fall back to reactor_init().
+int reactor_init_uring(int listen_fd);
+
+// Input is being held (server_stopping is set): wait until the ring has
+// no receive left in flight. No-op in the other modes, which read only
+// when they are told to.
+void reactor_hold();
+
+// Queue `msg` for `c`. Clients of another shard are only staged; call
+// reactor_deliver_flush() with the same message once every recipient
+// has been passed in. Callers hold the directory read lock, or stay in
+// an epoch section (see epoch.h), across both; either keeps every staged
+// Conn alive until its shard has the batch.
+void reactor_deliver(Conn *c, MsgBuf *msg);
+void reactor_deliver_flush(MsgBuf *msg);
+
+// Thread-per-client mode: watch a client socket for writability
+int reactor_add(Conn *c);
+
+// Hot restart: take over a client handed down by the previous process.
+// Its user already exists; whatever it sent meanwhile is read next.
+// Event loop modes only, after the reactor (or shards) are set up.
+int reactor_adopt(Conn *c);
+
+// A hot restart was called off: accept again, and read what clients
+// sent while input was held (see beginClientInput())
+void reactor_resume();
+void reactor_rearm(Conn *c);
+
+// Stop watching a connection, close its socket and free it once no
+// epoll batch or broadcast can still refer to it. Called once, by its
+// owner, after the client left the directory.
+void reactor_close(Conn *c);
+
+#endif
@@ -0,0 +1,354 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+// Cluster relay: ./relay [-u path]
+//
+// Joins several chat servers on one host into one chat (see cluster.h
+// for the frame format). Single threaded: one poll() loop over the
+// listener and every server connection. Each server has a non-blocking
+// output buffer; a server that stops reading is dropped once it falls
+// RELAY_OUT_MAX bytes behind, and resyncs when it reconnects.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "cluster.h"
+#include "hash.h"
+
+#define RELAY_MAX_NODES 64
+#define RELAY_OUT_MAX   (64 * 1024 * 1024)
+
+typedef struct Node {
+    int fd;                    // -1 marks a free slot
+    char *in;                  // Partial frame carried between reads
+    size_t in_len;
+    size_t in_cap;
+    char *out;                 // Frames not yet written
+    size_t out_len;
+    size_t out_off;
+    size_t out_cap;
+    StrMap subs;               // Rooms this server has members in
+} Node;
+
+static Node nodes[RELAY_MAX_NODES];
+static const char *socket_path = RELAY_PATH;
+
+// Every room any server has announced, replayed to new servers
+static StrMap known_rooms;
+static char **room_names = NULL;
+static size_t num_rooms = 0;
+static size_t rooms_cap = 0;
+
+/////////////////// NODES //////////////////////////
+
+static void node_close(Node *n) {
+    close(n->fd);
+    n->fd = -1;
+    for (size_t i = 0; i < n->subs.cap; i++) {
+        if (n->subs.slots[i].key != NULL) free(n->subs.slots[i].value);
+    }
+    strmap_free(&n->subs);
+    free(n->in);
+    free(n->out);
+    memset(n, 0, sizeof(Node));
+    n->fd = -1;
+    printf("Server left (%d rooms known)\n", (int) num_rooms);
+}
+
+static void node_send(Node *n, const char *frame, size_t len) {
+    if (n->fd == -1) return;
+
+    if (n->out_off == n->out_len) {
+        n->out_off = n->out_len = 0;
+    }
+    if (n->out_len + len > n->out_cap) {
+        size_t cap = n->out_cap ? n->out_cap : 65536;
+        while (cap < n->out_len + len) cap *= 2;
+        char *grown = cap <= RELAY_OUT_MAX ? (char*) realloc(n->out, cap) : NULL;
+        if (grown == NULL) {
+            fprintf(stderr, "Dropping a server that stopped reading\n");
+            node_close(n);
+            return;
+        }
+        n->out = grown;
+        n->out_cap = cap;
+    }
+    memcpy(n->out + n->out_len, frame, len);
+    n->out_len += len;
+}
+
+static int node_flush(Node *n) {
+    while (n->out_off < n->out_len) {
+        ssize_t sent = write(n->fd, n->out + n->out_off, n->out_len - n->out_off);
+        if (sent > 0) {
+            n->out_off += sent;
+        } else if (sent == -1 && errno == EINTR) {
+            continue;
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/////////////////// ROUTING //////////////////////////
+
+static void remember_room(const char *room) {
+    if (strmap_get(&known_rooms, room) != NULL) return;
+
+    if (num_rooms == rooms_cap) {
+        size_t cap = rooms_cap ? rooms_cap * 2 : 64;
+        char **grown = (char**) realloc(room_names, cap * sizeof(char*));
+        if (grown == NULL) return;
+        room_names = grown;
+        rooms_cap = cap;
+    }
+    char *name = strdup(room);
+    if (name == NULL || strmap_put(&known_rooms, name, name) == -1) {
+        free(name);
+        return;
+    }
+    room_names[num_rooms++] = name;
+}
+
+// Forward a MSG to every other server with members in one of its rooms
+static void route_msg(Node *from, char *frame, size_t len, char *rest) {
+    char *rooms[CLUSTER_MAX_ROOMS];
+    char *end = frame + len;
+    int nrooms = atoi(rest);
+    if (nrooms <= 0 || nrooms > CLUSTER_MAX_ROOMS) return;
+
+    // Cut the room names out of a copy; the frame goes out untouched.
+    // node_read() only passes frames up to CLUSTER_MAX_FRAME.
+    char names[CLUSTER_MAX_FRAME];
+    memcpy(names, rest, end - rest);
+    char *names_end = names + (end - rest);
+
+    char *p = memchr(names, ' ', names_end - names);
+    for (int i = 0; i < nrooms; i++) {
+        if (p == NULL) return;
+        rooms[i] = p + 1;
+        p = memchr(p + 1, ' ', names_end - (p + 1));
+        if (p != NULL) *p = '\0';
+    }
+    if (p == NULL) return;
+
+    for (int i = 0; i < RELAY_MAX_NODES; i++) {
+        Node *n = &nodes[i];
+        if (n == from || n->fd == -1) continue;
+        for (int r = 0; r < nrooms; r++) {
+            if (strmap_get(&n->subs, rooms[r]) != NULL) {
+                node_send(n, frame, len);
+                break;
+            }
+        }
+    }
+}
+
+static void handle_frame(Node *from, char *frame, size_t len) {
+    char *space = memchr(frame, ' ', len);
+    if (space == NULL) return;
+
+    size_t verb_len = space - frame;
+    char *rest = space + 1;
+
+    if (verb_len == 3 && memcmp(frame, "MSG", 3) == 0) {
+        route_msg(from, frame, len, rest);
+        return;
+    }
+
+    // The rest are single-room frames
+    char room[MAX_NAME_LEN];
+    size_t room_len = frame + len - 1 - rest;
+    if (room_len >= sizeof(room)) return;
+    memcpy(room, rest, room_len);
+    room[room_len] = '\0';
+
+    if (verb_len == 4 && memcmp(frame, "ROOM", 4) == 0) {
+        if (strmap_get(&known_rooms, room) != NULL) return;
+        remember_room(room);
+        for (int i = 0; i < RELAY_MAX_NODES; i++) {
+            if (&nodes[i] != from) node_send(&nodes[i], frame, len);
+        }
+    } else if (verb_len == 3 && memcmp(frame, "SUB", 3) == 0) {
+        if (strmap_get(&from->subs, room) != NULL) return;
+        char *name = strdup(room);
+        if (name != NULL && strmap_put(&from->subs, name, name) == -1) free(name);
+    } else if (verb_len == 5 && memcmp(frame, "UNSUB", 5) == 0) {
+        char *name = (char*) strmap_get(&from->subs, room);
+        if (name != NULL) {
+            strmap_remove(&from->subs, room);
+            free(name);
+        }
+    }
+}
+
+static int node_read(Node *n) {
+    while (1) {
+        if (n->in_cap - n->in_len < 4096) {
+            size_t cap = n->in_cap ? n->in_cap * 2 : 65536;
+            char *grown = (char*) realloc(n->in, cap);
+            if (grown == NULL) return -1;
+            n->in = grown;
+            n->in_cap = cap;
+        }
+
+        ssize_t received = read(n->fd, n->in + n->in_len, n->in_cap - n->in_len);
+        if (received == 0) return -1;
+        if (received == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        n->in_len += received;
+
+        size_t start = 0;
+        char *nl;
+        while ((nl = memchr(n->in + start, '\n', n->in_len - start)) != NULL) {
+            size_t len = nl + 1 - (n->in + start);
+            if (len > CLUSTER_MAX_FRAME) break;
+            handle_frame(n, n->in + start, len);
+            if (n->fd == -1) return -1;
+            start += len;
+        }
+        memmove(n->in, n->in + start, n->in_len - start);
+        n->in_len -= start;
+
+        // No server sends frames this long; whatever did must not grow
+        // the buffer without bound
+        if (n->in_len > CLUSTER_MAX_FRAME) {
+            fprintf(stderr, "Dropping a server that sent an oversized frame\n");
+            return -1;
+        }
+    }
+}
+
+/////////////////// MAIN //////////////////////////
+
+static void accept_node(int listen_fd) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) return;
+
+    Node *n = NULL;
+    for (int i = 0; i < RELAY_MAX_NODES && n == NULL; i++) {
+        if (nodes[i].fd == -1) n = &nodes[i];
+    }
+    if (n == NULL) {
+        fprintf(stderr, "Too many servers, refusing one\n");
+        close(fd);
+        return;
+    }
+    n->fd = fd;
+
+    // Bring the new server up to date on rooms
+    char frame[256];
+    for (size_t i = 0; i < num_rooms; i++) {
+        int len = snprintf(frame, sizeof(frame), "ROOM %s\n", room_names[i]);
+        if (len > 0 && (size_t) len < sizeof(frame)) node_send(n, frame, len);
+    }
+    printf("Server joined (%d rooms known)\n", (int) num_rooms);
+}
+
+static void relay_exit(int sig) {
+    unlink(socket_path);
+    _exit(0);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "u:h")) != -1) {
+        switch (opt) {
+        case 'u':
+            socket_path = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-u path]   (default: %s)\n", argv[0], RELAY_PATH);
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, relay_exit);
+    signal(SIGTERM, relay_exit);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        perror("socket");
+        exit(1);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path);
+
+    // Only servers run by the same user may join: the socket is created
+    // owner-only, so there is no moment where others can connect
+    mode_t old_mask = umask(077);
+    int bound = bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr));
+    umask(old_mask);
+    if (bound == -1 || listen(listen_fd, SOMAXCONN) == -1) {
+        perror("relay bind");
+        exit(1);
+    }
+    printf("Relay listening on %s\n", socket_path);
+    fflush(stdout);
+
+    for (int i = 0; i < RELAY_MAX_NODES; i++) {
+        nodes[i].fd = -1;
+    }
+
+    struct pollfd fds[RELAY_MAX_NODES + 1];
+    Node *polled[RELAY_MAX_NODES + 1];
+
+    while (1) {
+        int nfds = 0;
+        fds[nfds].fd = listen_fd;
+        fds[nfds].events = POLLIN;
+        polled[nfds++] = NULL;
+        for (int i = 0; i < RELAY_MAX_NODES; i++) {
+            if (nodes[i].fd == -1) continue;
+            fds[nfds].fd = nodes[i].fd;
+            fds[nfds].events = POLLIN | (nodes[i].out_off < nodes[i].out_len ? POLLOUT : 0);
+            polled[nfds++] = &nodes[i];
+        }
+
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            exit(1);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            accept_node(listen_fd);
+        }
+        for (int i = 1; i < nfds; i++) {
+            Node *n = polled[i];
+            if (n->fd == -1 || fds[i].fd != n->fd) continue;   // Closed this round
+            if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && node_read(n) == -1) {
+                if (n->fd != -1) node_close(n);
+            }
+        }
+
+        // Routing may have queued output for any server
+        for (int i = 0; i < RELAY_MAX_NODES; i++) {
+            if (nodes[i].fd != -1 && node_flush(&nodes[i]) == -1) {
+                node_close(&nodes[i]);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "rwlock.h"
+#include "metrics.h"
+
+void rwlock_init(RWLock *rw) {
+    pthread_mutex_init(&rw->lock, NULL);
+    pthread_cond_init(&rw->readers_ok, NULL);
+    pthread_cond_init(&rw->writer_ok, NULL);
+    rw->active_readers = 0;
+    rw->waiting_writers = 0;
+    rw->writer_active = 0;
+    rw->lock_class = 0;
+}
+
+void rwlock_destroy(RWLock *rw) {
+    pthread_mutex_destroy(&rw->lock);
+    pthread_cond_destroy(&rw->readers_ok);
+    pthread_cond_destroy(&rw->writer_ok);
+}
+
+// Instrumented locks record how long each acquisition waited. The clock
+// is only read when the caller actually has to wait.
+void rwlock_read_lock(RWLock *rw) {
+    long waited = 0;
+
+    pthread_mutex_lock(&rw->lock);
+    // Waiting writers go first
+    if (rw->writer_active || rw->waiting_writers > 0) {
+        long start = metrics_now_ns();
+        while (rw->writer_active || rw->waiting_writers > 0) {
+            pthread_cond_wait(&rw->readers_ok, &rw->lock);
+        }
+        waited = metrics_now_ns() - start;
+    }
+    rw->active_readers++;
+    pthread_mutex_unlock(&rw->lock);
+
+    if (rw->lock_class) metrics_lock_acquired(rw->lock_class, 0, waited);
+}
+
+void rwlock_read_unlock(RWLock *rw) {
+    pthread_mutex_lock(&rw->lock);
+    rw->active_readers--;
+    if (rw->active_readers == 0 && rw->waiting_writers > 0) {
+        pthread_cond_signal(&rw->writer_ok);
+    }
+    pthread_mutex_unlock(&rw->lock);
+}
+
+void rwlock_write_lock(RWLock *rw) {
+    long waited = 0;
+
+    pthread_mutex_lock(&rw->lock);
+    rw->waiting_writers++;
+    if (rw->writer_active || rw->active_readers > 0) {
+        long start = metrics_now_ns();
+        while (rw->writer_active || rw->active_readers > 0) {
+            pthread_cond_wait(&rw->writer_ok, &rw->lock);
+        }
+        waited = metrics_now_ns() - start;
+    }
+    rw->waiting_writers--;
+    rw->writer_active = 1;
+    pthread_mutex_unlock(&rw->lock);
+
+    if (rw->lock_class) metrics_lock_acquired(rw->lock_class, 1, waited);
+}
+
+void rwlock_write_unlock(RWLock *rw) {
+    pthread_mutex_lock(&rw->lock);
+    rw->writer_active = 0;
+    if (rw->waiting_writers > 0) {
+        pthread_cond_signal(&rw->writer_ok);
+    } else {
+        pthread_cond_broadcast(&rw->readers_ok);
+    }
+    pthread_mutex_unlock(&rw->lock);
+}
@@ -0,0 +1,37 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+#include <pthread.h>
+
+// Writer-preferring reader/writer lock. Any number of readers may hold
+// the lock together, but as soon as a writer is waiting new readers queue
+// behind it, so a steady stream of broadcasts cannot starve `join` or
+// `login`. Unlike the old numReaders/rw_lock pair, every unlock is done
+// by the thread that locked, which is what pthread mutexes require.
+typedef struct RWLock {
+    pthread_mutex_t lock;
+    pthread_cond_t readers_ok;
+    pthread_cond_t writer_ok;
+    int active_readers;
+    int waiting_writers;
+    int writer_active;
+    int lock_class;            // Metrics class (metrics.h), 0 = not timed
+} RWLock;
+
+#define RWLOCK_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, \
+                             PTHREAD_COND_INITIALIZER, 0, 0, 0, 0 }
+#define RWLOCK_INITIALIZER_CLASS(cls) { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, \
+                                        PTHREAD_COND_INITIALIZER, 0, 0, 0, (cls) }
+
+void rwlock_init(RWLock *rw);
+void rwlock_destroy(RWLock *rw);
+void rwlock_read_lock(RWLock *rw);
+void rwlock_read_unlock(RWLock *rw);
+void rwlock_write_lock(RWLock *rw);
+void rwlock_write_unlock(RWLock *rw);
+
+#endif
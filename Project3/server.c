@@ -3,16 +3,23 @@
 // Utsav Shah
 
 #include "server.h"
+#include "reactor.h"
+#include "hash.h"
+#include "admin.h"
+#include "metrics.h"
+#include "handoff.h"
+#include "listing.h"
+#include "timers.h"
+#include "epoch.h"
+
+#include <sys/signalfd.h>
 
 int chat_serv_sock_fd; // Server socket
 
 /////////////////////////////////////////////
-// USE THESE LOCKS AND COUNTER TO SYNCHRONIZE
-
-int numReaders = 0; // Keep count of the number of readers
+// USE THIS LOCK TO SYNCHRONIZE (see server.h)
 
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;  // mutex lock
-pthread_mutex_t rw_lock = PTHREAD_MUTEX_INITIALIZER;  // read/write lock
+RWLock rw_lock = RWLOCK_INITIALIZER_CLASS(LOCK_CLASS_DIR);  // read/write lock
 
 /////////////////////////////////////////////
 
@@ -21,36 +28,300 @@ char const *server_MOTD = "Thanks for connecting to the BisonChat Server.\n\ncha
 User *user_head = NULL;   // List of all users
 Room *room_head = NULL;   // List of all rooms
 
+// Indexes over the lists above, guarded by the same lock as the lists
+static IntMap users_by_socket;
+static StrMap users_by_name;
+static StrMap rooms_by_name;
+
+// Dense id -> record tables; ids index the membership bitsets
+static IdTable user_ids;
+static IdTable room_ids;
+
+// `users` and `rooms` replies, rebuilt after the lists change
+static void fillUsers(ListingBuilder *b);
+static void fillRooms(ListingBuilder *b);
+static ListingCache user_listing = LISTING_CACHE_INITIALIZER("Users", "users", fillUsers);
+static ListingCache room_listing = LISTING_CACHE_INITIALIZER("Rooms", "rooms", fillRooms);
+
+int server_mode = MODE_THREADS;   // Selected with -e, -s or -u
+int server_port = PORT;           // Changed with -P
+
+// Shutdown and hot restart (see the LIFECYCLE section)
+atomic_int server_stopping = 0;
+static atomic_int inputs_running = 0;
+static sigset_t lifecycle_signals;
+static char **server_argv;
+static int *listen_fds = NULL;    // Chat listeners, one per shard
+static int num_listen_fds = 0;
+
+static void openListeners(int shards);
+static void restoreState(char *state, int *fds, int nfds);
+static void resumeInput();
+static void *lifecycle_main(void *arg);
+
+// "idle,grace,write" in seconds; unlisted ones keep their default
+static int parseTimeouts(const char *arg) {
+    long *settings[] = { &idle_timeout_ms, &idle_grace_ms, &conn_write_timeout_ms };
+    const char *p = arg;
+
+    for (int i = 0; i < 3; i++) {
+        char *end;
+        long secs = strtol(p, &end, 10);
+        if (end == p || secs < 0) return -1;
+        *settings[i] = secs * 1000;
+        if (*end == '\0') return 0;
+        if (*end != ',') return -1;
+        p = end + 1;
+    }
+    return -1;
+}
+
+// Moves the epoch on even when nothing is being retired, so closed
+// connections waiting on it get freed (see epoch.h)
+static Timer reclaim_timer;
+
+static long reclaimTick(Timer *t, long now) {
+    epoch_reclaim();
+    return now + EPOCH_TICK_MS * 1000000L;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-e | -s shards | -u] [-w workers] [-q bytes] [-p policy] [-r rates] [-i timeouts] [-P port] [-a port] [-H dir] [-R relay]\n", prog);
+    fprintf(stderr, "  -e          use the epoll event loop instead of a thread per client\n");
+    fprintf(stderr, "  -s shards   one event loop per shard, each with its own listener\n");
+    fprintf(stderr, "              (0: one per CPU)\n");
+    fprintf(stderr, "  -u          one io_uring event loop (falls back to -e where unsupported)\n");
+    fprintf(stderr, "  -w workers  worker threads in event loop mode (default: one per CPU)\n");
+    fprintf(stderr, "  -q bytes    outbound queue limit per client (default: %d)\n", DEFAULT_QUEUE_LIMIT);
+    fprintf(stderr, "  -p policy   when a client's queue is full: drop, disconnect or block\n");
+    fprintf(stderr, "              (default: drop)\n");
+    fprintf(stderr, "  -r l,w,r    rate limits per second: any line per client, create/login\n");
+    fprintf(stderr, "              per client, messages per room; 0 disables (default: %d,%d,%d)\n",
+            RATE_LINES, RATE_WRITES, RATE_ROOM);
+    fprintf(stderr, "  -i i,g,w    seconds: silence before an idle client is pinged, time it has\n");
+    fprintf(stderr, "              to answer, stalled output before a disconnect; 0 disables\n");
+    fprintf(stderr, "              (default: %d,%d,%d)\n", IDLE_TIMEOUT_S, IDLE_GRACE_S,
+            DEFAULT_WRITE_TIMEOUT_MS / 1000);
+    fprintf(stderr, "  -P port     chat port (default: %d)\n", PORT);
+    fprintf(stderr, "  -H dir      directory for room history, \"off\" to disable (default: %s)\n", HISTORY_DIR);
+    fprintf(stderr, "  -a port     loopback admin port for `stats`, 0 to disable (default: %d)\n", ADMIN_PORT);
+    fprintf(stderr, "  -R relay    join the cluster relay listening on this Unix socket,\n");
+    fprintf(stderr, "              \"-\" for %s\n", RELAY_PATH);
+    fprintf(stderr, "SIGINT or SIGTERM shuts down gracefully, SIGUSR2 restarts in place:\n");
+    fprintf(stderr, "the binary at %s takes over every client without disconnecting it.\n", prog);
+}
+
 int main(int argc, char **argv) {
+    int num_workers = 0;
+    int num_shards = 0;
+    int admin_port = ADMIN_PORT;
+    const char *history_dir = HISTORY_DIR;
+    const char *relay = NULL;
+    int handoff_fd = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "es:uw:q:p:r:i:P:a:H:R:X:h")) != -1) {
+        switch (opt) {
+        case 'e':
+            server_mode = MODE_EPOLL;
+            break;
+        case 's':
+            server_mode = MODE_SHARDED;
+            num_shards = atoi(optarg);
+            break;
+        case 'u':
+            server_mode = MODE_URING;
+            break;
+        case 'w':
+            num_workers = atoi(optarg);
+            break;
+        case 'q':
+            // A queue must hold at least one full reply
+            conn_queue_limit = strtoul(optarg, NULL, 10);
+            if (conn_queue_limit < 2 * MAXBUFF) conn_queue_limit = 2 * MAXBUFF;
+            break;
+        case 'p':
+            if ((conn_slow_policy = parse_slow_policy(optarg)) == -1) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'r':
+            if (parse_rate_limits(optarg) == -1) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'i':
+            if (parseTimeouts(optarg) == -1) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'P':
+            server_port = atoi(optarg);
+            break;
+        case 'a':
+            admin_port = atoi(optarg);
+            break;
+        case 'H':
+            history_dir = optarg;
+            break;
+        case 'R':
+            relay = strcmp(optarg, "-") == 0 ? RELAY_PATH : optarg;
+            break;
+        case 'X':
+            // Internal: started by a hot restart (see handoff.h)
+            handoff_fd = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? 0 : 1);
+        }
+    }
 
-    signal(SIGINT, sigintHandler);
+    // Signals are read by the lifecycle thread; block them before any
+    // other thread exists so that every thread inherits the mask
+    sigemptyset(&lifecycle_signals);
+    sigaddset(&lifecycle_signals, SIGINT);
+    sigaddset(&lifecycle_signals, SIGTERM);
+    sigaddset(&lifecycle_signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &lifecycle_signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    server_argv = argv;
+
+    // Idle and write deadlines for every connection, and reclaiming
+    // directory memory
+    if (timers_start() == -1) {
+        exit(1);
+    }
+    timer_init(&reclaim_timer, reclaimTick, NULL);
+    timer_arm(&reclaim_timer, metrics_now_ns() + EPOCH_TICK_MS * 1000000L);
+
+    // A hot restart takes everything over from the previous process; it
+    // resumes reading once the clients are restored
+    char *state = NULL;
+    int *handed = NULL;
+    int nhanded = 0;
+    int nchat = 0;
+    int nadmin = 0;
+    int admin_fd = -1;
+    if (handoff_fd != -1) {
+        size_t state_len;
+        if (handoff_recv(handoff_fd, &state, &state_len, &handed, &nhanded) == -1 ||
+            sscanf(state, "LISTEN %d %d", &nchat, &nadmin) != 2 ||
+            nchat < 1 || nchat + nadmin > nhanded) {
+            printf("hot restart: bad handoff\n");
+            exit(1);
+        }
+        admin_fd = nadmin ? handed[nchat] : -1;
+        atomic_store(&server_stopping, 1);
+    }
     
+    if (strcmp(history_dir, "off") != 0 && history_init(history_dir) == -1) {
+        printf("room history unavailable, continuing without it\n");
+    }
+
     //////////////////////////////////////////////////////
     // Create the default room for all clients to join when 
     // initially connecting
     //////////////////////////////////////////////////////
-    room_head = insertFirstR(room_head, DEFAULT_ROOM);
+    addRoom(DEFAULT_ROOM);
+
+    if (handoff_fd != -1) {
+        listen_fds = handed;
+        num_listen_fds = nchat;
+        num_shards = nchat;
+    } else {
+        openListeners(num_shards);
+    }
+    chat_serv_sock_fd = listen_fds[0];
+   
+    printf("Server Launched! Listening on PORT: %d\n", server_port);
+
+    if ((admin_fd != -1 || admin_port > 0) && admin_start(admin_port, admin_fd) == -1) {
+        printf("admin port unavailable, continuing without it\n");
+    }
+
+    if (relay != NULL && cluster_start(relay) == -1) {
+        printf("relay unavailable, continuing standalone\n");
+    }
+
+    if (server_mode == MODE_URING && reactor_init_uring(chat_serv_sock_fd) == -1) {
+        printf("io_uring unavailable, using the epoll event loop\n");
+        server_mode = MODE_EPOLL;
+    }
+
+    if (server_mode == MODE_EPOLL) {
+        if (reactor_init(chat_serv_sock_fd, num_workers) == -1) {
+            close(chat_serv_sock_fd);
+            return 1;
+        }
+    } else if (server_mode == MODE_SHARDED) {
+        if (reactor_init_shards(listen_fds, num_listen_fds) == -1) {
+            close(chat_serv_sock_fd);
+            return 1;
+        }
+    } else if (server_mode == MODE_THREADS) {
+        // Client threads still read on their own, but outbound queues are
+        // drained by a reactor thread
+        pthread_t reactor_tid;
+        if (reactor_init(-1, 0) == -1 ||
+            pthread_create(&reactor_tid, NULL, reactor_thread, NULL) != 0) {
+            printf("reactor start error\n");
+            exit(1);
+        }
+    }
 
-    // Open server socket
-    chat_serv_sock_fd = get_server_socket();
+    if (handoff_fd != -1) {
+        restoreState(state, handed + nchat + nadmin, nhanded - nchat - nadmin);
+        free(state);
+        handoff_ack(handoff_fd);
+        close(handoff_fd);
+        resumeInput();
+    }
 
-    // Step 3: get ready to accept connections
-    if (start_server(chat_serv_sock_fd, BACKLOG) == -1) {
-        printf("start server error\n");
+    pthread_t lifecycle_tid;
+    if (pthread_create(&lifecycle_tid, NULL, lifecycle_main, NULL) != 0) {
+        perror("pthread_create lifecycle");
         exit(1);
     }
-   
-    printf("Server Launched! Listening on PORT: %d\n", PORT);
+    pthread_detach(lifecycle_tid);
+
+    if (server_mode == MODE_EPOLL || server_mode == MODE_URING) {
+        reactor_run();
+        close(chat_serv_sock_fd);
+        return 1;
+    }
+
+    if (server_mode == MODE_SHARDED) {
+        reactor_run_shards();
+        close(chat_serv_sock_fd);
+        return 1;
+    }
     
     // Main execution loop
     while (1) {
+        // While stopping, new clients wait in the backlog
+        struct pollfd pfd = { .fd = chat_serv_sock_fd, .events = POLLIN };
+        if (poll(&pfd, 1, -1) == -1 || atomic_load(&server_stopping)) {
+            usleep(10000);
+            continue;
+        }
+
         // Accept a connection, start a thread
         int new_client = accept_client(chat_serv_sock_fd);
         if (new_client != -1) {
-            int *client_socket = malloc(sizeof(int));
-            *client_socket = new_client;
+            // Sends must never block, so the socket is non-blocking
+            fcntl(new_client, F_SETFL, fcntl(new_client, F_GETFL, 0) | O_NONBLOCK);
+            Conn *conn = conn_create(new_client);
+            if (conn == NULL || reactor_add(conn) == -1) {
+                if (conn != NULL) conn_destroy(conn);
+                close(new_client);
+                continue;
+            }
             pthread_t new_client_thread;
-            pthread_create(&new_client_thread, NULL, client_receive, (void *)client_socket);
+            pthread_create(&new_client_thread, NULL, client_receive, (void *)conn);
             pthread_detach(new_client_thread);
         }
     }
@@ -59,7 +330,7 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-int get_server_socket() {
+int get_server_socket(int reuseport) {
     int opt = TRUE;   
     int master_socket;
     struct sockaddr_in address; 
@@ -75,11 +346,17 @@ int get_server_socket() {
         perror("setsockopt");   
         exit(EXIT_FAILURE);   
     }   
+
+    // Let several listeners share the port (sharded mode)
+    if (reuseport && setsockopt(master_socket, SOL_SOCKET, SO_REUSEPORT, (char *)&opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        exit(EXIT_FAILURE);
+    }
      
     // Type of socket created  
     address.sin_family = AF_INET;   
     address.sin_addr.s_addr = INADDR_ANY;   
-    address.sin_port = htons(PORT);   
+    address.sin_port = htons(server_port);   
          
     // Bind the socket to localhost port 8888  
     if (bind(master_socket, (struct sockaddr *)&address, sizeof(address)) < 0) {   
@@ -110,262 +387,758 @@ int accept_client(int serv_sock) {
     return reply_sock_fd;
 }
 
-/* Handle SIGINT (CTRL+C) */
-void sigintHandler(int sig_num) {
+// Open the chat listener(s). Sharded mode gets one per shard on the same
+// port; the kernel spreads incoming connections across them.
+static void openListeners(int shards) {
+    int count = 1;
+    if (server_mode == MODE_SHARDED) {
+        if (shards <= 0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            shards = cpus > 0 ? (int) cpus : 1;
+        }
+        count = shards > MAX_SHARDS ? MAX_SHARDS : shards;
+    }
+
+    listen_fds = (int*) malloc(count * sizeof(int));
+    if (listen_fds == NULL) {
+        perror("malloc failed for listeners");
+        exit(1);
+    }
+
+    // The event loop accepts in bursts, so give it a real backlog
+    int backlog = (server_mode == MODE_THREADS) ? BACKLOG : SOMAXCONN;
+    for (int i = 0; i < count; i++) {
+        listen_fds[i] = get_server_socket(server_mode == MODE_SHARDED);
+        if (start_server(listen_fds[i], backlog) == -1) {
+            printf("start server error\n");
+            exit(1);
+        }
+    }
+    num_listen_fds = count;
+}
+
+/////////////////// LIFECYCLE //////////////////////////
+
+// Signals never run handlers: SIGINT, SIGTERM and SIGUSR2 are blocked in
+// every thread and read from a signalfd by one lifecycle thread, which
+// can then take locks and wait like any other thread.
+//
+// Both a shutdown and a hot restart first stop taking input. Readers
+// check in with beginClientInput() before touching a socket, and
+// server_stopping turns them away; the lifecycle thread then waits for
+// the commands already running. With no command running nothing new is
+// queued, so outbound queues can be drained while the reactors keep
+// flushing.
+
+int beginClientInput(int force) {
+    atomic_fetch_add(&inputs_running, 1);
+    if (!force && atomic_load(&server_stopping)) {
+        atomic_fetch_sub(&inputs_running, 1);
+        return 0;
+    }
+    return 1;
+}
+
+void endClientInput() {
+    atomic_fetch_sub(&inputs_running, 1);
+}
+
+static long deadlineIn(long ms) {
+    return metrics_now_ns() + ms * 1000000L;
+}
+
+// Stop taking input and let running commands finish
+static void holdInput() {
+    long deadline = deadlineIn(SHUTDOWN_DRAIN_MS);
+
+    atomic_store(&server_stopping, 1);
+    reactor_hold();
+    while (atomic_load(&inputs_running) > 0 && metrics_now_ns() < deadline) {
+        usleep(1000);
+    }
+}
+
+// Take input again, including whatever arrived while it was held
+static void resumeInput() {
+    atomic_store(&server_stopping, 0);
+
+    rwlock_read_lock(&rw_lock);
+    for (User *u = user_head; u != NULL; u = u->next) {
+        reactor_rearm(u->conn);
+    }
+    rwlock_read_unlock(&rw_lock);
+    reactor_resume();
+}
+
+// Wait for every client's queued output to be written. Caller holds
+// rw_lock; the reactors flush without it.
+static void drainOutput(long deadline) {
+    while (metrics_now_ns() < deadline) {
+        size_t unsent = 0;
+        for (User *u = user_head; u != NULL; u = u->next) {
+            unsent += conn_unsent(u->conn);
+        }
+        if (unsent == 0) return;
+        usleep(1000);
+    }
+    printf("Output still queued at the deadline, dropping it\n");
+}
+
+static void serverShutdown() {
+    const char *goodbye = "Server is shutting down. Goodbye!\n";
+
     printf("\nShutting down server gracefully...\n");
+    holdInput();
    
     // Acquire write lock for cleanup
-    pthread_mutex_lock(&rw_lock);
+    rwlock_write_lock(&rw_lock);
    
-    // Close all client sockets and notify users
-    User *current = user_head;
-    while (current != NULL) {
-        send(current->socket, "Server is shutting down. Goodbye!\n", 36, 0);
-        close(current->socket);
-        current = current->next;
+    // Notify users, give the goodbyes time to go out, then close
+    for (User *u = user_head; u != NULL; u = u->next) {
+        conn_send(u->conn, goodbye, strlen(goodbye));
+    }
+    drainOutput(deadlineIn(SHUTDOWN_DRAIN_MS));
+    for (User *u = user_head; u != NULL; u = u->next) {
+        conn_shutdown(u->conn);
     }
    
+    // Report pool usage before the pools are released, once the records
+    // retired for lock-free readers are back in them
+    epoch_drain();
+    SlabPool *pools[] = { &user_pool, &room_pool };
+    for (int i = 0; i < 2; i++) {
+        SlabStats st;
+        slab_stats(pools[i], &st);
+        printf("pool %-5s allocs %ld frees %ld live %ld chunks %ld refills %ld\n",
+               st.name, st.allocs, st.frees, st.live, st.chunks, st.refills);
+    }
+   
+    listing_free(&user_listing);
+    listing_free(&room_listing);
+
     // Free all users
     freeAllUsers(&user_head);
+    intmap_free(&users_by_socket);
+    strmap_free(&users_by_name);
+    idtable_free(&user_ids);
    
-    // Free all rooms
+    // Write out pending history, then free all rooms
+    history_shutdown();
     freeAllRooms(&room_head);
+    strmap_free(&rooms_by_name);
+    idtable_free(&room_ids);
    
     // Release write lock
-    pthread_mutex_unlock(&rw_lock);
+    rwlock_write_unlock(&rw_lock);
    
     printf("--------CLOSING ACTIVE USERS--------\n");
    
-    close(chat_serv_sock_fd);
     exit(0);
 }
 
+// Hot restart state, one record per line:
+//   LISTEN <chat listeners> <admin listeners>
+//   ROOM <name>
+//   USER <fd> <name> <input> <partial line or frame in hex, or -> <held input in hex, or ->
+// where <input> is the text parser's discarding flag, 0 or 1, or for a
+// binary protocol client "F" and the bytes of an oversized frame still to
+// skip.
+//   JOIN <user> <room>
+//   DM <user> <user>
+// Users are numbered in USER order. The descriptors go alongside in the
+// same order: listeners first, then one client socket per USER line.
+// Caller holds rw_lock for writing.
+static int serializeState(char **state, size_t *len, int **fds, int *nfds) {
+    FILE *out = open_memstream(state, len);
+    if (out == NULL) return -1;
+
+    int admin_fd = admin_socket();
+    int nusers = 0;
+    for (User *u = user_head; u != NULL; u = u->next) nusers++;
+
+    *fds = (int*) malloc((num_listen_fds + 1 + nusers) * sizeof(int));
+    int *index = (int*) malloc((user_ids.cap + 1) * sizeof(int));
+    if (*fds == NULL || index == NULL) {
+        fclose(out);
+        free(*state);
+        free(*fds);
+        free(index);
+        return -1;
+    }
+    *nfds = 0;
+
+    fprintf(out, "LISTEN %d %d\n", num_listen_fds, admin_fd != -1);
+    for (int i = 0; i < num_listen_fds; i++) {
+        (*fds)[(*nfds)++] = listen_fds[i];
+    }
+    if (admin_fd != -1) {
+        (*fds)[(*nfds)++] = admin_fd;
+    }
+
+    for (Room *room = room_head; room != NULL; room = room->next) {
+        fprintf(out, "ROOM %s\n", room->name);
+    }
+
+    int i = 0;
+    for (User *u = user_head; u != NULL; u = u->next, i++) {
+        LineParser *in = &u->conn->in;
+        index[u->id] = i;
+        (*fds)[(*nfds)++] = u->conn->fd;
+
+        if (in->framed) {
+            fprintf(out, "USER %d %s F%zu ", u->conn->fd, u->username, in->skip);
+        } else {
+            fprintf(out, "USER %d %s %d ", u->conn->fd, u->username, in->discarding);
+        }
+        if (in->len == 0) fputc('-', out);
+        for (size_t b = 0; b < in->len; b++) {
+            fprintf(out, "%02x", (unsigned char) in->carry[b]);
+        }
+        fputc(' ', out);
+        if (u->conn->held_len == 0) fputc('-', out);
+        for (size_t b = 0; b < u->conn->held_len; b++) {
+            fprintf(out, "%02x", (unsigned char) u->conn->held[b]);
+        }
+        fputc('\n', out);
+    }
+
+    i = 0;
+    for (User *u = user_head; u != NULL; u = u->next, i++) {
+        BITSET_FOREACH(roomId, &u->rooms) {
+            Room *room = (Room*) idtable_get(&room_ids, roomId);
+            if (room != NULL) fprintf(out, "JOIN %d %s\n", i, room->name);
+        }
+        // Direct connections go both ways; send each pair once
+        IDLIST_FOREACH(peerId, &u->dmPeers) {
+            if (idtable_get(&user_ids, peerId) != NULL && index[peerId] > i) {
+                fprintf(out, "DM %d %d\n", i, index[peerId]);
+            }
+        }
+    }
+
+    free(index);
+    if (fclose(out) != 0) {
+        free(*state);
+        free(*fds);
+        return -1;
+    }
+    return 0;
+}
+
+// Rebuild the directory from serializeState() and take over the clients
+static void restoreState(char *state, int *fds, int nfds) {
+    int nusers = 0;
+    for (char *p = strstr(state, "\nUSER "); p != NULL; p = strstr(p + 1, "\nUSER ")) nusers++;
+    User **users = (User**) calloc(nusers + 1, sizeof(User*));
+    if (users == NULL) {
+        perror("calloc failed for restore");
+        exit(1);
+    }
+
+    rwlock_write_lock(&rw_lock);
+
+    int count = 0;
+    char *save;
+    for (char *line = strtok_r(state, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        char name[MAX_NAME_LEN];
+        char carry[2 * MAX_LINE_LEN + 2];
+        char input[32];
+        int a, b;
+        int end = 0;
+
+        if (sscanf(line, "ROOM %49s", name) == 1) {
+            if (findRoomByName(name) == NULL) addRoom(name);
+        }
+        else if (sscanf(line, "USER %d %49s %31s %4191s%n", &a, name, input, carry, &end) == 4 && count < nusers && count < nfds) {
+            Conn *conn = conn_create(fds[count]);
+            if (conn == NULL) {
+                close(fds[count++]);
+                continue;
+            }
+
+            // Guest names follow the socket number, which has changed
+            if (strncmp(name, "guest", 5) == 0 && atoi(name + 5) == a) {
+                snprintf(name, sizeof(name), "guest%d", conn->fd);
+            }
+            addUser(conn, name);
+            users[count] = findUserBySocket(conn->fd);
+            client_start_timers(conn);
+
+            // The half-typed command carries on where it left off, in
+            // the protocol the client switched to
+            if (input[0] == 'F') {
+                conn_start_binary(conn, NULL, 0);
+                conn->in.framed = 1;
+                conn->in.skip = strtoul(input + 1, NULL, 10);
+            } else {
+                conn->in.discarding = atoi(input);
+            }
+            size_t half = strcmp(carry, "-") == 0 ? 0 : strlen(carry) / 2;
+            if (half > 0 && (conn->in.carry = (char*) malloc(MAX_LINE_LEN + 1)) != NULL) {
+                for (size_t i = 0; i < half; i++) {
+                    unsigned int byte;
+                    sscanf(carry + 2 * i, "%2x", &byte);
+                    conn->in.carry[i] = (char) byte;
+                }
+                conn->in.len = half;
+            }
+
+            // So does input the old process had read but not yet run
+            char *held = line + end;
+            while (*held == ' ') held++;
+            size_t held_len = (*held == '\0' || *held == '-') ? 0 : strlen(held) / 2;
+            if (held_len > 0 && (conn->held = (char*) malloc(held_len)) != NULL) {
+                for (size_t i = 0; i < held_len; i++) {
+                    unsigned int byte;
+                    sscanf(held + 2 * i, "%2x", &byte);
+                    conn->held[i] = (char) byte;
+                }
+                conn->held_len = held_len;
+            }
+
+            int adopted = server_mode == MODE_THREADS ? reactor_add(conn) : reactor_adopt(conn);
+            if (adopted == 0 && server_mode == MODE_THREADS) {
+                pthread_t tid;
+                adopted = pthread_create(&tid, NULL, client_resume, conn) == 0 ? 0 : -1;
+                if (adopted == 0) pthread_detach(tid);
+            }
+            if (adopted == -1) {
+                printf("hot restart: lost a client\n");
+            }
+            metrics_add(M_CONN_OPENED, 1);
+            count++;
+        }
+        else if (sscanf(line, "JOIN %d %49s", &a, name) == 2 && a >= 0 && a < count && users[a]) {
+            addUserToRoom(users[a]->username, name);
+        }
+        else if (sscanf(line, "DM %d %d", &a, &b) == 2 && a >= 0 && a < count && b >= 0 && b < count &&
+                 users[a] && users[b]) {
+            addDirectConnection(users[a]->username, users[b]->username);
+        }
+    }
+
+    rwlock_write_unlock(&rw_lock);
+    free(users);
+    printf("Hot restart: took over %d client(s)\n", count);
+}
+
+// Hand everything to a new copy of the binary. Returns only on failure,
+// with the server still serving.
+static void serverRestart() {
+    char *state;
+    size_t len;
+    int *fds;
+    int nfds;
+
+    printf("Hot restart: handing over to %s\n", server_argv[0]);
+    holdInput();
+    rwlock_write_lock(&rw_lock);
+
+    // Compressor state cannot be handed over: end every compressed
+    // stream, and those clients carry on in plain text
+    for (User *u = user_head; u != NULL; u = u->next) {
+        conn_stop_compression(u->conn);
+    }
+    drainOutput(deadlineIn(SHUTDOWN_DRAIN_MS));
+    history_flush();
+
+    if (serializeState(&state, &len, &fds, &nfds) == 0) {
+        int sock = handoff_exec(server_argv);
+        if (sock != -1) {
+            if (handoff_send(sock, state, len, fds, nfds) == 0 && handoff_wait(sock) == 0) {
+                // The new process owns every socket now; leave without
+                // touching any of them
+                printf("Hot restart: new process is serving, exiting\n");
+                fflush(stdout);
+                _exit(0);
+            }
+            close(sock);
+        }
+        free(state);
+        free(fds);
+    }
+
+    printf("Hot restart failed, still serving\n");
+    rwlock_write_unlock(&rw_lock);
+    resumeInput();
+}
+
+static void *lifecycle_main(void *arg) {
+    int sfd = signalfd(-1, &lifecycle_signals, SFD_CLOEXEC);
+    if (sfd == -1) {
+        perror("signalfd");
+        return NULL;
+    }
+
+    while (1) {
+        struct signalfd_siginfo info;
+        ssize_t n = read(sfd, &info, sizeof(info));
+        if (n != sizeof(info)) {
+            if (n == -1 && errno == EINTR) continue;
+            perror("read signalfd");
+            return NULL;
+        }
+
+        if (info.ssi_signo == SIGUSR2) {
+            serverRestart();
+        } else {
+            serverShutdown();
+        }
+    }
+    return NULL;
+}
+
 /////////////////////////////////////////////
 // Helper function implementations
 /////////////////////////////////////////////
 
 void addRoom(const char *roomname) {
-    room_head = insertFirstR(room_head, roomname);
+    if (strmap_get(&rooms_by_name, roomname) != NULL) {
+        printf("Duplicate room: %s\n", roomname);
+        return;
+    }
+    Room *head = prependR(room_head, roomname);
+    if (head == room_head) return;   // Allocation failed
+
+    if ((head->id = idtable_add(&room_ids, head)) == -1 ||
+        strmap_put(&rooms_by_name, head->name, head) == -1) {
+        idtable_remove(&room_ids, head->id);
+        room_head = head->next;
+        rwlock_destroy(&head->lock);
+        slab_free(&room_pool, head);
+        return;
+    }
+    // Only a registered room gets a log: logs are never closed before
+    // shutdown, and two for one name would both write its directory.
+    // Nobody can post to the room before joining it, under rw_lock.
+    head->log = history_open(head->name);
+    room_head = head;
+    listing_changed(&room_listing);
 }
 
-void addUser(int socket, const char *username) {
-    user_head = insertFirstU(user_head, socket, (char *)username);
+void addUser(Conn *conn, const char *username) {
+    int socket = conn->fd;
+
+    if (strmap_get(&users_by_name, username) != NULL) {
+        printf("Duplicate username: %s\n", username);
+        return;
+    }
+    User *head = prependU(user_head, socket, username);
+    if (head == user_head) return;   // Allocation failed
+    head->conn = conn;
+
+    if ((head->id = idtable_add(&user_ids, head)) == -1 ||
+        strmap_put(&users_by_name, head->username, head) == -1 ||
+        intmap_put(&users_by_socket, socket, head) == -1) {
+        idtable_remove(&user_ids, head->id);
+        strmap_remove(&users_by_name, head->username);
+        user_head = unlinkU(head, head);
+        return;
+    }
+    user_head = head;
+    conn->user = head;
+    listing_changed(&user_listing);
 }
 
 void addUserToRoom(const char *username, const char *roomname) {
-    Room *room = findR(room_head, roomname);
-    User *user = findU(user_head, (char *)username);
+    Room *room = findRoomByName(roomname);
+    User *user = findUserByName(username);
     
     if (room != NULL && user != NULL) {
-        addUserToR(room, username);
-        addRoomToUser(user, roomname);
+        pthread_mutex_lock(&user->lock);
+        rwlock_write_lock(&room->lock);
+        if (!bitset_test(&room->users, user->id)) {
+            addUserToR(room, user->id);
+            if (bitset_count(&room->users) == 1) cluster_subscribe(room->name, 1);
+        }
+        addRoomToUser(user, room->id);
+        rwlock_write_unlock(&room->lock);
+        pthread_mutex_unlock(&user->lock);
     }
 }
 
 User *findUserBySocket(int socket) {
-    return findUBySocket(user_head, socket);
+    return (User*) intmap_get(&users_by_socket, socket);
 }
 
 Room *findRoomByName(const char *roomname) {
-    return findR(room_head, roomname);
+    return (Room*) strmap_get(&rooms_by_name, roomname);
 }
 
 void removeUserFromRoom(const char *username, const char *roomname) {
-    Room *room = findR(room_head, roomname);
-    User *user = findU(user_head, (char *)username);
+    Room *room = findRoomByName(roomname);
+    User *user = findUserByName(username);
     
-    if (room != NULL) {
-        removeUserFromR(room, username);
+    if (user != NULL) {
+        pthread_mutex_lock(&user->lock);
+    }
+    if (room != NULL && user != NULL) {
+        rwlock_write_lock(&room->lock);
+        if (bitset_test(&room->users, user->id)) {
+            removeUserFromR(room, user->id);
+            if (bitset_count(&room->users) == 0) cluster_subscribe(room->name, 0);
+        }
+        rwlock_write_unlock(&room->lock);
+        removeRoomFromUser(user, room->id);
     }
     if (user != NULL) {
-        removeRoomFromUser(user, roomname);
+        pthread_mutex_unlock(&user->lock);
     }
 }
 
 User *findUserByName(const char *username) {
-    return findU(user_head, (char *)username);
+    return (User*) strmap_get(&users_by_name, username);
+}
+
+// Lock two users in address order; either may be NULL or both the same
+static void lockUserPair(User *a, User *b) {
+    if (a == NULL || b == NULL || a == b) {
+        if (a != NULL) pthread_mutex_lock(&a->lock);
+        else if (b != NULL) pthread_mutex_lock(&b->lock);
+        return;
+    }
+    if (a > b) {
+        User *t = a; a = b; b = t;
+    }
+    pthread_mutex_lock(&a->lock);
+    pthread_mutex_lock(&b->lock);
+}
+
+static void unlockUserPair(User *a, User *b) {
+    if (a != NULL) pthread_mutex_unlock(&a->lock);
+    if (b != NULL && b != a) pthread_mutex_unlock(&b->lock);
 }
 
 void addDirectConnection(const char *fromUser, const char *toUser) {
-    User *from = findU(user_head, (char *)fromUser);
-    User *to = findU(user_head, (char *)toUser);
+    User *from = findUserByName(fromUser);
+    User *to = findUserByName(toUser);
     
     if (from != NULL && to != NULL) {
         // Add bidirectional connection
-        addDirectConn(from, toUser);
-        addDirectConn(to, fromUser);
+        lockUserPair(from, to);
+        addDirectConn(from, to->id);
+        addDirectConn(to, from->id);
+        unlockUserPair(from, to);
     }
 }
 
 void removeDirectConnection(const char *fromUser, const char *toUser) {
-    User *from = findU(user_head, (char *)fromUser);
-    User *to = findU(user_head, (char *)toUser);
+    User *from = findUserByName(fromUser);
+    User *to = findUserByName(toUser);
     
-    if (from != NULL) {
-        removeDirectConn(from, toUser);
-    }
-    if (to != NULL) {
-        removeDirectConn(to, fromUser);
+    if (from != NULL && to != NULL) {
+        lockUserPair(from, to);
+        removeDirectConn(from, to->id);
+        removeDirectConn(to, from->id);
+        unlockUserPair(from, to);
     }
 }
 
-void listAllRooms(int client_socket) {
-    char buffer[MAXBUFF];
-    char temp[MAXBUFF];
-    
-    strcpy(buffer, "Rooms:\n");
-    
-    Room *current = room_head;
-    while (current != NULL) {
-        snprintf(temp, sizeof(temp), "  - %s\n", current->name);
-        strncat(buffer, temp, sizeof(buffer) - strlen(buffer) - 1);
-        current = current->next;
+// Listing rebuilds (see listing.h); only these take rw_lock
+static void fillRooms(ListingBuilder *b) {
+    rwlock_read_lock(&rw_lock);
+    for (Room *current = room_head; current != NULL; current = current->next) {
+        listing_add(b, current->name);
     }
-    
-    strncat(buffer, "chat>", sizeof(buffer) - strlen(buffer) - 1);
-    send(client_socket, buffer, strlen(buffer), 0);
+    rwlock_read_unlock(&rw_lock);
 }
 
-void listAllUsers(int client_socket, int requesting_socket) {
-    char buffer[MAXBUFF];
-    char temp[MAXBUFF];
-    
-    strcpy(buffer, "Users:\n");
-    
-    User *current = user_head;
-    while (current != NULL) {
-        snprintf(temp, sizeof(temp), "  - %s\n", current->username);
-        strncat(buffer, temp, sizeof(buffer) - strlen(buffer) - 1);
-        current = current->next;
+static void fillUsers(ListingBuilder *b) {
+    rwlock_read_lock(&rw_lock);
+    for (User *current = user_head; current != NULL; current = current->next) {
+        listing_add(b, current->username);
     }
-    
-    strncat(buffer, "chat>", sizeof(buffer) - strlen(buffer) - 1);
-    send(client_socket, buffer, strlen(buffer), 0);
+    rwlock_read_unlock(&rw_lock);
 }
 
-void renameUser(int socket, const char *newName) {
-    User *user = findUBySocket(user_head, socket);
-    if (user == NULL) return;
-    
-    char oldName[MAX_NAME_LEN];
-    strncpy(oldName, user->username, MAX_NAME_LEN - 1);
-    oldName[MAX_NAME_LEN - 1] = '\0';
-    
-    // Update username in user struct
-    renameU(user_head, socket, newName);
-    
-    // Update username in all rooms
-    Room *room = room_head;
-    while (room != NULL) {
-        RoomUser *ru = room->users;
-        while (ru != NULL) {
-            if (strcmp(ru->username, oldName) == 0) {
-                strncpy(ru->username, newName, MAX_NAME_LEN - 1);
-                ru->username[MAX_NAME_LEN - 1] = '\0';
-            }
-            ru = ru->next;
-        }
-        room = room->next;
-    }
+// No lock needed: replies come from the cached snapshot
+void listAllRooms(Conn *conn, long offset, long limit) {
+    listing_send(&room_listing, conn, offset, limit);
+}
+
+void listAllUsers(Conn *conn, long offset, long limit) {
+    listing_send(&user_listing, conn, offset, limit);
+}
+
+// Returns -1 if another user already has the name
+int renameUser(int socket, const char *newName) {
+    User *user = findUserBySocket(socket);
+    if (user == NULL) return 0;
+
+    char name[MAX_NAME_LEN];
+    strncpy(name, newName, MAX_NAME_LEN - 1);
+    name[MAX_NAME_LEN - 1] = '\0';
+
+    User *owner = findUserByName(name);
+    if (owner == user) return 0;
+    if (owner != NULL) return -1;
     
-    // Update direct connections of other users
-    User *otherUser = user_head;
-    while (otherUser != NULL) {
-        DirectConn *dc = otherUser->directConns;
-        while (dc != NULL) {
-            if (strcmp(dc->username, oldName) == 0) {
-                strncpy(dc->username, newName, MAX_NAME_LEN - 1);
-                dc->username[MAX_NAME_LEN - 1] = '\0';
-            }
-            dc = dc->next;
-        }
-        otherUser = otherUser->next;
-    }
+    // Rooms and peers refer to the user by id, so only the name index
+    // changes. It points at the username buffer, so take the entry out
+    // while the name is rewritten.
+    strmap_remove(&users_by_name, user->username);
+    strcpy(user->username, name);
+    strmap_put(&users_by_name, user->username, user);
+    listing_changed(&user_listing);
+    return 0;
 }
 
 void removeAllUserConnections(const char *username) {
-    User *user = findU(user_head, (char *)username);
+    User *user = findUserByName(username);
     if (user == NULL) return;
     
     // Remove user from all rooms
-    RoomList *rl = user->rooms;
-    while (rl != NULL) {
-        Room *room = findR(room_head, rl->roomname);
+    BITSET_FOREACH(roomId, &user->rooms) {
+        Room *room = (Room*) idtable_get(&room_ids, roomId);
         if (room != NULL) {
-            removeUserFromR(room, username);
+            removeUserFromR(room, user->id);
+            if (bitset_count(&room->users) == 0) cluster_subscribe(room->name, 0);
         }
-        rl = rl->next;
     }
     
     // Remove all direct connections (bidirectional)
-    DirectConn *dc = user->directConns;
-    while (dc != NULL) {
-        User *otherUser = findU(user_head, dc->username);
+    IDLIST_FOREACH(peerId, &user->dmPeers) {
+        User *otherUser = (User*) idtable_get(&user_ids, peerId);
         if (otherUser != NULL) {
-            removeDirectConn(otherUser, username);
+            removeDirectConn(otherUser, user->id);
         }
-        dc = dc->next;
     }
 }
 
 void removeUser(int socket) {
-    user_head = deleteU(user_head, socket);
+    User *user = findUserBySocket(socket);
+    if (user == NULL) return;
+
+    intmap_remove(&users_by_socket, socket);
+    strmap_remove(&users_by_name, user->username);
+    idtable_remove(&user_ids, user->id);
+    if (user->conn != NULL) user->conn->user = NULL;
+    user_head = unlinkU(user_head, user);
+    listing_changed(&user_listing);
 }
 
-// Send message to all users in same rooms or with direct connections
-void sendMessageToRecipients(User *sender, const char *message) {
-    if (sender == NULL) return;
-    
-    // Track which users we've already sent to (to avoid duplicates)
-    int sentSockets[MAX_USERS];
-    int sentCount = 0;
+// Send message to all users in same rooms or with direct connections,
+// and append `record` to the history of each of the sender's rooms.
+// Called from the sender's own input handler with no lock at all: the
+// memberships and id tables are read through their published copies
+// inside an epoch section (see epoch.h), so logins, joins and
+// disconnects never wait for a broadcast, nor broadcasts for them. A
+// recipient leaving meanwhile may still get this one message; its Conn
+// stays valid until the section is over.
+void sendMessageToRecipients(User *sender, MsgBuf *message,
+                             const char *record, size_t record_len) {
+    if (sender == NULL || message == NULL) return;
+    long start = metrics_now_ns();
+    long delivered = 0;
     
-    // Send to all users in the same rooms
-    RoomList *rl = sender->rooms;
-    while (rl != NULL) {
-        Room *room = findR(room_head, rl->roomname);
-        if (room != NULL) {
-            RoomUser *ru = room->users;
-            while (ru != NULL) {
-                User *recipient = findU(user_head, ru->username);
-                if (recipient != NULL && recipient->socket != sender->socket) {
-                    // Check if we've already sent to this user
-                    int alreadySent = 0;
-                    for (int i = 0; i < sentCount; i++) {
-                        if (sentSockets[i] == recipient->socket) {
-                            alreadySent = 1;
-                            break;
-                        }
-                    }
-                    if (!alreadySent) {
-                        send(recipient->socket, message, strlen(message), 0);
-                        sentSockets[sentCount++] = recipient->socket;
-                    }
+    // OR together every audience the sender reaches. A user in several
+    // shared rooms is still a single bit, so each recipient gets the
+    // message exactly once. A room over its message rate is left out,
+    // so one flooded room does not slow down the others.
+    Bitset recipients = {NULL, 0};
+    const char *rooms[CLUSTER_MAX_ROOMS];
+    int nrooms = 0;
+
+    epoch_enter();
+
+    Bitset *joined = atomic_load_explicit(&sender->publishedRooms, memory_order_acquire);
+    if (joined != NULL) {
+        BITSET_FOREACH(roomId, joined) {
+            Room *room = (Room*) idtable_peek(&room_ids, roomId);
+            if (room != NULL) {
+                if (!ratelimit_take(&room->limit, &rate_room, start)) {
+                    metrics_add(M_LIMITED_ROOM, 1);
+                    continue;
                 }
-                ru = ru->next;
+                Bitset *members = atomic_load_explicit(&room->publishedUsers, memory_order_acquire);
+                if (members != NULL) bitset_or(&recipients, members);
+                history_append(room->log, record, record_len);
+                if (nrooms < CLUSTER_MAX_ROOMS) rooms[nrooms++] = room->name;
             }
         }
-        rl = rl->next;
     }
-    
-    // Send to all direct connections
-    DirectConn *dc = sender->directConns;
-    while (dc != NULL) {
-        User *recipient = findU(user_head, dc->username);
-        if (recipient != NULL && recipient->socket != sender->socket) {
-            // Check if we've already sent to this user
-            int alreadySent = 0;
-            for (int i = 0; i < sentCount; i++) {
-                if (sentSockets[i] == recipient->socket) {
-                    alreadySent = 1;
-                    break;
-                }
-            }
-            if (!alreadySent) {
-                send(recipient->socket, message, strlen(message), 0);
-                sentSockets[sentCount++] = recipient->socket;
-            }
+    Bitset *peers = atomic_load_explicit(&sender->publishedConns, memory_order_acquire);
+    if (peers != NULL) bitset_or(&recipients, peers);
+
+    bitset_clear(&recipients, sender->id);
+    BITSET_FOREACH(userId, &recipients) {
+        User *recipient = (User*) idtable_peek(&user_ids, userId);
+        if (recipient != NULL) {
+            reactor_deliver(recipient->conn, message);
+            delivered++;
         }
-        dc = dc->next;
     }
-}
\ No newline at end of file
+    reactor_deliver_flush(message);
+
+    epoch_exit();
+    bitset_free(&recipients);
+
+    // Members on other servers
+    cluster_publish(rooms, nrooms, record, record_len);
+
+    metrics_add(M_BROADCASTS, 1);
+    metrics_add(M_DELIVERIES, delivered);
+    metrics_record(H_FANOUT, delivered);
+    metrics_record(H_BROADCAST, metrics_now_ns() - start);
+}
+
+// A chat line from another server: deliver it to this server's members
+// of `rooms` and keep it in their history. Rooms unknown here have no
+// members to reach.
+void deliverRemoteMessage(char **rooms, int nrooms, const char *record, size_t len) {
+    MsgBuf *message = msgbuf_printf("\n%.*schat>", (int) len, record);
+    if (message == NULL) return;
+    long delivered = 0;
+
+    Bitset recipients = {NULL, 0};
+
+    rwlock_read_lock(&rw_lock);
+    for (int i = 0; i < nrooms; i++) {
+        Room *room = findRoomByName(rooms[i]);
+        if (room != NULL) {
+            rwlock_read_lock(&room->lock);
+            bitset_or(&recipients, &room->users);
+            rwlock_read_unlock(&room->lock);
+            history_append(room->log, record, len);
+        }
+    }
+
+    BITSET_FOREACH(userId, &recipients) {
+        User *recipient = (User*) idtable_get(&user_ids, userId);
+        if (recipient != NULL) {
+            reactor_deliver(recipient->conn, message);
+            delivered++;
+        }
+    }
+    reactor_deliver_flush(message);
+    rwlock_read_unlock(&rw_lock);
+
+    bitset_free(&recipients);
+    msgbuf_unref(message);
+    metrics_add(M_DELIVERIES, delivered);
+}
+
+// A room created on another server
+void addRemoteRoom(const char *roomname) {
+    rwlock_write_lock(&rw_lock);
+    if (findRoomByName(roomname) == NULL) {
+        addRoom(roomname);
+    }
+    rwlock_write_unlock(&rw_lock);
+}
+
+// (Re)joined the relay: announce every room, and subscribe to those with
+// members here. Each subscription is sent under its room lock, like the
+// membership changes racing with it.
+void clusterResync() {
+    rwlock_read_lock(&rw_lock);
+    for (Room *room = room_head; room != NULL; room = room->next) {
+        cluster_room_created(room->name);
+        rwlock_read_lock(&room->lock);
+        if (bitset_count(&room->users) > 0) {
+            cluster_subscribe(room->name, 1);
+        }
+        rwlock_read_unlock(&room->lock);
+    }
+    rwlock_read_unlock(&rw_lock);
+}
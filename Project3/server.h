@@ -21,14 +21,25 @@
 #include <netdb.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
 
 /* Local Header Files */
 #include "list.h"
+#include "rwlock.h"
+#include "conn.h"
+#include "history.h"
+#include "cluster.h"
 
-#define MAX_READERS 25
 #define TRUE   1  
 #define FALSE  0  
 #define PORT 8888  
+#define HISTORY_DIR "history"   // Room logs, change with -H
+#define ADMIN_PORT 8889         // Loopback stats port, change with -a
+#define SHUTDOWN_DRAIN_MS 2000  // Time given to running commands and queued output
+#define IDLE_TIMEOUT_S 900      // Silence before a client is asked if it is there
+#define IDLE_GRACE_S 60         // Time it then has to answer
 #define max_clients  30
 #define DEFAULT_ROOM "Lobby"
 #define MAXBUFF   2096
@@ -36,41 +47,63 @@
 #define MAX_ROOMS 100
 #define MAX_USERS 100
 #define MAX_DIRECT_CONN 50
-// Could add these macros to server.h
-#define READER_LOCK_ACQUIRE() do { \
-    pthread_mutex_lock(&mutex); \
-    numReaders++; \
-    if (numReaders == 1) pthread_mutex_lock(&rw_lock); \
-    pthread_mutex_unlock(&mutex); \
-} while(0)
 
-#define READER_LOCK_RELEASE() do { \
-    pthread_mutex_lock(&mutex); \
-    numReaders--; \
-    if (numReaders == 0) pthread_mutex_unlock(&rw_lock); \
-    pthread_mutex_unlock(&mutex); \
-} while(0)
+// Server modes
+#define MODE_THREADS 0   // One blocking thread per client (default)
+#define MODE_EPOLL   1   // Edge-triggered epoll reactor + worker pool
+#define MODE_SHARDED 2   // One reactor per core, SO_REUSEPORT listeners
+#define MODE_URING   3   // One io_uring thread, multishot requests
+// Locking rules:
+//  - rw_lock guards the user/room lists and their indexes. Take it for
+//    reading to look anything up, for writing to add, remove or rename
+//    a user or room.
+//  - Room->lock guards a room's member list, User->lock guards a user's
+//    room list and DM list. Both may only be taken while rw_lock is held
+//    for reading; under the write lock nobody else can hold them.
+//  - Order: rw_lock, then User locks (lowest address first when two are
+//    needed), then at most one Room lock.
+//  - Chat broadcasts take none of these. They read the published copies
+//    of the member lists in an epoch section (see list.h and epoch.h);
+//    writers keep taking the locks above.
+
 // External variables - defined in server.c
 extern User *user_head;
 extern Room *room_head;
-extern int numReaders;
-extern pthread_mutex_t rw_lock;
-extern pthread_mutex_t mutex;
+extern RWLock rw_lock;
 extern char const *server_MOTD;
+extern int server_mode;
+extern int server_port;
+extern atomic_int server_stopping;   // Input is held (shutdown or hot restart)
+extern long idle_timeout_ms;         // 0: idle clients are never reaped
+extern long idle_grace_ms;
 
 
 // Server socket functions
-int get_server_socket();
+int get_server_socket(int reuseport);
 int start_server(int serv_socket, int backlog);
 int accept_client(int serv_sock);
-void sigintHandler(int sig_num);
 
 // Client thread function
 void *client_receive(void *ptr);
+void *client_resume(void *ptr);
+char *trimwhitespace(char *str);
+
+// Every read of client input is bracketed by these. beginClientInput()
+// returns 0 while input is held, and the caller must leave the socket
+// alone; `force` counts the caller in regardless.
+int beginClientInput(int force);
+void endClientInput();
+
+// Client handling shared by all server modes
+void client_connected(Conn *conn);
+void client_start_timers(Conn *conn);
+void client_disconnected(Conn *conn);
+int process_command(Conn *conn, char *line, size_t len);
+int client_input(Conn *conn, char *data, size_t n);
 
 // Helper functions for commands
 void addRoom(const char *roomname);
-void addUser(int socket, const char *username);
+void addUser(Conn *conn, const char *username);
 void addUserToRoom(const char *username, const char *roomname);
 User *findUserBySocket(int socket);
 Room *findRoomByName(const char *roomname);
@@ -78,11 +111,18 @@ void removeUserFromRoom(const char *username, const char *roomname);
 User *findUserByName(const char *username);
 void addDirectConnection(const char *fromUser, const char *toUser);
 void removeDirectConnection(const char *fromUser, const char *toUser);
-void listAllRooms(int client_socket);
-void listAllUsers(int client_socket, int requesting_socket);
-void renameUser(int socket, const char *newName);
+// `offset` and `limit` page through the list; limit 0 is the default page
+void listAllRooms(Conn *conn, long offset, long limit);
+void listAllUsers(Conn *conn, long offset, long limit);
+int renameUser(int socket, const char *newName);
 void removeAllUserConnections(const char *username);
 void removeUser(int socket);
-void sendMessageToRecipients(User *sender, const char *message);
+// Cluster hooks, called from the relay connection (cluster.c)
+void addRemoteRoom(const char *roomname);
+void deliverRemoteMessage(char **rooms, int nrooms, const char *record, size_t len);
+void clusterResync();
+
+void sendMessageToRecipients(User *sender, MsgBuf *message,
+                             const char *record, size_t record_len);
 
 #endif
\ No newline at end of file
@@ -3,9 +3,16 @@
 // Utsav Shah
 
 #include "server.h"
+#include "reactor.h"
+#include "metrics.h"
+#include "command.h"
+#include "wire.h"
 
 #define DEFAULT_ROOM "Lobby"
 
+long idle_timeout_ms = IDLE_TIMEOUT_S * 1000L;   // Set with -i
+long idle_grace_ms = IDLE_GRACE_S * 1000L;
+
 char *trimwhitespace(char *str) {
     char *end;
     while (isspace((unsigned char)*str)) str++;
@@ -17,238 +24,592 @@ char *trimwhitespace(char *str) {
     return str;
 }
 
-void *client_receive(void *ptr) {
-    int client = *(int *) ptr;
-    free(ptr);  // Free the allocated socket pointer
-    
-    int received;
-    char buffer[MAXBUFF], sbuffer[MAXBUFF];  
-    char tmpbuf[MAXBUFF];  
-    char cmd[MAXBUFF], username[MAX_NAME_LEN];
-    char *arguments[80];
-    const char *delimiters = " \t\n\r";
-
-    send(client, server_MOTD, strlen(server_MOTD), 0);
+// Greet a freshly accepted client and register it as a guest in the lobby
+void client_connected(Conn *conn) {
+    char username[MAX_NAME_LEN];
+
+    metrics_add(M_CONN_OPENED, 1);
+    conn_send(conn, server_MOTD, strlen(server_MOTD));
 
     // Create a guest username
-    snprintf(username, sizeof(username), "guest%d", client);
+    snprintf(username, sizeof(username), "guest%d", conn->fd);
 
     // Add user with write lock
-    pthread_mutex_lock(&rw_lock);
-    addUser(client, username);
+    rwlock_write_lock(&rw_lock);
+    addUser(conn, username);
     addUserToRoom(username, DEFAULT_ROOM);
-    pthread_mutex_unlock(&rw_lock);
+    rwlock_write_unlock(&rw_lock);
 
-    while (1) {
-        if ((received = read(client, buffer, MAXBUFF - 1)) > 0) {
-            buffer[received] = '\0'; 
-            strcpy(cmd, buffer);  
-            strcpy(sbuffer, buffer);
-
-            // Tokenize
-            arguments[0] = strtok(cmd, delimiters);
-            int i = 0;
-            while (arguments[i] != NULL) {
-                arguments[++i] = strtok(NULL, delimiters);
-                if (arguments[i] != NULL)
-                    arguments[i] = trimwhitespace(arguments[i]);
-            }
+    client_start_timers(conn);
+}
 
-            if (arguments[0] == NULL) {
-                // Empty command
-                snprintf(buffer, sizeof(buffer), "\nchat>");
-                send(client, buffer, strlen(buffer), 0);
-                continue;
-            }
+// Drop every trace of a client. Once this returns no other thread can
+// reach the connection, so the caller may close it.
+void client_disconnected(Conn *conn) {
+    timer_cancel(&conn->idle_timer);
 
-            // Locking strategy:
-            // For commands that read from data: use reader lock
-            // For commands that modify data: use writer lock
+    rwlock_write_lock(&rw_lock);
+    User *u = findUserBySocket(conn->fd);
+    if (u) {
+        removeAllUserConnections(u->username);
+        removeUser(conn->fd);
+    }
+    rwlock_write_unlock(&rw_lock);
+    metrics_add(M_CONN_CLOSED, 1);
+}
 
-            if (strcmp(arguments[0], "create") == 0 && arguments[1] != NULL) {
-                pthread_mutex_lock(&rw_lock);
-                addRoom(arguments[1]);
-                pthread_mutex_unlock(&rw_lock);
+/////////////////// IDLE CLIENTS //////////////////////////
 
-                snprintf(buffer, sizeof(buffer), "Room '%s' created.\nchat>", arguments[1]);
-                send(client, buffer, strlen(buffer), 0);
-            }
-            else if (strcmp(arguments[0], "join") == 0 && arguments[1] != NULL) {
-                pthread_mutex_lock(&rw_lock);
-                User *u = findUserBySocket(client);
-                if (u && findRoomByName(arguments[1])) {
-                    addUserToRoom(u->username, arguments[1]);
-                    snprintf(buffer, sizeof(buffer), "Joined room '%s'.\nchat>", arguments[1]);
-                } else {
-                    snprintf(buffer, sizeof(buffer), "Room '%s' does not exist.\nchat>", arguments[1]);
-                }
-                pthread_mutex_unlock(&rw_lock);
-                send(client, buffer, strlen(buffer), 0);
-            }
-            else if (strcmp(arguments[0], "leave") == 0 && arguments[1] != NULL) {
-                pthread_mutex_lock(&rw_lock);
-                User *u = findUserBySocket(client);
-                if (u) {
-                    removeUserFromRoom(u->username, arguments[1]);
-                    snprintf(buffer, sizeof(buffer), "Left room '%s'.\nchat>", arguments[1]);
-                } else {
-                    snprintf(buffer, sizeof(buffer), "User not found.\nchat>");
-                }
-                pthread_mutex_unlock(&rw_lock);
-                send(client, buffer, strlen(buffer), 0);
-            }
-            else if (strcmp(arguments[0], "connect") == 0 && arguments[1] != NULL) {
-                pthread_mutex_lock(&rw_lock);
-                User *u = findUserBySocket(client);
-                User *target = findUserByName(arguments[1]);
-                if (u && target) {
-                    addDirectConnection(u->username, target->username);
-                    snprintf(buffer, sizeof(buffer), "Connected (DM) with '%s'.\nchat>", target->username);
-                } else {
-                    snprintf(buffer, sizeof(buffer), "User '%s' not found.\nchat>", arguments[1]);
-                }
-                pthread_mutex_unlock(&rw_lock);
-                send(client, buffer, strlen(buffer), 0);
-            }
-            else if (strcmp(arguments[0], "disconnect") == 0 && arguments[1] != NULL) {
-                pthread_mutex_lock(&rw_lock);
-                User *u = findUserBySocket(client);
-                if (u) {
-                    removeDirectConnection(u->username, arguments[1]);
-                    snprintf(buffer, sizeof(buffer), "Disconnected from '%s'.\nchat>", arguments[1]);
-                } else {
-                    snprintf(buffer, sizeof(buffer), "User not found.\nchat>");
-                }
-                pthread_mutex_unlock(&rw_lock);
-                send(client, buffer, strlen(buffer), 0);
-            }
-            else if (strcmp(arguments[0], "rooms") == 0) {
-                // Reader lock for listing
-                pthread_mutex_lock(&mutex);
-                numReaders++;
-                if (numReaders == 1) pthread_mutex_lock(&rw_lock);
-                pthread_mutex_unlock(&mutex);
-
-                // Perform read
-                listAllRooms(client);
-
-                pthread_mutex_lock(&mutex);
-                numReaders--;
-                if (numReaders == 0) pthread_mutex_unlock(&rw_lock);
-                pthread_mutex_unlock(&mutex);
-            }
-            else if (strcmp(arguments[0], "users") == 0) {
-                // Reader lock for listing
-                pthread_mutex_lock(&mutex);
-                numReaders++;
-                if (numReaders == 1) pthread_mutex_lock(&rw_lock);
-                pthread_mutex_unlock(&mutex);
-
-                // Perform read
-                listAllUsers(client, client);
-
-                pthread_mutex_lock(&mutex);
-                numReaders--;
-                if (numReaders == 0) pthread_mutex_unlock(&rw_lock);
-                pthread_mutex_unlock(&mutex);
-            }
-            else if (strcmp(arguments[0], "login") == 0 && arguments[1] != NULL) {
-                pthread_mutex_lock(&rw_lock);
-                renameUser(client, arguments[1]);
-                pthread_mutex_unlock(&rw_lock);
+// A peer that vanished without closing (a dead host, a dropped NAT
+// mapping) never sends EOF, so silence is the only sign. After
+// idle_timeout_ms without input the client is asked whether it is still
+// there; if idle_grace_ms more pass without a word, its socket is shut
+// down and its owner cleans up as if it had left. Reads only store a
+// timestamp: the timer checks it when it goes off instead of being
+// re-armed for every line.
 
-                snprintf(buffer, sizeof(buffer), "Logged in as '%s'.\nchat>", arguments[1]);
-                send(client, buffer, strlen(buffer), 0);
-            }
-            else if (strcmp(arguments[0], "help") == 0) {
-                snprintf(buffer, sizeof(buffer), 
-                    "Commands:\n"
-                    "login <username>\n"
-                    "create <room>\n"
-                    "join <room>\n"
-                    "leave <room>\n"
-                    "users\n"
-                    "rooms\n"
-                    "connect <user>\n"
-                    "disconnect <user>\n"
-                    "exit\n"
-                    "chat>");
-                send(client, buffer, strlen(buffer), 0);
-            }
-            else if (strcmp(arguments[0], "exit") == 0 || strcmp(arguments[0], "logout") == 0) {
-                pthread_mutex_lock(&rw_lock);
-                User *u = findUserBySocket(client);
-                if (u) {
-                    removeAllUserConnections(u->username);
-                    removeUser(client);
-                }
-                pthread_mutex_unlock(&rw_lock);
-                close(client);
-                pthread_exit(NULL);
-            } 
-            else {
-                // Sending a message:
-                // Find the user who sent it
-                pthread_mutex_lock(&mutex);
-                numReaders++;
-                if (numReaders == 1) pthread_mutex_lock(&rw_lock);
-                pthread_mutex_unlock(&mutex);
-
-                User *sender = findUserBySocket(client);
-
-                if (sender == NULL) {
-                    pthread_mutex_lock(&mutex);
-                    numReaders--;
-                    if (numReaders == 0) pthread_mutex_unlock(&rw_lock);
-                    pthread_mutex_unlock(&mutex);
-                    
-                    snprintf(tmpbuf, sizeof(tmpbuf), "\nchat>");
-                    send(client, tmpbuf, strlen(tmpbuf), 0);
-                    continue;
-                }
-
-                // Format the message
-                snprintf(tmpbuf, sizeof(tmpbuf), "\n::%s> %s\nchat>", sender->username, trimwhitespace(sbuffer));
-                
-                // Send message to all recipients (room members and DM connections)
-                sendMessageToRecipients(sender, tmpbuf);
-                
-                // Also send back to sender as confirmation
-                send(client, tmpbuf, strlen(tmpbuf), 0);
-
-                pthread_mutex_lock(&mutex);
-                numReaders--;
-                if (numReaders == 0) pthread_mutex_unlock(&rw_lock);
-                pthread_mutex_unlock(&mutex);
-            }
+static long idle_check(Timer *t, long now) {
+    Conn *conn = (Conn*) t->arg;
+    long last = atomic_load_explicit(&conn->last_input, memory_order_relaxed);
+
+    if (now - last < idle_timeout_ms * 1000000L) {
+        conn->idle_pinged = 0;
+        return last + idle_timeout_ms * 1000000L;
+    }
+
+    char text[160];
+    int len;
+    if (!conn->idle_pinged) {
+        conn->idle_pinged = 1;
+        len = snprintf(text, sizeof(text),
+                       "\nStill there? Send anything within %ld seconds to stay connected.\nchat>",
+                       idle_grace_ms / 1000);
+        conn_send(conn, text, len);
+        metrics_add(M_IDLE_PINGS, 1);
+        return now + idle_grace_ms * 1000000L;
+    }
+
+    len = snprintf(text, sizeof(text), "\nDisconnected after %ld seconds of silence. Goodbye!\n",
+                   (now - last) / 1000000000L);
+    conn_send(conn, text, len);
+    shutdown(conn->fd, SHUT_RDWR);   // Owner sees EOF and cleans up
+    metrics_add(M_IDLE_CLOSED, 1);
+    return 0;
+}
+
+// Start watching a registered client for silence
+void client_start_timers(Conn *conn) {
+    long now = metrics_now_ns();
+
+    atomic_store(&conn->last_input, now);
+    conn->idle_pinged = 0;
+    timer_init(&conn->idle_timer, idle_check, conn);
+    if (idle_timeout_ms > 0) {
+        timer_arm(&conn->idle_timer, now + idle_timeout_ms * 1000000L);
+    }
+}
+
+/////////////////// COMMAND HANDLERS //////////////////////////
+
+// One handler per CommandId. Arguments arrive NUL terminated in
+// cmd->args, already checked against the command's minimum count.
+// Handlers return -1 when the client asked to leave, 0 otherwise.
+//
+// Locking strategy:
+// For commands that only read the directory or change membership of
+// one room or user pair: use reader lock (the helpers take the
+// per-room / per-user locks themselves)
+// For commands that add, remove or rename users or rooms: use writer lock
+
+typedef int (*command_handler)(Conn *conn, Command *cmd);
+
+// Answer the command being run: the printf-formatted text for a text
+// client, `status` and `subject` (may be NULL) in a REPLY frame tagged
+// like the request for a binary one (see wire.h)
+static void sendReply(Conn *conn, int status, const char *subject, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void sendReply(Conn *conn, int status, const char *subject, const char *fmt, ...) {
+    if (conn->binary) {
+        MsgBuf *frame = wire_reply(conn->wire_tag, status, subject);
+        conn_send_buf(conn, frame);
+        msgbuf_unref(frame);
+        return;
+    }
+
+    char buffer[MAXBUFF];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    if (len >= (int) sizeof(buffer)) len = sizeof(buffer) - 1;
+    if (len > 0) conn_send(conn, buffer, len);
+}
+
+// Commands that take rw_lock for writing stall every other client, so
+// they get their own, much lower rate
+static int writeAllowed(Conn *conn) {
+    if (ratelimit_take(&conn->write_limit, &rate_writes, metrics_now_ns())) return 1;
+
+    metrics_add(M_LIMITED_WRITES, 1);
+    sendReply(conn, WIRE_LIMITED, NULL, "Too many changes, try again in a moment.\nchat>");
+    return 0;
+}
+
+static int cmd_empty(Conn *conn, Command *cmd) {
+    sendReply(conn, WIRE_OK, NULL, "\nchat>");
+    return 0;
+}
+
+static int cmd_create(Conn *conn, Command *cmd) {
+    const char *room = cmd->args[0].ptr;
+
+    if (!writeAllowed(conn)) return 0;
+
+    rwlock_write_lock(&rw_lock);
+    addRoom(room);
+    cluster_room_created(room);
+    rwlock_write_unlock(&rw_lock);
+
+    sendReply(conn, WIRE_OK, room, "Room '%s' created.\nchat>", room);
+    return 0;
+}
+
+static int cmd_join(Conn *conn, Command *cmd) {
+    const char *room = cmd->args[0].ptr;
+
+    rwlock_read_lock(&rw_lock);
+    User *u = findUserBySocket(conn->fd);
+    int found = u && findRoomByName(room);
+    if (found) addUserToRoom(u->username, room);
+    rwlock_read_unlock(&rw_lock);
+
+    if (found) {
+        sendReply(conn, WIRE_OK, room, "Joined room '%s'.\nchat>", room);
+    } else {
+        sendReply(conn, WIRE_NOT_FOUND, room, "Room '%s' does not exist.\nchat>", room);
+    }
+    return 0;
+}
+
+static int cmd_leave(Conn *conn, Command *cmd) {
+    const char *room = cmd->args[0].ptr;
+
+    rwlock_read_lock(&rw_lock);
+    User *u = findUserBySocket(conn->fd);
+    if (u) removeUserFromRoom(u->username, room);
+    rwlock_read_unlock(&rw_lock);
+
+    if (u) {
+        sendReply(conn, WIRE_OK, room, "Left room '%s'.\nchat>", room);
+    } else {
+        sendReply(conn, WIRE_NOT_FOUND, NULL, "User not found.\nchat>");
+    }
+    return 0;
+}
+
+static int cmd_connect(Conn *conn, Command *cmd) {
+    const char *name = cmd->args[0].ptr;
+
+    char peer[MAX_NAME_LEN] = "";
+
+    rwlock_read_lock(&rw_lock);
+    User *u = findUserBySocket(conn->fd);
+    User *target = findUserByName(name);
+    if (u && target) {
+        addDirectConnection(u->username, target->username);
+        snprintf(peer, sizeof(peer), "%s", target->username);
+    }
+    rwlock_read_unlock(&rw_lock);
+
+    if (peer[0] != '\0') {
+        sendReply(conn, WIRE_OK, peer, "Connected (DM) with '%s'.\nchat>", peer);
+    } else {
+        sendReply(conn, WIRE_NOT_FOUND, name, "User '%s' not found.\nchat>", name);
+    }
+    return 0;
+}
+
+static int cmd_disconnect(Conn *conn, Command *cmd) {
+    const char *name = cmd->args[0].ptr;
+
+    rwlock_read_lock(&rw_lock);
+    User *u = findUserBySocket(conn->fd);
+    if (u) removeDirectConnection(u->username, name);
+    rwlock_read_unlock(&rw_lock);
+
+    if (u) {
+        sendReply(conn, WIRE_OK, name, "Disconnected from '%s'.\nchat>", name);
+    } else {
+        sendReply(conn, WIRE_NOT_FOUND, NULL, "User not found.\nchat>");
+    }
+    return 0;
+}
+
+// "msg <user> <text>": a chat line for one DM peer only. The peer is
+// found by name in the hash index and the DM checked in its bitset, so
+// the cost does not depend on room sizes; rooms are not involved at all
+// and nothing goes to history or the cluster.
+static int cmd_msg(Conn *conn, Command *cmd) {
+    const char *name = cmd->args[0].ptr;
+
+    rwlock_read_lock(&rw_lock);
+    User *sender = findUserBySocket(conn->fd);
+    User *target = findUserByName(name);
+    int connected = 0;
+    if (sender && target) {
+        pthread_mutex_lock(&sender->lock);
+        connected = findDirectConn(sender, target->id);
+        pthread_mutex_unlock(&sender->lock);
+    }
+
+    if (!connected) {
+        rwlock_read_unlock(&rw_lock);
+        if (target == NULL) {
+            sendReply(conn, WIRE_NOT_FOUND, name, "User '%s' not found.\nchat>", name);
+        } else {
+            sendReply(conn, WIRE_NOT_CONNECTED, name, "Not connected with '%s'; use: connect %s\nchat>", name, name);
+        }
+        return 0;
+    }
+
+    MsgBuf *msg = msgbuf_printf("\n::%s [dm]> %s\nchat>", sender->username, cmd->args[1].ptr);
+    if (msg != NULL && atomic_load_explicit(&conn_binary_count, memory_order_relaxed) > 0) {
+        msg->frame = wire_chat(1, sender->id, sender->username, cmd->args[1].ptr, cmd->args[1].len);
+    }
+    if (msg != NULL) {
+        if (target != sender) {
+            reactor_deliver(target->conn, msg);
+            reactor_deliver_flush(msg);
+            metrics_add(M_DELIVERIES, 1);
+        }
+        metrics_add(M_DIRECT_MESSAGES, 1);
+    }
+    rwlock_read_unlock(&rw_lock);
 
-            memset(buffer, 0, sizeof(buffer));
-        } 
-        else if (received == 0) {
-            // Client disconnected
-            pthread_mutex_lock(&rw_lock);
-            User *u = findUserBySocket(client);
-            if (u) {
-                removeAllUserConnections(u->username);
-                removeUser(client);
+    // Echoed back like any chat line; a binary client gets its reply instead
+    if (conn->binary) {
+        sendReply(conn, msg != NULL ? WIRE_OK : WIRE_UNAVAILABLE, name, "\nchat>");
+    } else {
+        conn_send_buf(conn, msg);
+    }
+    msgbuf_unref(msg);
+    return 0;
+}
+
+// "rooms [offset] [limit]", "users [offset] [limit]". Listings come
+// from a cached snapshot and need no lock here.
+static int cmd_rooms(Conn *conn, Command *cmd) {
+    long offset = cmd->argc > 0 ? atol(cmd->args[0].ptr) : 0;
+    long limit = cmd->argc > 1 ? atol(cmd->args[1].ptr) : 0;
+    listAllRooms(conn, offset, limit);
+    return 0;
+}
+
+static int cmd_users(Conn *conn, Command *cmd) {
+    long offset = cmd->argc > 0 ? atol(cmd->args[0].ptr) : 0;
+    long limit = cmd->argc > 1 ? atol(cmd->args[1].ptr) : 0;
+    listAllUsers(conn, offset, limit);
+    return 0;
+}
+
+static int cmd_login(Conn *conn, Command *cmd) {
+    const char *name = cmd->args[0].ptr;
+
+    if (!writeAllowed(conn)) return 0;
+
+    rwlock_write_lock(&rw_lock);
+    int status = renameUser(conn->fd, name);
+    rwlock_write_unlock(&rw_lock);
+
+    if (status == -1) {
+        sendReply(conn, WIRE_TAKEN, name, "Username '%s' is already taken.\nchat>", name);
+    } else {
+        sendReply(conn, WIRE_OK, name, "Logged in as '%s'.\nchat>", name);
+    }
+    return 0;
+}
+
+static int cmd_history(Conn *conn, Command *cmd) {
+    const char *name = cmd->args[0].ptr;
+
+    // The count may be a u32 from a binary client; anything out of range,
+    // or not a number, means as many as there are
+    int lines = HISTORY_DEFAULT_LINES;
+    if (cmd->argc > 1) {
+        const char *arg = cmd->args[1].ptr;
+        char *end;
+        errno = 0;
+        unsigned long count = strtoul(arg, &end, 10);
+        int valid = errno == 0 && end != arg && *end == '\0' && arg[0] != '-';
+        lines = valid && count > 0 && count <= HISTORY_MAX_LINES ? (int) count : HISTORY_MAX_LINES;
+    }
+
+    // Rooms and their logs last as long as the server, so the reply can
+    // go out without rw_lock: a slow client must not hold up writers
+    rwlock_read_lock(&rw_lock);
+    Room *room = findRoomByName(name);
+    RoomLog *log = room != NULL ? room->log : NULL;
+    rwlock_read_unlock(&rw_lock);
+
+    if (room == NULL) {
+        sendReply(conn, WIRE_NOT_FOUND, name, "Room '%s' does not exist.\nchat>", name);
+    } else if (log == NULL) {
+        sendReply(conn, WIRE_UNAVAILABLE, name, "History is disabled.\nchat>");
+    } else {
+        history_send_tail(log, conn, name, lines);
+    }
+    return 0;
+}
+
+static int cmd_help(Conn *conn, Command *cmd) {
+    static const char help[] =
+        "Commands:\n"
+        "login <username>\n"
+        "create <room>\n"
+        "join <room>\n"
+        "leave <room>\n"
+        "history <room> [n]\n"
+        "users [offset] [limit]\n"
+        "rooms [offset] [limit]\n"
+        "connect <user>\n"
+        "disconnect <user>\n"
+        "msg <user> <text>\n"
+        "compress [off]\n"
+        "binary [version]\n"
+        "exit\n";
+    sendReply(conn, WIRE_OK, help, "%schat>", help);
+    return 0;
+}
+
+static int cmd_exit(Conn *conn, Command *cmd) {
+    return -1;
+}
+
+// "compress [on|off]": see compress.h for what the client gets
+static int cmd_compress(Conn *conn, Command *cmd) {
+    static const char on[] = "Compression on.\nchat>";
+    static const char off[] = "Compression off.\nchat>";
+    static const char failed[] = "Compression is not available.\nchat>";
+
+    if (cmd->argc > 0 && strcmp(cmd->args[0].ptr, "off") == 0) {
+        conn_stop_compression(conn);
+        sendReply(conn, WIRE_OK, "off", "%s", off);
+    } else if (conn_compressed(conn)) {
+        sendReply(conn, WIRE_OK, "on", "%s", on);
+    } else {
+        // The reply is the last thing sent uncompressed, in whichever
+        // protocol the client speaks
+        MsgBuf *reply = conn->binary ? wire_reply(conn->wire_tag, WIRE_OK, "on")
+                                     : msgbuf_new(on, sizeof(on) - 1);
+        if (reply == NULL || conn_start_compression(conn, reply->data, reply->len) == -1) {
+            sendReply(conn, WIRE_UNAVAILABLE, NULL, "%s", failed);
+        }
+        msgbuf_unref(reply);
+    }
+    return 0;
+}
+
+// "binary [version]": switch to the binary protocol (see wire.h). The
+// acknowledgement is the last text line; whatever follows it in the same
+// read is already taken as frames.
+static int cmd_binary(Conn *conn, Command *cmd) {
+    static const char on[] = "Binary protocol on.\n";
+    int version = cmd->argc > 0 ? atoi(cmd->args[0].ptr) : WIRE_VERSION;
+
+    if (conn->binary) {
+        sendReply(conn, WIRE_OK, NULL, "\nchat>");
+    } else if (version != WIRE_VERSION) {
+        sendReply(conn, WIRE_BAD_REQUEST, NULL,
+                  "Binary protocol version %d is not supported (use %d).\nchat>", version, WIRE_VERSION);
+    } else if (conn_start_binary(conn, on, sizeof(on) - 1) == 0) {
+        conn->in.framed = 1;
+    }
+    return 0;
+}
+
+// Anything that is not a command is a chat message. The line was left
+// untouched by command_parse(). No lock: the sender is this client's own
+// user, which only this handler's thread renames or removes, and the
+// recipients are found as sendMessageToRecipients() describes.
+static int cmd_message(Conn *conn, char *line) {
+    User *sender = conn->user;
+
+    if (sender == NULL) {
+        sendReply(conn, WIRE_NOT_FOUND, NULL, "\nchat>");
+        return 0;
+    }
+
+    // Format the message once; every recipient queues the same buffer.
+    // Binary clients get the same line as a CHAT frame, built alongside
+    // only while there are any.
+    char *text = trimwhitespace(line);
+    MsgBuf *msg = msgbuf_printf("\n::%s> %s\nchat>", sender->username, text);
+    if (msg != NULL && atomic_load_explicit(&conn_binary_count, memory_order_relaxed) > 0) {
+        msg->frame = wire_chat(0, sender->id, sender->username, text, strlen(text));
+    }
+
+    // Send message to all recipients (room members and DM connections).
+    // Room history keeps the chat line itself, without the leading
+    // newline and the prompt.
+    if (msg != NULL) {
+        sendMessageToRecipients(sender, msg, msg->data + 1, msg->len - 1 - strlen("chat>"));
+    }
+
+    // Also send back to sender as confirmation; a binary client gets its
+    // reply instead
+    if (conn->binary) {
+        sendReply(conn, msg != NULL ? WIRE_OK : WIRE_UNAVAILABLE, NULL, "\nchat>");
+    } else {
+        conn_send_buf(conn, msg);
+    }
+    msgbuf_unref(msg);
+    return 0;
+}
+
+static const command_handler handlers[CMD_COUNT] = {
+    [CMD_EMPTY] = cmd_empty,
+    [CMD_CREATE] = cmd_create,
+    [CMD_JOIN] = cmd_join,
+    [CMD_LEAVE] = cmd_leave,
+    [CMD_CONNECT] = cmd_connect,
+    [CMD_DISCONNECT] = cmd_disconnect,
+    [CMD_ROOMS] = cmd_rooms,
+    [CMD_USERS] = cmd_users,
+    [CMD_LOGIN] = cmd_login,
+    [CMD_HISTORY] = cmd_history,
+    [CMD_HELP] = cmd_help,
+    [CMD_EXIT] = cmd_exit,
+    [CMD_COMPRESS] = cmd_compress,
+    [CMD_MSG] = cmd_msg,
+    [CMD_BINARY] = cmd_binary,
+};
+
+// Handle one command line from a client. `line` is NUL terminated and
+// writable; command arguments are cut in place instead of being copied.
+// Returns -1 when the client asked to leave, 0 otherwise.
+int process_command(Conn *conn, char *line, size_t len) {
+    Command cmd;
+
+    conn->wire_tag = 0;
+    if (command_parse(line, len, &cmd) == CMD_MESSAGE) {
+        return cmd_message(conn, line);
+    }
+    return handlers[cmd.id](conn, &cmd);
+}
+
+// The same for one complete request frame from a binary client: its
+// arguments are copied out, then it runs like the command it stands for
+static int processFrame(Conn *conn, const char *frame, size_t len) {
+    WireRequest req;
+
+    conn->wire_tag = wire_tag(frame);
+    if (wire_decode(frame, len, &req) == -1) {
+        metrics_add(M_BAD_FRAMES, 1);
+        sendReply(conn, WIRE_BAD_REQUEST, NULL, "\nchat>");
+        return 0;
+    }
+    if (req.cmd.id == CMD_MESSAGE) {
+        return cmd_message(conn, req.cmd.args[0].ptr);
+    }
+    return handlers[req.cmd.id](conn, &req.cmd);
+}
+
+// Parser callback: one complete line, or frame once the client switched
+// to the binary protocol
+static int handle_line(void *arg, char *line, size_t len) {
+    Conn *conn = (Conn *) arg;
+    int framed = conn->in.framed;
+
+    if (line == NULL || (framed && len > WIRE_MAX_FRAME)) {
+        metrics_add(M_OVERSIZED_LINES, 1);
+        conn->wire_tag = framed ? wire_tag(line) : 0;
+        sendReply(conn, WIRE_TOO_LONG, NULL, "Line too long (max %d bytes).\nchat>", MAX_LINE_LEN);
+        return 0;
+    }
+    metrics_add(framed ? M_FRAMES_IN : M_LINES_IN, 1);
+
+    // With a line rate set (-r, off by default) a line over it is dropped
+    // unread. The client hears about it once per flood, not once per line.
+    // Messages and create/login have their own limits either way, and are
+    // all a binary client is held to: it negotiated the protocol to drive
+    // thousands of requests a second.
+    if (!framed && !ratelimit_take(&conn->line_limit, &rate_lines, metrics_now_ns())) {
+        metrics_add(M_LIMITED_LINES, 1);
+        if (!conn->throttled) {
+            conn->throttled = 1;
+            static const char slow[] = "Too many messages, slow down.\nchat>";
+            conn_send(conn, slow, sizeof(slow) - 1);
+        }
+        return 0;
+    }
+    conn->throttled = 0;
+    return framed ? processFrame(conn, line, len) : process_command(conn, line, len);
+}
+
+// Run every complete command in `n` freshly read bytes. `data` must be
+// where parser_space() said to read. Returns -1 when the client left.
+int client_input(Conn *conn, char *data, size_t n) {
+    atomic_store_explicit(&conn->last_input, metrics_now_ns(), memory_order_relaxed);
+    metrics_add(M_BYTES_IN, n);
+    return parser_feed(&conn->in, data, n, handle_line, conn);
+}
+
+// Thread-per-client mode: read and run commands until the client leaves.
+// The socket is non-blocking so replies can be queued, so wait in poll()
+// between reads.
+static void client_loop(Conn *conn) {
+    int client = conn->fd;
+
+    ssize_t received;
+    char scratch[PARSER_SCRATCH];
+
+    while (1) {
+        size_t room;
+        char *space = parser_space(&conn->in, scratch, &room);
+
+        // Hold off while the server is stopping or handing over
+        if (!beginClientInput(0)) {
+            usleep(10000);
+            continue;
+        }
+
+        if ((received = read(client, space, room)) > 0) {
+            if (client_input(conn, space, received) == -1) {
+                break;
             }
-            pthread_mutex_unlock(&rw_lock);
-            close(client);
-            pthread_exit(NULL);
+        }
+        else if (received == -1 && (errno == EAGAIN || errno == EINTR)) {
+            endClientInput();
+            struct pollfd pfd = { .fd = client, .events = POLLIN };
+            poll(&pfd, 1, -1);
+            continue;
         }
         else {
-            // Error reading
-            pthread_mutex_lock(&rw_lock);
-            User *u = findUserBySocket(client);
-            if (u) {
-                removeAllUserConnections(u->username);
-                removeUser(client);
-            }
-            pthread_mutex_unlock(&rw_lock);
-            close(client);
-            pthread_exit(NULL);
+            // Client disconnected (0) or error reading (-1)
+            break;
         }
+        endClientInput();
     }
 
+    client_disconnected(conn);
+    endClientInput();
+    reactor_close(conn);
+}
+
+void *client_receive(void *ptr) {
+    Conn *conn = (Conn *) ptr;
+
+    beginClientInput(1);
+    client_connected(conn);
+    endClientInput();
+
+    client_loop(conn);
     return NULL;
-}
\ No newline at end of file
+}
+
+// A client handed over by the previous process on a hot restart
+void *client_resume(void *ptr) {
+    client_loop((Conn *) ptr);
+    return NULL;
+}
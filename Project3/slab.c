@@ -0,0 +1,257 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "slab.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SLAB_ALIGN 16
+#define CHUNK_HEADER SLAB_ALIGN   // SlabChunk, padded so objects stay aligned
+#define NO_SLOT -2                // Every cache slot was already taken
+
+// A free object's first word links it to the next free object
+#define NEXT_FREE(obj) (*(void**) (obj))
+
+// Per-thread stash of free objects for one pool
+typedef struct SlabCache {
+    void *head;
+    int count;
+    int batch;                 // Next refill size, grows to SLAB_CACHE_BATCH
+    unsigned generation;       // Pool generation the objects belong to
+} SlabCache;
+
+static SlabPool *slab_pools[SLAB_MAX_POOLS];
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static int num_slots = 0;
+
+static __thread SlabCache slab_caches[SLAB_MAX_POOLS];
+static __thread int cache_registered = 0;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static size_t slab_stride(const SlabPool *pool) {
+    size_t size = pool->size < sizeof(void*) ? sizeof(void*) : pool->size;
+    return (size + SLAB_ALIGN - 1) & ~(size_t) (SLAB_ALIGN - 1);
+}
+
+/////////////////// SHARED FREE LIST //////////////////////////
+
+// Carve a new chunk into free objects. Caller holds pool->lock.
+static int grow_locked(SlabPool *pool) {
+    size_t stride = slab_stride(pool);
+    SlabChunk *chunk = (SlabChunk*) malloc(CHUNK_HEADER + SLAB_CHUNK_OBJS * stride);
+    if (chunk == NULL) {
+        perror("malloc failed for slab chunk");
+        return -1;
+    }
+    chunk->next = pool->chunk_list;
+    pool->chunk_list = chunk;
+
+    char *base = (char*) chunk + CHUNK_HEADER;
+    for (int i = SLAB_CHUNK_OBJS - 1; i >= 0; i--) {
+        void *obj = base + i * stride;
+        NEXT_FREE(obj) = pool->free_list;
+        pool->free_list = obj;
+    }
+    pool->nfree += SLAB_CHUNK_OBJS;
+    atomic_fetch_add_explicit(&pool->chunks, 1, memory_order_relaxed);
+    return 0;
+}
+
+static void *take_locked(SlabPool *pool) {
+    if (pool->free_list == NULL && grow_locked(pool) == -1) {
+        return NULL;
+    }
+    void *obj = pool->free_list;
+    pool->free_list = NEXT_FREE(obj);
+    pool->nfree--;
+    return obj;
+}
+
+// Hand a linked run of `count` objects back to the pool
+static void give_back(SlabPool *pool, void *head, void *tail, int count, unsigned generation) {
+    pthread_mutex_lock(&pool->lock);
+    if (atomic_load(&pool->generation) == generation) {
+        NEXT_FREE(tail) = pool->free_list;
+        pool->free_list = head;
+        pool->nfree += count;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/////////////////// THREAD CACHES //////////////////////////
+
+// Runs when a thread that used a cache exits
+static void flush_caches(void *unused) {
+    (void) unused;
+
+    pthread_mutex_lock(&registry_lock);
+    int slots = num_slots;
+    pthread_mutex_unlock(&registry_lock);
+
+    for (int i = 0; i < slots; i++) {
+        SlabCache *c = &slab_caches[i];
+        if (c->head == NULL) continue;
+
+        void *tail = c->head;
+        while (NEXT_FREE(tail) != NULL) tail = NEXT_FREE(tail);
+        give_back(slab_pools[i], c->head, tail, c->count, c->generation);
+        c->head = NULL;
+        c->count = 0;
+    }
+}
+
+static void make_cache_key() {
+    pthread_key_create(&cache_key, flush_caches);
+}
+
+static int pool_slot(SlabPool *pool) {
+    int slot = atomic_load_explicit(&pool->slot, memory_order_acquire);
+    if (slot != -1) return slot;
+
+    pthread_mutex_lock(&registry_lock);
+    slot = atomic_load(&pool->slot);
+    if (slot == -1) {
+        if (num_slots < SLAB_MAX_POOLS) {
+            slot = num_slots++;
+            slab_pools[slot] = pool;
+        } else {
+            slot = NO_SLOT;
+        }
+        atomic_store_explicit(&pool->slot, slot, memory_order_release);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return slot;
+}
+
+// This thread's cache for the pool, or NULL if the pool has none
+static SlabCache *cache_for(SlabPool *pool) {
+    int slot = pool_slot(pool);
+    if (slot < 0) return NULL;
+
+    if (!cache_registered) {
+        pthread_once(&cache_once, make_cache_key);
+        pthread_setspecific(cache_key, &cache_registered);
+        cache_registered = 1;
+    }
+
+    SlabCache *c = &slab_caches[slot];
+    unsigned generation = atomic_load(&pool->generation);
+    if (c->generation != generation) {
+        // The pool was released; whatever we held is gone
+        c->head = NULL;
+        c->count = 0;
+        c->generation = generation;
+    }
+    return c;
+}
+
+// Threads start with single-object refills and double up from there, so
+// the thread-per-client server does not strand a batch in every client
+// thread that only ever allocates its own User.
+static int refill(SlabPool *pool, SlabCache *c) {
+    if (c->batch < SLAB_CACHE_BATCH) {
+        c->batch = c->batch ? c->batch * 2 : 1;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < c->batch; i++) {
+        void *obj = take_locked(pool);
+        if (obj == NULL) break;
+        NEXT_FREE(obj) = c->head;
+        c->head = obj;
+        c->count++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    atomic_fetch_add_explicit(&pool->refills, 1, memory_order_relaxed);
+    return c->head != NULL ? 0 : -1;
+}
+
+/////////////////// POOL API //////////////////////////
+
+void *slab_alloc(SlabPool *pool) {
+    SlabCache *c = cache_for(pool);
+    void *obj;
+
+    if (c == NULL) {
+        pthread_mutex_lock(&pool->lock);
+        obj = take_locked(pool);
+        pthread_mutex_unlock(&pool->lock);
+        if (obj == NULL) return NULL;
+    } else {
+        if (c->head == NULL && refill(pool, c) == -1) return NULL;
+        obj = c->head;
+        c->head = NEXT_FREE(obj);
+        c->count--;
+    }
+
+    atomic_fetch_add_explicit(&pool->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->live, 1, memory_order_relaxed);
+    return obj;
+}
+
+void slab_free(SlabPool *pool, void *obj) {
+    if (obj == NULL) return;
+
+    atomic_fetch_add_explicit(&pool->frees, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&pool->live, 1, memory_order_relaxed);
+
+    SlabCache *c = cache_for(pool);
+    if (c == NULL) {
+        pthread_mutex_lock(&pool->lock);
+        NEXT_FREE(obj) = pool->free_list;
+        pool->free_list = obj;
+        pool->nfree++;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    NEXT_FREE(obj) = c->head;
+    c->head = obj;
+    c->count++;
+
+    // A thread that mostly frees (one worker greets a client, another
+    // sees it hang up) must not pile the pool up in its own cache
+    if (c->count > SLAB_CACHE_MAX) {
+        void *head = c->head;
+        void *tail = head;
+        for (int i = 1; i < SLAB_CACHE_BATCH; i++) tail = NEXT_FREE(tail);
+        c->head = NEXT_FREE(tail);
+        c->count -= SLAB_CACHE_BATCH;
+        give_back(pool, head, tail, SLAB_CACHE_BATCH, c->generation);
+    }
+}
+
+void slab_release(SlabPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    SlabChunk *chunk = pool->chunk_list;
+    while (chunk != NULL) {
+        SlabChunk *temp = chunk;
+        chunk = chunk->next;
+        free(temp);
+    }
+    pool->chunk_list = NULL;
+    pool->free_list = NULL;
+    pool->nfree = 0;
+    atomic_store(&pool->chunks, 0);
+    atomic_store(&pool->live, 0);
+    atomic_fetch_add(&pool->generation, 1);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void slab_stats(SlabPool *pool, SlabStats *out) {
+    out->name = pool->name;
+    out->size = pool->size;
+    out->allocs = atomic_load_explicit(&pool->allocs, memory_order_relaxed);
+    out->frees = atomic_load_explicit(&pool->frees, memory_order_relaxed);
+    out->live = atomic_load_explicit(&pool->live, memory_order_relaxed);
+    out->chunks = atomic_load_explicit(&pool->chunks, memory_order_relaxed);
+    out->refills = atomic_load_explicit(&pool->refills, memory_order_relaxed);
+
+    pthread_mutex_lock(&pool->lock);
+    out->cached = pool->nfree;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,76 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Fixed-size object pools for the chat directory (User, Room, ...).
+//
+// Objects are carved out of chunks of SLAB_CHUNK_OBJS and recycled
+// through a free list, so join/leave churn never reaches malloc once a
+// pool has warmed up. Each thread keeps a small cache per pool and only
+// takes the pool lock to move SLAB_CACHE_BATCH objects at a time. A
+// thread's cache goes back to its pools when the thread exits.
+//
+// slab_release() frees every chunk at once. It may only be called when
+// no object from the pool is still in use; objects other threads still
+// hold in their caches are discarded rather than handed out again.
+
+#define SLAB_MAX_POOLS   8      // Pools that can have thread caches
+#define SLAB_CHUNK_OBJS  64     // Objects per chunk
+#define SLAB_CACHE_BATCH 16     // Objects moved between cache and pool
+#define SLAB_CACHE_MAX   64     // Cache size that triggers a give-back
+
+typedef struct SlabChunk {
+    struct SlabChunk *next;
+} SlabChunk;
+
+typedef struct SlabPool {
+    const char *name;
+    size_t size;               // Object size, before rounding
+    atomic_int slot;           // Thread cache index, -1 until first use
+
+    pthread_mutex_t lock;      // Guards free_list, nfree and chunk_list
+    void *free_list;
+    long nfree;
+    SlabChunk *chunk_list;
+    atomic_uint generation;    // Bumped by slab_release()
+
+    // Counters for monitoring, updated without the lock
+    atomic_long allocs;        // Objects handed out, ever
+    atomic_long frees;         // Objects given back, ever
+    atomic_long live;          // Objects currently in use
+    atomic_long chunks;        // Chunks currently allocated
+    atomic_long refills;       // Cache misses that took the pool lock
+} SlabPool;
+
+#define SLAB_POOL_INITIALIZER(type, label) { \
+    .name = (label), \
+    .size = sizeof(type), \
+    .slot = -1, \
+    .lock = PTHREAD_MUTEX_INITIALIZER, \
+}
+
+// Point-in-time copy of a pool's counters
+typedef struct SlabStats {
+    const char *name;
+    size_t size;
+    long allocs;
+    long frees;
+    long live;
+    long chunks;
+    long refills;
+    long cached;               // Free objects in the shared free list
+} SlabStats;
+
+void *slab_alloc(SlabPool *pool);      // Uninitialized object, or NULL
+void slab_free(SlabPool *pool, void *obj);
+void slab_release(SlabPool *pool);     // Free all chunks in one go
+void slab_stats(SlabPool *pool, SlabStats *out);
+
+#endif
@@ -0,0 +1,405 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+// Stress test for the lock-free broadcast path.
+//
+// Writer threads churn the directory the way the server does, with the
+// same locks: users join and leave rooms (rw_lock read, User lock, Room
+// lock), open and close DMs (both User locks), and log out and back in
+// under the write lock, which retires their User and Conn and sends
+// their ids through limbo for reuse. Messenger threads broadcast all the
+// while as sendMessageToRecipients() does: no locks, only the published
+// copies, inside an epoch section, sometimes yielding in the middle to
+// stretch it. Every delivery is checked:
+//   - the User found for an id still carries that id, i.e. it was not
+//     freed and handed to someone else while the section was open
+//   - its Conn was not freed: retired Conns are poisoned and kept, not
+//     released, so a late reader finds the poison
+//   - every id in a published set lies inside the id table
+// Any violation fails the run.
+//
+// Usage: ./stress_directory [-u users] [-r rooms] [-m messengers]
+//                           [-w writers] [-t seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "list.h"
+#include "rwlock.h"
+#include "epoch.h"
+#include "metrics.h"
+
+#define CONN_LIVE 0x11feL
+#define CONN_DEAD 0xdeadL
+
+// Only what the broadcast path looks at
+struct Conn {
+    long magic;
+    struct Conn *next;         // Quarantine link once retired
+};
+
+static int num_users = 2000;
+static int num_rooms = 32;
+static int num_messengers = 4;
+static int num_writers = 4;
+static int seconds = 5;
+
+static RWLock dir_lock = RWLOCK_INITIALIZER;
+static User *user_head = NULL;
+static Room *room_head = NULL;
+static IdTable user_ids;
+static IdTable room_ids;
+static User **slots;           // Churned users; dir_lock guards the pointers
+static Room **rooms;
+static User **senders;         // One per messenger, never churned
+
+static atomic_int running;
+static atomic_long violations;
+
+static pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct Conn *quarantine = NULL;
+static long quarantined = 0;
+
+typedef struct Worker {
+    int id;
+    long ops;
+    long deliveries;
+    long joins, dms, relogins;
+    Bitset recipients;
+} Worker;
+
+static void violation(const char *what, int id) {
+    if (atomic_fetch_add(&violations, 1) < 10) {
+        fprintf(stderr, "violation: %s (id %d)\n", what, id);
+    }
+}
+
+/////////////////// DIRECTORY //////////////////////////
+
+// Retired Conns are poisoned instead of freed
+static void killConn(void *arg) {
+    struct Conn *c = (struct Conn*) arg;
+    c->magic = CONN_DEAD;
+    pthread_mutex_lock(&quarantine_lock);
+    c->next = quarantine;
+    quarantine = c;
+    quarantined++;
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+// Caller holds dir_lock for writing
+static User *login(const char *name) {
+    struct Conn *c = (struct Conn*) calloc(1, sizeof(struct Conn));
+    User *head = prependU(user_head, 0, name);
+    if (c == NULL || head == user_head) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    c->magic = CONN_LIVE;
+    head->conn = c;
+    if ((head->id = idtable_add(&user_ids, head)) == -1) {
+        fprintf(stderr, "out of ids\n");
+        exit(1);
+    }
+    user_head = head;
+    return head;
+}
+
+// Caller holds dir_lock for writing; as removeAllUserConnections(),
+// removeUser() and reactor_close() in the server
+static void logout(User *user) {
+    BITSET_FOREACH(roomId, &user->rooms) {
+        removeUserFromR((Room*) idtable_get(&room_ids, roomId), user->id);
+    }
+    IDLIST_FOREACH(peerId, &user->dmPeers) {
+        removeDirectConn((User*) idtable_get(&user_ids, peerId), user->id);
+    }
+    idtable_remove(&user_ids, user->id);
+    epoch_retire(user->conn, killConn);
+    user_head = unlinkU(user_head, user);
+}
+
+static void lockUserPair(User *a, User *b) {
+    if (a == b) {
+        pthread_mutex_lock(&a->lock);
+        return;
+    }
+    if (a > b) {
+        User *t = a; a = b; b = t;
+    }
+    pthread_mutex_lock(&a->lock);
+    pthread_mutex_lock(&b->lock);
+}
+
+static void unlockUserPair(User *a, User *b) {
+    pthread_mutex_unlock(&a->lock);
+    if (b != a) pthread_mutex_unlock(&b->lock);
+}
+
+/////////////////// THREADS //////////////////////////
+
+static void checkSet(const Bitset *b) {
+    int cap = atomic_load(&user_ids.cap);
+    if (b->nwords > (size_t) (cap + 63) / 64) {
+        violation("published set is larger than the id table", (int) b->nwords * 64);
+    }
+}
+
+static void *messenger(void *arg) {
+    Worker *w = (Worker*) arg;
+    User *sender = senders[w->id];
+    unsigned int seed = w->id + 1;
+
+    while (atomic_load(&running)) {
+        bitset_zero(&w->recipients);
+
+        epoch_enter();
+        Bitset *joined = atomic_load_explicit(&sender->publishedRooms, memory_order_acquire);
+        if (joined != NULL) {
+            BITSET_FOREACH(roomId, joined) {
+                Room *room = (Room*) idtable_peek(&room_ids, roomId);
+                if (room == NULL) {
+                    violation("joined room missing from the table", roomId);
+                    continue;
+                }
+                Bitset *members = atomic_load_explicit(&room->publishedUsers, memory_order_acquire);
+                if (members != NULL) {
+                    checkSet(members);
+                    bitset_or(&w->recipients, members);
+                }
+            }
+        }
+        Bitset *peers = atomic_load_explicit(&sender->publishedConns, memory_order_acquire);
+        if (peers != NULL) {
+            checkSet(peers);
+            bitset_or(&w->recipients, peers);
+        }
+
+        // Give writers time to retire what this section is holding
+        if (rand_r(&seed) % 64 == 0) sched_yield();
+
+        bitset_clear(&w->recipients, sender->id);
+        BITSET_FOREACH(userId, &w->recipients) {
+            User *recipient = (User*) idtable_peek(&user_ids, userId);
+            if (recipient == NULL) continue;   // Left meanwhile
+            if (recipient->id != userId) {
+                violation("user record was reused while still reachable", userId);
+            } else if (recipient->conn->magic != CONN_LIVE) {
+                violation("conn was freed while still reachable", userId);
+            } else {
+                w->deliveries++;
+            }
+        }
+        epoch_exit();
+        w->ops++;
+    }
+    return NULL;
+}
+
+static void *writer(void *arg) {
+    Worker *w = (Worker*) arg;
+    unsigned int seed = w->id + 100;
+
+    while (atomic_load(&running)) {
+        int kind = rand_r(&seed) % 16;
+
+        if (kind == 0) {
+            // Log out and back in: new User, new Conn, maybe a recycled id
+            int slot = rand_r(&seed) % num_users;
+            rwlock_write_lock(&dir_lock);
+            char name[MAX_NAME_LEN];
+            snprintf(name, sizeof(name), "user%d", slot);
+            logout(slots[slot]);
+            slots[slot] = login(name);
+            rwlock_write_unlock(&dir_lock);
+            w->relogins++;
+        } else if (kind < 4) {
+            // Toggle a DM, sometimes with a messenger
+            rwlock_read_lock(&dir_lock);
+            User *a = slots[rand_r(&seed) % num_users];
+            User *b = rand_r(&seed) % 4 == 0 ? senders[rand_r(&seed) % num_messengers]
+                                             : slots[rand_r(&seed) % num_users];
+            if (a != b) {
+                lockUserPair(a, b);
+                if (findDirectConn(a, b->id)) {
+                    removeDirectConn(a, b->id);
+                    removeDirectConn(b, a->id);
+                } else {
+                    addDirectConn(a, b->id);
+                    addDirectConn(b, a->id);
+                }
+                unlockUserPair(a, b);
+            }
+            rwlock_read_unlock(&dir_lock);
+            w->dms++;
+        } else {
+            // Join or leave a room
+            rwlock_read_lock(&dir_lock);
+            User *user = slots[rand_r(&seed) % num_users];
+            Room *room = rooms[rand_r(&seed) % num_rooms];
+            pthread_mutex_lock(&user->lock);
+            rwlock_write_lock(&room->lock);
+            if (bitset_test(&room->users, user->id)) {
+                removeUserFromR(room, user->id);
+                removeRoomFromUser(user, room->id);
+            } else {
+                addUserToR(room, user->id);
+                addRoomToUser(user, room->id);
+            }
+            rwlock_write_unlock(&room->lock);
+            pthread_mutex_unlock(&user->lock);
+            rwlock_read_unlock(&dir_lock);
+            w->joins++;
+        }
+        w->ops++;
+    }
+    return NULL;
+}
+
+// What the server's timer does every EPOCH_TICK_MS, only more often
+static void *reclaimer(void *arg) {
+    while (atomic_load(&running)) {
+        epoch_reclaim();
+        usleep(1000);
+    }
+    return NULL;
+}
+
+/////////////////// MAIN //////////////////////////
+
+static void setup() {
+    rooms = (Room**) malloc(num_rooms * sizeof(Room*));
+    for (int i = 0; i < num_rooms; i++) {
+        char name[MAX_NAME_LEN];
+        snprintf(name, sizeof(name), "room%d", i);
+        room_head = prependR(room_head, name);
+        room_head->id = idtable_add(&room_ids, room_head);
+        rooms[i] = room_head;
+    }
+
+    // Messengers sit in every other room
+    senders = (User**) malloc(num_messengers * sizeof(User*));
+    for (int i = 0; i < num_messengers; i++) {
+        char name[MAX_NAME_LEN];
+        snprintf(name, sizeof(name), "sender%d", i);
+        senders[i] = login(name);
+        for (int r = i % 2; r < num_rooms; r += 2) {
+            addUserToR(rooms[r], senders[i]->id);
+            addRoomToUser(senders[i], rooms[r]->id);
+        }
+    }
+
+    unsigned int seed = 7;
+    slots = (User**) malloc(num_users * sizeof(User*));
+    for (int i = 0; i < num_users; i++) {
+        char name[MAX_NAME_LEN];
+        snprintf(name, sizeof(name), "user%d", i);
+        slots[i] = login(name);
+        for (int j = 0; j < 2; j++) {
+            Room *room = rooms[rand_r(&seed) % num_rooms];
+            addUserToR(room, slots[i]->id);
+            addRoomToUser(slots[i], room->id);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "u:r:m:w:t:")) != -1) {
+        switch (opt) {
+        case 'u': num_users = atoi(optarg); break;
+        case 'r': num_rooms = atoi(optarg); break;
+        case 'm': num_messengers = atoi(optarg); break;
+        case 'w': num_writers = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-u users] [-r rooms] [-m messengers] "
+                            "[-w writers] [-t seconds]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (num_users < 2 || num_rooms < 1 || num_messengers < 1 || num_writers < 1) {
+        fprintf(stderr, "need at least 2 users and one room, messenger and writer\n");
+        exit(1);
+    }
+
+    setup();
+    printf("%d users, %d rooms, %d messengers, %d writers, %ds\n\n",
+           num_users, num_rooms, num_messengers, num_writers, seconds);
+
+    Worker mw[num_messengers], ww[num_writers];
+    pthread_t mt[num_messengers], wt[num_writers], rt;
+    atomic_store(&running, 1);
+
+    for (int i = 0; i < num_messengers; i++) {
+        memset(&mw[i], 0, sizeof(Worker));
+        mw[i].id = i;
+        pthread_create(&mt[i], NULL, messenger, &mw[i]);
+    }
+    for (int i = 0; i < num_writers; i++) {
+        memset(&ww[i], 0, sizeof(Worker));
+        ww[i].id = i;
+        pthread_create(&wt[i], NULL, writer, &ww[i]);
+    }
+    pthread_create(&rt, NULL, reclaimer, NULL);
+
+    sleep(seconds);
+    atomic_store(&running, 0);
+
+    long messages = 0, deliveries = 0, joins = 0, dms = 0, relogins = 0;
+    for (int i = 0; i < num_messengers; i++) {
+        pthread_join(mt[i], NULL);
+        messages += mw[i].ops;
+        deliveries += mw[i].deliveries;
+        bitset_free(&mw[i].recipients);
+    }
+    for (int i = 0; i < num_writers; i++) {
+        pthread_join(wt[i], NULL);
+        joins += ww[i].joins;
+        dms += ww[i].dms;
+        relogins += ww[i].relogins;
+    }
+    pthread_join(rt, NULL);
+
+    freeAllUsers(&user_head);   // Drains everything still retired
+    MetricsSnapshot snap;
+    metrics_snapshot(&snap);
+
+    printf("%-22s %12.0f/s\n", "messages", (double) messages / seconds);
+    printf("%-22s %12.0f/s\n", "deliveries", (double) deliveries / seconds);
+    printf("%-22s %12.0f/s\n", "joins + leaves", (double) joins / seconds);
+    printf("%-22s %12.0f/s\n", "dm changes", (double) dms / seconds);
+    printf("%-22s %12.0f/s\n", "relogins", (double) relogins / seconds);
+    printf("%-22s %12ld\n", "retired", snap.counters[M_EPOCH_RETIRED]);
+    printf("%-22s %12ld\n", "freed", snap.counters[M_EPOCH_FREED]);
+    printf("%-22s %12ld of %ld\n", "conns poisoned", quarantined, relogins);
+
+    long bad = atomic_load(&violations);
+    if (quarantined != relogins || snap.counters[M_EPOCH_FREED] != snap.counters[M_EPOCH_RETIRED]) {
+        printf("\nFAILED: retired memory was not all reclaimed\n");
+        bad++;
+    } else if (bad > 0) {
+        printf("\nFAILED: %ld violations\n", bad);
+    } else {
+        printf("\nOK\n");
+    }
+
+    while (quarantine != NULL) {
+        struct Conn *next = quarantine->next;
+        free(quarantine);
+        quarantine = next;
+    }
+    freeAllRooms(&room_head);
+    idtable_free(&user_ids);
+    idtable_free(&room_ids);
+    free(slots);
+    free(senders);
+    free(rooms);
+    return bad > 0 ? 1 : 0;
+}
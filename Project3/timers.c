@@ -0,0 +1,179 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "timers.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+#define SLOT_BITS 6                      // log2(TIMER_SLOTS)
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define TICK_NS   (TIMER_TICK_MS * 1000000L)
+
+typedef struct Wheel {
+    pthread_mutex_t lock;
+    pthread_cond_t idle;                 // Signalled when a callback returns
+    long now;                            // Next tick to run
+    int started;
+    Timer *running;                      // Callback in progress, or NULL
+    Timer slots[TIMER_LEVELS][TIMER_SLOTS];   // List heads
+} Wheel;
+
+static Wheel wheel = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+};
+
+static long tick_of(long ns) {
+    return (ns + TICK_NS - 1) / TICK_NS;
+}
+
+/////////////////// SLOTS //////////////////////////
+
+static void unlink_timer(Timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->armed = 0;
+}
+
+// The finest level whose span from now reaches the deadline. Caller
+// holds the lock.
+static void link_timer(Timer *t) {
+    long delta = t->expires - wheel.now;
+    int level = 0;
+
+    if (delta < 0) {
+        t->expires = wheel.now;          // Overdue: the next tick
+        delta = 0;
+    }
+    while (level < TIMER_LEVELS - 1 && delta >= (1L << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    long max = (1L << (SLOT_BITS * TIMER_LEVELS)) - 1;
+    if (delta > max) {
+        t->expires = wheel.now + max;    // Farther than the wheel reaches
+    }
+
+    Timer *head = &wheel.slots[level][(t->expires >> (SLOT_BITS * level)) & SLOT_MASK];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    t->armed = 1;
+}
+
+// Move every timer of a coarse slot down to where it now belongs
+static void cascade(int level) {
+    Timer *head = &wheel.slots[level][(wheel.now >> (SLOT_BITS * level)) & SLOT_MASK];
+    while (head->next != head) {
+        Timer *t = head->next;
+        unlink_timer(t);
+        link_timer(t);
+    }
+}
+
+/////////////////// TIMER THREAD //////////////////////////
+
+// Run one tick. Caller holds the lock; it is dropped around callbacks.
+static void run_tick() {
+    // Each time a level wraps, the next coarser slot comes due
+    for (int level = 1; level < TIMER_LEVELS; level++) {
+        if ((wheel.now & ((1L << (SLOT_BITS * level)) - 1)) != 0) break;
+        cascade(level);
+    }
+
+    Timer *head = &wheel.slots[0][wheel.now & SLOT_MASK];
+    wheel.now++;
+
+    while (head->next != head) {
+        Timer *t = head->next;
+        unlink_timer(t);
+        t->cancelled = 0;
+        wheel.running = t;
+        pthread_mutex_unlock(&wheel.lock);
+
+        long now = metrics_now_ns();
+        long again = t->fn(t, now);
+
+        pthread_mutex_lock(&wheel.lock);
+        wheel.running = NULL;
+        // timer_arm() from elsewhere meanwhile wins over `again`
+        if (again != 0 && !t->cancelled && !t->armed) {
+            t->expires = tick_of(again);
+            link_timer(t);
+        }
+        pthread_cond_broadcast(&wheel.idle);
+    }
+}
+
+static void *timer_main(void *arg) {
+    while (1) {
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = TICK_NS };
+        nanosleep(&ts, NULL);
+
+        long target = metrics_now_ns() / TICK_NS;
+        pthread_mutex_lock(&wheel.lock);
+        while (wheel.now <= target) {
+            run_tick();
+        }
+        pthread_mutex_unlock(&wheel.lock);
+    }
+    return NULL;
+}
+
+int timers_start() {
+    pthread_mutex_lock(&wheel.lock);
+    wheel.now = metrics_now_ns() / TICK_NS;
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        for (int i = 0; i < TIMER_SLOTS; i++) {
+            wheel.slots[level][i].next = wheel.slots[level][i].prev = &wheel.slots[level][i];
+        }
+    }
+    wheel.started = 1;
+    pthread_mutex_unlock(&wheel.lock);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, timer_main, NULL) != 0) {
+        perror("pthread_create timers");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/////////////////// PUBLIC API //////////////////////////
+
+void timer_init(Timer *t, timer_fn fn, void *arg) {
+    t->next = t->prev = NULL;
+    t->expires = 0;
+    t->armed = 0;
+    t->cancelled = 0;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+void timer_arm(Timer *t, long when) {
+    pthread_mutex_lock(&wheel.lock);
+    if (wheel.started) {
+        if (t->armed) unlink_timer(t);
+        t->cancelled = 0;
+        t->expires = tick_of(when);
+        link_timer(t);
+    }
+    pthread_mutex_unlock(&wheel.lock);
+}
+
+void timer_cancel(Timer *t) {
+    pthread_mutex_lock(&wheel.lock);
+    if (t->armed) unlink_timer(t);
+    if (wheel.running == t) {
+        t->cancelled = 1;
+        while (wheel.running == t) {
+            pthread_cond_wait(&wheel.idle, &wheel.lock);
+        }
+    }
+    pthread_mutex_unlock(&wheel.lock);
+}
@@ -0,0 +1,55 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef TIMERS_H
+#define TIMERS_H
+
+// Connection timers on a hierarchical timing wheel.
+//
+// One wheel and one timer thread serve every connection, so a deadline
+// costs a list node in its Conn, not a thread or a kernel timer. Arming
+// and cancelling unlink and link a node: O(1) whatever the number of
+// timers. The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots; level
+// 0 slots are TIMER_TICK_MS wide and each level above is TIMER_SLOTS
+// times coarser. A timer sits in the finest level that reaches its
+// deadline and moves down a level (a cascade) each time its coarse slot
+// comes around, so it is touched at most once per level.
+//
+// Expiry is rounded up to the next tick. Callbacks run on the timer
+// thread without the wheel lock held, one at a time, and may take any
+// lock except by waiting for a timer to be cancelled.
+
+#define TIMER_TICK_MS 100
+#define TIMER_LEVELS  4
+#define TIMER_SLOTS   64                // Per level; 4 x 64 reaches 19 days
+
+typedef struct Timer Timer;
+
+// Called once `t` expires. Returns the time (metrics_now_ns() clock) to
+// run again at, or 0 to stay disarmed.
+typedef long (*timer_fn)(Timer *t, long now);
+
+struct Timer {
+    Timer *next;
+    Timer *prev;
+    long expires;                       // Tick
+    int armed;                          // Linked into a slot
+    int cancelled;                      // Cancelled while its callback ran
+    timer_fn fn;
+    void *arg;
+};
+
+// Start the timer thread. Returns -1 if it could not be started.
+int timers_start();
+
+void timer_init(Timer *t, timer_fn fn, void *arg);
+
+// (Re)arm `t` to run at `when`, replacing any earlier deadline
+void timer_arm(Timer *t, long when);
+
+// Disarm `t`. If its callback is running, wait for it to return; after
+// this the callback does not run again until `t` is armed anew.
+void timer_cancel(Timer *t);
+
+#endif
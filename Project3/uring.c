@@ -0,0 +1,218 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argsz) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned nargs) {
+    return (int) syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+// Multishot accept and recv arrived in 5.19 and 6.0; there is no feature
+// bit to test for them
+static int kernel_at_least(int major, int minor) {
+    struct utsname un;
+    int maj = 0, min = 0;
+    if (uname(&un) == -1 || sscanf(un.release, "%d.%d", &maj, &min) != 2) return 0;
+    return maj > major || (maj == major && min >= minor);
+}
+
+/////////////////// SETUP //////////////////////////
+
+static int setup_buffers(Uring *u) {
+    size_t ring_bytes = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+
+    if (posix_memalign((void**) &u->buf_ring, sysconf(_SC_PAGESIZE), ring_bytes) != 0) {
+        u->buf_ring = NULL;
+        return -1;
+    }
+    u->bufs = (char*) malloc((size_t) URING_BUF_COUNT * URING_BUF_SIZE);
+    if (u->bufs == NULL) return -1;
+    memset(u->buf_ring, 0, ring_bytes);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) u->buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (sys_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        perror("io_uring provided buffers");
+        return -1;
+    }
+
+    for (unsigned i = 0; i < URING_BUF_COUNT; i++) {
+        uring_recycle(u, i);
+    }
+    return 0;
+}
+
+int uring_init(Uring *u) {
+    struct io_uring_params p;
+
+    memset(u, 0, sizeof(Uring));
+    u->fd = -1;
+
+    if (!kernel_at_least(6, 0)) {
+        fprintf(stderr, "io_uring backend needs Linux 6.0 or later\n");
+        return -1;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_ENTRIES * 4;
+    if ((u->fd = sys_setup(URING_ENTRIES, &p)) == -1) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_EXT_ARG)) {
+        fprintf(stderr, "io_uring lacks needed features\n");
+        uring_free(u);
+        return -1;
+    }
+
+    // Submission and completion rings share one mapping
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    u->ring_mem = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe*) mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->ring_mem == MAP_FAILED || u->sqes == MAP_FAILED) {
+        perror("io_uring mmap");
+        if (u->ring_mem == MAP_FAILED) u->ring_mem = NULL;
+        if (u->sqes == MAP_FAILED) u->sqes = NULL;
+        uring_free(u);
+        return -1;
+    }
+
+    char *ring = (char*) u->ring_mem;
+    u->sq_head = (unsigned*) (ring + p.sq_off.head);
+    u->sq_tail = (unsigned*) (ring + p.sq_off.tail);
+    u->sq_mask = *(unsigned*) (ring + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sq_array = (unsigned*) (ring + p.sq_off.array);
+    u->sq_local_tail = *u->sq_tail;
+    u->cq_head = (unsigned*) (ring + p.cq_off.head);
+    u->cq_tail = (unsigned*) (ring + p.cq_off.tail);
+    u->cq_mask = *(unsigned*) (ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*) (ring + p.cq_off.cqes);
+
+    if (setup_buffers(u) == -1) {
+        uring_free(u);
+        return -1;
+    }
+    return 0;
+}
+
+void uring_free(Uring *u) {
+    if (u->sqes != NULL) munmap(u->sqes, u->sqes_size);
+    if (u->ring_mem != NULL) munmap(u->ring_mem, u->ring_size);
+    if (u->fd != -1) close(u->fd);
+    free(u->buf_ring);
+    free(u->bufs);
+    memset(u, 0, sizeof(Uring));
+    u->fd = -1;
+}
+
+/////////////////// SUBMISSION //////////////////////////
+
+// Make filled-in entries visible to the kernel
+static unsigned publish(Uring *u) {
+    unsigned tail = *u->sq_tail;
+    unsigned count = u->sq_local_tail - tail;
+    for (; tail != u->sq_local_tail; tail++) {
+        u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+    }
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+    return count;
+}
+
+struct io_uring_sqe *uring_sqe(Uring *u) {
+    while (u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+        unsigned count = publish(u);
+        if (sys_enter(u->fd, count, 0, 0, NULL, 0) == -1 && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter");
+        }
+    }
+    struct io_uring_sqe *sqe = &u->sqes[u->sq_local_tail & u->sq_mask];
+    u->sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_wait(Uring *u, int timeout_ms) {
+    unsigned count = publish(u);
+    unsigned flags = 0;
+    unsigned wait = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+
+    memset(&arg, 0, sizeof(arg));
+    if (timeout_ms > 0 && uring_peek(u) == NULL) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (unsigned long) &ts;
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        wait = 1;
+    }
+    if (count == 0 && wait == 0) return 0;
+
+    if (sys_enter(u->fd, count, wait, flags, wait ? &arg : NULL, wait ? sizeof(arg) : 0) == -1) {
+        // Timeouts and signals are normal; a full completion queue just
+        // means reaping first
+        if (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN) return 0;
+        perror("io_uring_enter");
+        return -1;
+    }
+    return 0;
+}
+
+/////////////////// COMPLETION //////////////////////////
+
+struct io_uring_cqe *uring_peek(Uring *u) {
+    unsigned head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &u->cqes[head & u->cq_mask];
+}
+
+void uring_seen(Uring *u) {
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/////////////////// BUFFERS //////////////////////////
+
+char *uring_buffer(Uring *u, unsigned id) {
+    return u->bufs + (size_t) id * URING_BUF_SIZE;
+}
+
+void uring_recycle(Uring *u, unsigned id) {
+    struct io_uring_buf *buf = &u->buf_ring->bufs[u->buf_tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (unsigned long) uring_buffer(u, id);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = id;
+    u->buf_tail++;
+    __atomic_store_n(&u->buf_ring->tail, u->buf_tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,72 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// A minimal io_uring, driven through the raw system calls (no liburing).
+//
+// One thread owns a Uring: it alone fills submission entries and reaps
+// completions, so the ring indexes need no lock, only the ordering the
+// kernel requires. Received data lands in a ring of provided buffers
+// that the kernel picks from, so an idle connection holds no buffer.
+
+#define URING_ENTRIES     1024     // Submission queue; the completion queue is 4x
+#define URING_BUF_GROUP   0
+#define URING_BUF_COUNT   1024     // Provided receive buffers (a power of two)
+#define URING_BUF_SIZE    4096
+
+typedef struct Uring {
+    int fd;
+
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;        // Entries filled in but not yet published
+    struct io_uring_sqe *sqes;
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring_mem;
+    size_t ring_size;
+    size_t sqes_size;
+
+    // Provided buffers
+    struct io_uring_buf_ring *buf_ring;
+    char *bufs;
+    unsigned short buf_tail;
+} Uring;
+
+// Set up the ring and its receive buffers. Returns -1, with the reason
+// printed, if this kernel cannot run the io_uring backend.
+int uring_init(Uring *u);
+void uring_free(Uring *u);
+
+// A zeroed submission entry, submitting queued ones first if the queue
+// is full. Never NULL.
+struct io_uring_sqe *uring_sqe(Uring *u);
+
+// Submit what is queued, then wait up to `timeout_ms` for at least one
+// completion (0: do not wait). Returns -1 on a ring error.
+int uring_wait(Uring *u, int timeout_ms);
+
+// Next completion, or NULL. uring_seen() retires it.
+struct io_uring_cqe *uring_peek(Uring *u);
+void uring_seen(Uring *u);
+
+// A provided buffer picked by the kernel, and giving it back
+char *uring_buffer(Uring *u, unsigned id);
+void uring_recycle(Uring *u, unsigned id);
+
+#endif
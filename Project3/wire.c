@@ -0,0 +1,132 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#include "wire.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PROMPT "chat>"
+
+/////////////////// REQUESTS //////////////////////////
+
+// What each request op runs and its payload: one letter per argument as
+// in wire.h, the first `min` of them required
+static const struct {
+    CommandId id;
+    const char *args;
+    int min;
+} requests[WIRE_REQUEST_OPS] = {
+    [WIRE_MESSAGE] = { CMD_MESSAGE, "t", 1 },
+    [WIRE_LOGIN] = { CMD_LOGIN, "w", 1 },
+    [WIRE_CREATE] = { CMD_CREATE, "w", 1 },
+    [WIRE_JOIN] = { CMD_JOIN, "w", 1 },
+    [WIRE_LEAVE] = { CMD_LEAVE, "w", 1 },
+    [WIRE_CONNECT] = { CMD_CONNECT, "w", 1 },
+    [WIRE_DISCONNECT] = { CMD_DISCONNECT, "w", 1 },
+    [WIRE_MSG] = { CMD_MSG, "wt", 2 },
+    [WIRE_ROOMS] = { CMD_ROOMS, "uu", 0 },
+    [WIRE_USERS] = { CMD_USERS, "uu", 0 },
+    [WIRE_HISTORY] = { CMD_HISTORY, "wu", 1 },
+    [WIRE_HELP] = { CMD_HELP, "", 0 },
+    [WIRE_PING] = { CMD_EMPTY, "", 0 },
+    [WIRE_EXIT] = { CMD_EXIT, "", 0 },
+    [WIRE_COMPRESS] = { CMD_COMPRESS, "w", 0 },
+};
+
+// A string argument must read back the same way a typed one would: no
+// NUL, no newline, and a word has no whitespace at all
+static int valid_string(const char *s, size_t len, char kind) {
+    if (memchr(s, '\0', len) != NULL || memchr(s, '\n', len) != NULL) return 0;
+    if (kind == 'w') {
+        if (len == 0) return 0;
+        for (size_t i = 0; i < len; i++) {
+            if (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\v' || s[i] == '\f') return 0;
+        }
+    }
+    return 1;
+}
+
+int wire_decode(const char *frame, size_t len, WireRequest *req) {
+    if (len < WIRE_HEADER || len != wire_frame_len(frame)) return -1;
+
+    int op = (unsigned char) frame[0];
+    if (op >= WIRE_REQUEST_OPS || requests[op].args == NULL) return -1;
+
+    Command *cmd = &req->cmd;
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->id = requests[op].id;
+    req->tag = wire_tag(frame);
+
+    const char *p = frame + WIRE_HEADER;
+    const char *end = frame + len;
+    char *out = req->store;
+    for (const char *kind = requests[op].args; *kind != '\0' && p < end; kind++) {
+        Slice *arg = &cmd->args[cmd->argc++];
+        arg->ptr = out;
+
+        if (*kind == 'u') {
+            if (end - p < 4) return -1;
+            arg->len = sprintf(out, "%lu", wire_get32(p));
+            p += 4;
+        } else {
+            if (end - p < 2) return -1;
+            size_t n = wire_get16(p);
+            p += 2;
+            if ((size_t) (end - p) < n || !valid_string(p, n, *kind)) return -1;
+            memcpy(out, p, n);
+            out[n] = '\0';
+            arg->len = n;
+            p += n;
+        }
+        out += arg->len + 1;
+    }
+    if (p != end || cmd->argc < requests[op].min) return -1;
+    return 0;
+}
+
+/////////////////// SERVER FRAMES //////////////////////////
+
+MsgBuf *wire_frame(int op, int code, unsigned int tag, size_t len) {
+    MsgBuf *m = msgbuf_alloc(WIRE_HEADER + len);
+    if (m == NULL) return NULL;
+    wire_put_header(m->data, op, code, tag, len);
+    m->frame = m;
+    return m;
+}
+
+MsgBuf *wire_reply(unsigned int tag, int status, const char *subject) {
+    if (subject == NULL) subject = "";
+    size_t n = strlen(subject);
+    MsgBuf *m = wire_frame(WIRE_REPLY, status, tag, 2 + n);
+    if (m != NULL) wire_put_string(m->data + WIRE_HEADER, subject, n);
+    return m;
+}
+
+MsgBuf *wire_chat(int dm, unsigned long sender, const char *name, const char *text, size_t len) {
+    size_t name_len = strlen(name);
+    MsgBuf *m = wire_frame(WIRE_CHAT, dm, 0, 4 + 2 + name_len + 2 + len);
+    if (m != NULL) {
+        char *p = wire_put32(m->data + WIRE_HEADER, sender);
+        p = wire_put_string(p, name, name_len);
+        wire_put_string(p, text, len);
+    }
+    return m;
+}
+
+MsgBuf *wire_text(const char *text, size_t len) {
+    size_t prompt = strlen(PROMPT);
+
+    if (len >= prompt && memcmp(text + len - prompt, PROMPT, prompt) == 0) len -= prompt;
+    while (len > 0 && text[0] == '\n') {
+        text++;
+        len--;
+    }
+    while (len > 0 && text[len - 1] == '\n') len--;
+    if (len > 0xffff) len = 0xffff;
+
+    MsgBuf *m = wire_frame(WIRE_TEXT, 0, 0, 2 + len);
+    if (m != NULL) wire_put_string(m->data + WIRE_HEADER, text, len);
+    return m;
+}
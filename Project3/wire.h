@@ -0,0 +1,160 @@
+// Group Members:
+// Sijan Shrestha
+// Utsav Shah
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "msgbuf.h"
+#include "parser.h"
+#include "command.h"
+
+// Binary protocol for machine clients.
+//
+// A client switches to it with the text command "binary [version]". The
+// plain-text acknowledgement is the last text it gets; from then on both
+// directions are frames, for the rest of the connection:
+//
+//   u8 op | u8 code | u16 tag | u32 length | payload (length bytes)
+//
+// all big-endian. A request carries a tag of the client's choosing and
+// its reply carries it back; events the client did not ask for have tag
+// 0. Payloads are made of fields: a string is a u16 length and its bytes
+// (no terminator), a number a u32. Requests run through the same command
+// handlers as text lines, so they behave exactly like their text
+// command; only the reply is a status code and at most one name instead
+// of a sentence with a "chat>" prompt. Frames are not held to the
+// per-line rate (-r); the room and create/login limits still apply.
+//
+// Requests (w: a word, no whitespace; t: text, no newline; u: a number;
+// [ ]: may be left out from the end):
+//   MESSAGE t              chat line to the sender's rooms and DM peers
+//   LOGIN w, CREATE w, JOIN w, LEAVE w, CONNECT w, DISCONNECT w
+//   MSG w t                chat line to one DM peer
+//   ROOMS [u offset [u limit]], USERS [u offset [u limit]]
+//   HISTORY w [u count]
+//   HELP, PING, EXIT, COMPRESS [w "off"]
+//
+// Server frames:
+//   REPLY    code status, payload one string (the subject, may be empty)
+//   LIST     u32 total, u32 offset of the first name, one string per name
+//   RECORDS  u32 count, then the raw history records, "\n"-terminated
+//   CHAT     code 1 for a DM; u32 sender's user id, string name, string text
+//   TEXT     anything else the server says (idle warnings, relayed chat
+//            from other servers, shutdown notices), as one string
+
+#define WIRE_VERSION 1
+#define WIRE_HEADER 8
+#define WIRE_MAX_FRAME (MAX_LINE_LEN + 1)   // Longest request, header included
+
+typedef enum WireOp {
+    WIRE_MESSAGE = 0x01,
+    WIRE_LOGIN = 0x02,
+    WIRE_CREATE = 0x03,
+    WIRE_JOIN = 0x04,
+    WIRE_LEAVE = 0x05,
+    WIRE_CONNECT = 0x06,
+    WIRE_DISCONNECT = 0x07,
+    WIRE_MSG = 0x08,
+    WIRE_ROOMS = 0x09,
+    WIRE_USERS = 0x0a,
+    WIRE_HISTORY = 0x0b,
+    WIRE_HELP = 0x0c,
+    WIRE_PING = 0x0d,
+    WIRE_EXIT = 0x0e,
+    WIRE_COMPRESS = 0x0f,
+    WIRE_REQUEST_OPS,
+
+    WIRE_REPLY = 0x80,
+    WIRE_LIST = 0x81,
+    WIRE_RECORDS = 0x82,
+    WIRE_CHAT = 0x90,
+    WIRE_TEXT = 0x91,
+} WireOp;
+
+typedef enum WireStatus {
+    WIRE_OK = 0,
+    WIRE_NOT_FOUND = 1,        // No such user or room
+    WIRE_TAKEN = 2,            // LOGIN: the name is in use
+    WIRE_NOT_CONNECTED = 3,    // MSG: no DM with that user
+    WIRE_LIMITED = 4,          // Over a rate limit, try again later
+    WIRE_TOO_LONG = 5,         // Frame over WIRE_MAX_FRAME, skipped
+    WIRE_BAD_REQUEST = 6,      // Unknown op or malformed payload
+    WIRE_UNAVAILABLE = 7,      // Disabled or out of resources
+} WireStatus;
+
+// A decoded request. Its arguments point into `store`, NUL terminated;
+// numbers are handed on in decimal, as a text client would type them.
+typedef struct WireRequest {
+    unsigned int tag;
+    Command cmd;
+    char store[WIRE_MAX_FRAME + COMMAND_MAX_ARGS * 12];
+} WireRequest;
+
+static inline unsigned int wire_get16(const char *p) {
+    const unsigned char *u = (const unsigned char*) p;
+    return (unsigned int) u[0] << 8 | u[1];
+}
+
+static inline unsigned long wire_get32(const char *p) {
+    const unsigned char *u = (const unsigned char*) p;
+    return (unsigned long) u[0] << 24 | (unsigned long) u[1] << 16 | (unsigned long) u[2] << 8 | u[3];
+}
+
+static inline char *wire_put16(char *p, unsigned int v) {
+    p[0] = (char) (v >> 8);
+    p[1] = (char) v;
+    return p + 2;
+}
+
+static inline char *wire_put32(char *p, unsigned long v) {
+    p[0] = (char) (v >> 24);
+    p[1] = (char) (v >> 16);
+    p[2] = (char) (v >> 8);
+    p[3] = (char) v;
+    return p + 4;
+}
+
+static inline char *wire_put_string(char *p, const char *s, size_t len) {
+    p = wire_put16(p, len);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+// Write a header; returns where the payload goes
+static inline char *wire_put_header(char *p, int op, int code, unsigned int tag, size_t len) {
+    p[0] = (char) op;
+    p[1] = (char) code;
+    p = wire_put16(p + 2, tag);
+    return wire_put32(p, len);
+}
+
+// Frame size, header included, from a complete header
+static inline size_t wire_frame_len(const char *header) {
+    return WIRE_HEADER + wire_get32(header + 4);
+}
+
+static inline unsigned int wire_tag(const char *header) {
+    return wire_get16(header + 2);
+}
+
+// Decode one complete request frame. Returns -1 for an unknown op or a
+// payload that does not fit it.
+int wire_decode(const char *frame, size_t len, WireRequest *req);
+
+// A frame in a new MsgBuf, with `len` payload bytes for the caller to
+// fill in after the header. Its `frame` points to itself.
+MsgBuf *wire_frame(int op, int code, unsigned int tag, size_t len);
+
+MsgBuf *wire_reply(unsigned int tag, int status, const char *subject);
+
+MsgBuf *wire_chat(int dm, unsigned long sender, const char *name, const char *text, size_t len);
+
+// A TEXT frame for server output written for text clients: the blank
+// line in front and the "chat>" prompt are left out
+MsgBuf *wire_text(const char *text, size_t len);
+
+#endif